@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <deque>
+#include <functional>
+#include <curl/curl.h>
+
+#include "AsyncTask.hpp"
+#include "SkidBot.hpp"
+#include "Logger.hpp"
+
+// Local function prototypes
+static void *asyncThread (void *);
+static size_t asyncWriteCallback (void *contents, size_t size, size_t nmemb, void *userp);
+
+// Global varibles
+pthread_t async_thread_ids[ASYNC_MAX_THREADS];
+uint8_t async_thread_count = 0;
+pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+std::deque<std::function<void ()>> async_work;
+bool async_running = false;
+
+extern Logger *logger;
+
+
+/**
+ * Starts the threads that run the blocking work tasks wait on, returns how many were started, or -1 if
+ * none were, in which case the work is run by whoever awaits it
+ */
+int setupAsyncTasks (uint8_t threads)
+{
+	uint8_t t;
+
+	if ((threads < 1) || (threads > ASYNC_MAX_THREADS))
+	{
+		logger->logf (" AsyncTask: I can't use %d threads, so I'm using %d.\n", threads, ASYNC_THREADS);
+		threads = ASYNC_THREADS;
+	}
+
+	curl_global_init (CURL_GLOBAL_ALL);
+
+	lock (async_mutex);
+	async_running = true;
+	release (async_mutex);
+
+	for (t = 0; t < threads; t++)
+	{
+		if (pthread_create (&async_thread_ids[t], NULL, asyncThread, NULL) != 0)
+		{
+			logger->logf (" AsyncTask: I was unable to start thread %d, reason: %s.\n", t, strerror(errno));
+			break;
+		}
+	}
+
+	async_thread_count = t;
+	if (async_thread_count == 0)
+	{
+		lock (async_mutex);
+		async_running = false;
+		release (async_mutex);
+		return -1;
+	}
+	logger->logf (" AsyncTask: I've started %d threads for database and api calls.\n", async_thread_count);
+
+	return async_thread_count;
+}
+
+
+/**
+ * Queues blocking work for the next free async thread, if they aren't running it's run straight away
+ */
+void asyncSubmit (std::function<void ()> &&work)
+{
+	lock (async_mutex);
+	if (!async_running)
+	{
+		release (async_mutex);
+		work ();
+		return;
+	}
+	async_work.push_back (std::move (work));
+	pthread_cond_signal (&async_cond);
+	release (async_mutex);
+}
+
+
+/**
+ * Called when a task stops on an exception it didn't catch, the task is dropped but we carry on
+ */
+void asyncTaskFailed (void)
+{
+	logger->log (" AsyncTask: A task stopped on an error it didn't handle, so I've dropped it.\n");
+}
+
+
+/**
+ * Lets the async threads finish the work they were given and waits for them to close, the dispatcher
+ * should be stopped first so no task is left waiting
+ */
+void stopAsyncTasks (void)
+{
+	uint8_t t;
+
+	lock (async_mutex);
+	async_running = false;
+	pthread_cond_broadcast (&async_cond);
+	release (async_mutex);
+
+	for (t = 0; t < async_thread_count; t++)
+	{
+		pthread_join (async_thread_ids[t], NULL);
+	}
+	async_thread_count = 0;
+}
+
+
+/**
+ * Runs a query on an async thread, the caller frees the result
+ */
+AsyncCall<MYSQL_RES *> asyncQuery (MySQLHandler *mysql, std::string query)
+{
+	return AsyncCall<MYSQL_RES *> ([mysql, query] () -> MYSQL_RES *
+	{
+		return mysql->mysqlQuery ("%s", query.c_str());
+	});
+}
+
+
+/**
+ * Sends a GET request on an async thread
+ */
+AsyncCall<async_response> asyncFetch (std::string url, long timeout)
+{
+	return AsyncCall<async_response> ([url, timeout] () -> async_response
+	{
+		async_response response;
+		CURL *curl = curl_easy_init ();
+		if (!curl)
+		{
+			response.error = "unable to start curl";
+			return response;
+		}
+
+		curl_easy_setopt (curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, asyncWriteCallback);
+		curl_easy_setopt (curl, CURLOPT_WRITEDATA, &response.body);
+		curl_easy_setopt (curl, CURLOPT_TIMEOUT, timeout);
+		curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+		CURLcode res = curl_easy_perform (curl);
+		if (res != CURLE_OK)
+		{
+			response.error = curl_easy_strerror (res);
+		}
+		else
+		{
+			response.ok = true;
+			curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &response.status);
+		}
+		curl_easy_cleanup (curl);
+
+		return response;
+	});
+}
+
+
+/**
+ * asyncThread, runs queued blocking work until it's stopped and the queue is empty
+ */
+static void *asyncThread (void *)
+{
+	lock (async_mutex);
+	while (true)
+	{
+		if (!async_work.empty ())
+		{
+			std::function<void ()> work = std::move (async_work.front ());
+			async_work.pop_front ();
+			release (async_mutex);
+			work ();
+			lock (async_mutex);
+		}
+		else if (!async_running)
+		{
+			break;
+		}
+		else
+		{
+			pthread_cond_wait (&async_cond, &async_mutex);
+		}
+	}
+	release (async_mutex);
+
+	return NULL;
+}
+
+
+/**
+ * Curl callback function, adds the reply to the response's body
+ */
+static size_t asyncWriteCallback (void *contents, size_t size, size_t nmemb, void *userp)
+{
+	((std::string*)userp)->append((char*)contents, size * nmemb);
+	return size * nmemb;
+}
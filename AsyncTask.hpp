@@ -0,0 +1,107 @@
+#ifndef	_ASYNC_TASK_H
+#define _ASYNC_TASK_H
+
+#include <stdint.h>
+
+#include <coroutine>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "MySQLHandler.hpp"
+#include "Dispatcher.hpp"
+
+// Defines how many threads run the blocking work tasks wait on, and how long an api call may take
+#define ASYNC_THREADS			4
+#define ASYNC_MAX_THREADS		16
+#define ASYNC_HTTP_TIMEOUT		10
+
+// Holds the reply to an api call
+typedef struct async_response
+{
+	bool ok = false;					// Set when the request was sent and a reply came back
+	long status = 0;					// The HTTP status of the reply
+	std::string body;
+	std::string error;					// Why the request failed, when it did
+} async_response;
+
+// Global function prototypes
+int setupAsyncTasks (uint8_t threads);
+void asyncSubmit (std::function<void ()> &&work);
+void asyncTaskFailed (void);
+void stopAsyncTasks (void);
+
+// Define the AsyncTask class
+class AsyncTask;
+
+// Build the AsyncTask class template, the return type of a coroutine that runs as soon as it's called and
+// frees itself when it finishes. Nothing waits on it, so it should take everything it needs by value.
+class AsyncTask
+{
+public:
+	struct promise_type
+	{
+		AsyncTask get_return_object (void) { return AsyncTask (); }
+		std::suspend_never initial_suspend (void) noexcept { return {}; }
+		std::suspend_never final_suspend (void) noexcept { return {}; }
+		void return_void (void) {}
+		void unhandled_exception (void) { asyncTaskFailed (); }
+	};
+};
+
+// Define the AsyncCall class
+template <typename T> class AsyncCall;
+
+// Build the AsyncCall class template, awaiting it runs blocking work on one of the async threads. A task
+// started on a dispatch worker carries on back on that worker, so it keeps to its room's state, and the
+// worker handles other lines in the meantime. Anywhere else it carries on on the async thread.
+template <typename T> class AsyncCall
+{
+private:
+	// Private variables
+	std::function<T ()> work;
+	T result {};
+
+public:
+	// Constructors and destructor
+	AsyncCall (std::function<T ()> &&new_work) : work (std::move (new_work)) {}
+
+	// Public methods
+	bool await_ready (void) { return false; }
+	void await_suspend (std::coroutine_handle<> task)
+	{
+		int worker = dispatchCurrentWorker ();
+		if (worker >= 0)
+		{
+			dispatchSuspend (worker);
+		}
+
+		// The call lives in the task's frame, which stays put until the task carries on
+		asyncSubmit ([this, task, worker] ()
+		{
+			result = work ();
+			if (worker >= 0)
+			{
+				dispatchResume (worker, task);
+			}
+			else
+			{
+				task.resume ();
+			}
+		});
+	}
+	T await_resume (void) { return std::move (result); }
+};
+
+/**
+ * Runs blocking work on an async thread, "T value = co_await asyncRun<T> (work);"
+ */
+template <typename T> AsyncCall<T> asyncRun (std::function<T ()> work)
+{
+	return AsyncCall<T> (std::move (work));
+}
+
+AsyncCall<MYSQL_RES *> asyncQuery (MySQLHandler *mysql, std::string query);
+AsyncCall<async_response> asyncFetch (std::string url, long timeout = ASYNC_HTTP_TIMEOUT);
+
+#endif
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mysql/mysql.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+
+#include "CommandRegistry.hpp"
+#include "IRCThread.hpp"
+#include "SkidBot.hpp"
+#include "Logger.hpp"
+#include "MySQLHandler.hpp"
+
+
+/**
+ * Folds the text to lower case, triggers are stored folded so they match however they're typed
+ */
+static std::string commandFold (std::string_view text)
+{
+	std::string folded (text);
+	for (char &character : folded)
+	{
+		if ((character >= 'A') && (character <= 'Z'))
+		{
+			character += 'a' - 'A';
+		}
+	}
+	return folded;
+}
+
+
+/**
+ * Returns the key a command's cooldown is kept under in the room's wheel, or a user's cooldown on it
+ * when user isn't 0, the room's own cooldown is COMMAND_ROOM_COOLDOWN
+ */
+static uint64_t commandCooldownKey (uint32_t id, uint64_t user)
+{
+	uint64_t key = (uint64_t)id + 1;
+	return (user == 0) ? key : ((user * 0x9e3779b97f4a7c15ULL) ^ key);
+}
+
+
+/**
+ * Strips spaces from the begining and end of the text
+ */
+static std::string_view commandTrim (std::string_view text)
+{
+	while ((!text.empty ()) && (text.front () == ' '))
+	{
+		text.remove_prefix (1);
+	}
+	while ((!text.empty ()) && (text.back () == ' '))
+	{
+		text.remove_suffix (1);
+	}
+	return text;
+}
+
+
+/**
+ * Creates an empty registry
+ */
+CommandRegistry::CommandRegistry (Logger *new_logger)
+{
+	longest_message = 0;
+	logger = new_logger;
+}
+
+
+/**
+ * Destroys the registry
+ */
+CommandRegistry::~CommandRegistry ()
+{
+	logger = NULL;
+}
+
+
+/**
+ * Adds a command under each of the comma separated triggers, a trigger that's already taken is moved
+ * to the new command. Returns how many triggers were added.
+ */
+size_t CommandRegistry::add (const command_entry &command, std::string_view trigger_list)
+{
+	size_t index = commands.size ();
+	size_t added = 0;
+
+	commands.push_back (command);
+	commands[index].id = index;
+	while (!trigger_list.empty ())
+	{
+		size_t comma = trigger_list.find (',');
+		std::string_view trigger = commandTrim (trigger_list.substr (0, comma));
+		trigger_list = (comma == std::string_view::npos) ? std::string_view () : trigger_list.substr (comma + 1);
+
+		// Work out how the trigger is matched from how it's written
+		uint8_t kind = COMMAND_WORD;
+		if ((trigger.size () >= 2) && (trigger.front () == '"') && (trigger.back () == '"'))
+		{
+			kind = COMMAND_MESSAGE;
+			trigger = trigger.substr (1, trigger.size () - 2);
+		}
+		else if ((trigger.size () >= 2) && (trigger.front () == '!') && (trigger.find (' ') == std::string_view::npos))
+		{
+			kind = COMMAND_PREFIX;
+		}
+		else if (trigger.find (' ') != std::string_view::npos)
+		{
+			kind = COMMAND_PHRASE;
+		}
+		if (trigger.empty ())
+		{
+			continue;
+		}
+
+		std::string key = commandFold (trigger);
+		if (commands[index].name.empty ())
+		{
+			commands[index].name = key;
+		}
+		if (!triggers[kind].insert_or_assign (key, index).second)
+		{
+			logger->debugf (DEBUG_STANDARD, " Commands: The %s trigger was already taken, so I've moved it to the newer command.\n", key.c_str());
+		}
+		if (kind == COMMAND_MESSAGE)
+		{
+			longest_message = std::max (longest_message, key.size ());
+		}
+		added++;
+	}
+
+	// A command nothing can trigger is of no use
+	if (added == 0)
+	{
+		commands.pop_back ();
+	}
+
+	return added;
+}
+
+
+/**
+ * Adds a command that replies from its definition, written as
+ * "triggers | permission | cooldown | game | reply", the game may be left empty for any game, and the
+ * cooldown may be written "room/user" to also stop each user using it again for so many seconds
+ */
+bool CommandRegistry::load (std::string_view definition)
+{
+	std::string_view fields[5];
+	uint8_t t;
+
+	// The reply is everything after the fourth bar, so it may have bars of its own
+	for (t = 0; t < 4; t++)
+	{
+		size_t bar = definition.find ('|');
+		if (bar == std::string_view::npos)
+		{
+			logger->logf (" Commands: I was unable to understand the command \"%.*s\", it should be \"triggers | permission | cooldown | game | reply\".\n", (int)definition.size (), definition.data ());
+			return false;
+		}
+		fields[t] = definition.substr (0, bar);
+		definition.remove_prefix (bar + 1);
+	}
+	fields[4] = definition;
+
+	return define (fields[0], fields[1], fields[2], fields[3], fields[4]);
+}
+
+
+/**
+ * Adds the commands from a MySQL table with the columns triggers, permission, cooldown, game and reply,
+ * returns how many were added, or -1 if the table couldn't be read
+ */
+int CommandRegistry::loadTable (MySQLHandler *mysql, const std::string &table)
+{
+	int added = 0;
+
+	MYSQL_RES *result = mysql->mysqlQuery ("SELECT triggers, permission, cooldown, game, reply FROM %s", table.c_str());
+	if (result == NULL)
+	{
+		logger->logf (" Commands: I was unable to read my commands from the %s table.\n", table.c_str());
+		return -1;
+	}
+
+	if (mysql_num_fields (result) >= 5)
+	{
+		MYSQL_ROW row;
+		while ((row = mysql_fetch_row (result)) != NULL)
+		{
+			if (define ((row[0] != NULL) ? row[0] : "", (row[1] != NULL) ? row[1] : "", (row[2] != NULL) ? row[2] : "", (row[3] != NULL) ? row[3] : "", (row[4] != NULL) ? row[4] : ""))
+			{
+				added++;
+			}
+		}
+	}
+	mysql_free_result (result);
+
+	return added;
+}
+
+
+/**
+ * Finds the command for the case folded text, or NULL if there isn't one
+ */
+const command_entry *CommandRegistry::find (uint8_t kind, std::string_view text)
+{
+	std::unordered_map<std::string, size_t>::const_iterator found = triggers[kind].find (commandFold (text));
+	return (found != triggers[kind].end ()) ? &commands[found->second] : NULL;
+}
+
+
+/**
+ * Builds a command that replies from the fields of its definition
+ */
+bool CommandRegistry::define (std::string_view trigger_list, std::string_view permission, std::string_view cooldown, std::string_view game, std::string_view reply)
+{
+	command_entry command;
+
+	permission = commandTrim (permission);
+	reply = commandTrim (reply);
+	if (reply.empty ())
+	{
+		logger->logf (" Commands: The command for %.*s has nothing to reply with, so I've left it out.\n", (int)trigger_list.size (), trigger_list.data ());
+		return false;
+	}
+
+	if (commandFold (permission) == "master")
+	{
+		command.permission = COMMAND_MASTER;
+	}
+	else if ((commandFold (permission) == "moderator") || (commandFold (permission) == "mod"))
+	{
+		command.permission = COMMAND_MODERATOR;
+	}
+	std::string cooldowns (commandTrim (cooldown));
+	size_t slash = cooldowns.find ('/');
+	command.cooldown = (uint16_t)std::min (std::max (atoi (cooldowns.substr (0, slash).c_str ()), 0), 3600);
+	if (slash != std::string::npos)
+	{
+		command.user_cooldown = (uint16_t)std::min (std::max (atoi (cooldowns.substr (slash + 1).c_str ()), 0), 3600);
+	}
+	command.game = commandTrim (game);
+	command.reply = reply;
+
+	size_t index = commands.size ();
+	if (add (command, trigger_list) == 0)
+	{
+		logger->logf (" Commands: The command replying \"%.*s\" has no triggers, so I've left it out.\n", (int)reply.size (), reply.data ());
+		return false;
+	}
+	commands[index].description = "the " + commands[index].name + " reply";
+
+	return true;
+}
+
+
+/**
+ * Finds and runs the command for a chat message, the user, user_key, room, chat, moderator, now,
+ * cooldowns, room_cooldown and state fields of the context must be set. Returns true if a command was found, even if it wasn't
+ * allowed to run.
+ */
+bool CommandRegistry::dispatch (command_context *context, std::string_view game)
+{
+	std::string_view chat = context->chat;
+	const command_entry *command = NULL;
+	size_t address = strlen (COMMAND_ADDRESS);
+
+	context->remainder = std::string_view ();
+	context->argument = std::string_view ();
+	context->words.clear ();
+
+	if ((chat.size () >= address) && (commandFold (chat.substr (0, address)) == COMMAND_ADDRESS))
+	{
+		// Addressed to us, so look for the whole phrase first, then the first word
+		context->remainder = chat.substr (address);
+		std::string_view remainder = context->remainder;
+		while (!remainder.empty ())
+		{
+			size_t space = remainder.find (' ');
+			context->words.push_back (remainder.substr (0, space));
+			remainder = (space == std::string_view::npos) ? std::string_view () : remainder.substr (space + 1);
+		}
+		if (context->words.empty ())
+		{
+			return false;
+		}
+
+		command = find (COMMAND_PHRASE, context->remainder);
+		if (command == NULL)
+		{
+			command = find (COMMAND_WORD, context->words[0]);
+			context->argument = context->remainder.substr (std::min (context->words[0].size () + 1, context->remainder.size ()));
+		}
+	}
+	else
+	{
+		if (chat.size () <= longest_message)
+		{
+			command = find (COMMAND_MESSAGE, chat);
+		}
+		size_t space = chat.find (' ');
+		if ((command == NULL) && (space != std::string_view::npos) && (space > 0))
+		{
+			command = find (COMMAND_PREFIX, chat.substr (0, space));
+			context->argument = chat.substr (space + 1);
+		}
+	}
+
+	if (command == NULL)
+	{
+		return false;
+	}
+	context->command = command;
+
+	// Commands for another game are treated as though they don't exist
+	if ((!command->game.empty ()) && (commandFold (command->game) != commandFold (game)))
+	{
+		return false;
+	}
+
+	bool master = (context->user.compare (COMMAND_MASTER_USER) == 0);
+	if (((command->permission == COMMAND_MASTER) && (!master)) || ((command->permission == COMMAND_MODERATOR) && (!master) && (!context->moderator)))
+	{
+		logger->debugf (DEBUG_STANDARD, " Commands: %s isn't allowed to use %s.\n", context->user.c_str(), command->name.c_str());
+		return true;
+	}
+
+	// The room's cooldown covers every command with a cooldown, the command's only itself, and the user's
+	// only that user using it, so one user asking for the rules doesn't hold up another asking for something else
+	if ((context->cooldowns != NULL) && ((command->cooldown > 0) || (command->user_cooldown > 0)))
+	{
+		CooldownWheel *cooldowns = context->cooldowns;
+		uint64_t command_key = commandCooldownKey (command->id, 0);
+		uint64_t user_key = commandCooldownKey (command->id, context->user_key);
+
+		if ((context->room_cooldown > 0) && (cooldowns->active (COMMAND_ROOM_COOLDOWN, context->now)))
+		{
+			logger->debugf (DEBUG_STANDARD, " Commands: I'm ignoring %s from %s, I replied to a command in %s too recently.\n", command->name.c_str(), context->user.c_str(), context->room.c_str());
+			return true;
+		}
+		if ((command->cooldown > 0) && (cooldowns->active (command_key, context->now)))
+		{
+			logger->debugf (DEBUG_STANDARD, " Commands: I'm ignoring %s from %s, I replied to it in %s too recently.\n", command->name.c_str(), context->user.c_str(), context->room.c_str());
+			return true;
+		}
+		if ((command->user_cooldown > 0) && (cooldowns->active (user_key, context->now)))
+		{
+			logger->debugf (DEBUG_STANDARD, " Commands: I'm ignoring %s from %s, they used it in %s too recently.\n", command->name.c_str(), context->user.c_str(), context->room.c_str());
+			return true;
+		}
+
+		if (context->room_cooldown > 0)
+		{
+			cooldowns->arm (COMMAND_ROOM_COOLDOWN, context->room_cooldown, context->now);
+		}
+		if (command->cooldown > 0)
+		{
+			cooldowns->arm (command_key, command->cooldown, context->now);
+		}
+		if (command->user_cooldown > 0)
+		{
+			cooldowns->arm (user_key, command->user_cooldown, context->now);
+		}
+	}
+
+	if (command->task != NULL)
+	{
+		command_call call;
+		call.user = context->user;
+		call.room = context->room;
+		call.chat = context->chat;
+		call.argument = context->argument;
+		call.words.assign (context->words.begin (), context->words.end ());
+		call.moderator = context->moderator;
+		call.now = context->now;
+		call.state = context->state;
+		call.command = command;
+		command->task (std::move (call));
+	}
+	else if (command->handler != NULL)
+	{
+		command->handler (context);
+	}
+	else
+	{
+		logger->logf (": Giving %s to %s. :)\n", command->description.c_str(), context->user.c_str());
+		send_room (context->room, command->reply, IRC_PRIORITY_LOW);
+	}
+
+	return true;
+}
+
+
+/**
+ * Returns how many commands there are
+ */
+size_t CommandRegistry::size (void)
+{
+	return commands.size ();
+}
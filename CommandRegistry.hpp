@@ -0,0 +1,124 @@
+#ifndef	_COMMAND_REGISTRY_H
+#define _COMMAND_REGISTRY_H
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+
+#include "Logger.hpp"
+#include "MySQLHandler.hpp"
+#include "AsyncTask.hpp"
+#include "CooldownWheel.hpp"
+
+// Defines who may use a command, each level includes the ones above it
+#define COMMAND_EVERYONE	0
+#define COMMAND_MODERATOR	1
+#define COMMAND_MASTER		2
+
+// Defines how a trigger is matched against chat, a trigger starting with ! is a prefix, one in quotes is
+// a whole message, and otherwise it's a word, or a phrase if it has a space in it
+#define COMMAND_WORD		0	// The first word after addressing the bot, "SkidBot, rules"
+#define COMMAND_PHRASE		1	// Everything after addressing the bot, "SkidBot, channel rules"
+#define COMMAND_PREFIX		2	// The first word of a message with more after it, "!roll 1d20"
+#define COMMAND_MESSAGE		3	// The whole message, "Good SkidBot"
+#define COMMAND_KINDS		4
+
+// Defines the key a room's own cooldown is kept under, no command's cooldown can have it
+#define COMMAND_ROOM_COOLDOWN	0
+
+// Defines how the bot is addressed, and who its master is
+#define COMMAND_ADDRESS		"skidbot, "
+#define COMMAND_MASTER_USER	"skidinc"
+
+struct room_state;
+
+// Holds what a command was called with, the views are in to the chat message so are only valid while
+// the command runs
+typedef struct command_context
+{
+	std::string user;
+	std::string room;
+	std::string_view chat;
+	std::string_view remainder;			// Everything after addressing the bot, empty when it wasn't
+	std::string_view argument;			// Everything after the trigger
+	std::vector<std::string_view> words;	// The remainder split by spaces
+	bool moderator = false;				// Set when twitch says the user is a moderator or the broadcaster
+	std::chrono::high_resolution_clock::time_point now;
+	uint64_t user_key = 0;				// The user's SeenUsers key, their per user cooldowns are kept under it
+	CooldownWheel *cooldowns = NULL;	// The room's running cooldowns, none are kept when it's NULL
+	uint16_t room_cooldown = 0;			// Seconds after a command with a cooldown before any other may reply in the room
+	struct room_state *state = NULL;	// The room's own state, for the handlers
+	const struct command_entry *command = NULL;
+} command_context;
+
+// Holds a copy of what a command was called with, for handlers that wait on the database or the api
+// and so carry on after the chat message is gone
+typedef struct command_call
+{
+	std::string user;
+	std::string room;
+	std::string chat;
+	std::string argument;
+	std::vector<std::string> words;
+	bool moderator = false;
+	std::chrono::high_resolution_clock::time_point now;
+	struct room_state *state = NULL;
+	const struct command_entry *command = NULL;
+} command_call;
+
+typedef void (*command_handler) (const command_context *context);
+typedef AsyncTask (*command_task) (command_call call);
+
+// Holds a single command, commands without a handler or task send their reply to the room
+typedef struct command_entry
+{
+	std::string name;					// The first trigger, used when logging
+	uint8_t permission = COMMAND_EVERYONE;
+	uint16_t cooldown = 0;				// Seconds after replying in a room before this may reply there again, 0 for none
+	uint16_t user_cooldown = 0;			// Seconds before the same user may use this again in the room, 0 for none
+	uint32_t id = 0;					// Set when it's added, the command's cooldowns are kept under it
+	std::string game;					// Only runs while this game is being played, empty for any game
+	std::string reply;
+	std::string description;			// What the reply gives the user, for the log
+	command_handler handler = NULL;
+	command_task task = NULL;			// Used instead of the handler when the command has to wait for something
+} command_entry;
+
+// Define the CommandRegistry class
+class CommandRegistry;
+
+// Build the CommandRegistry class template, holds every chat command keyed on its case folded triggers
+// so finding the command for a message costs the same however many there are. Commands are added in
+// code for the ones that need a handler, and from the config or a MySQL table for the ones that reply.
+// Once they're added the registry is only read, so the dispatch workers can share it.
+class CommandRegistry
+{
+private:
+	// Private variables
+	std::vector<command_entry> commands;
+	std::unordered_map<std::string, size_t> triggers[COMMAND_KINDS];
+	size_t longest_message;
+	Logger *logger;
+
+	// Private methods
+	const command_entry *find (uint8_t kind, std::string_view text);
+	bool define (std::string_view trigger_list, std::string_view permission, std::string_view cooldown, std::string_view game, std::string_view reply);
+
+public:
+	// Constructors and destructor
+	CommandRegistry (Logger *new_logger);
+	~CommandRegistry ();
+
+	// Public methods
+	size_t add (const command_entry &command, std::string_view trigger_list);
+	bool load (std::string_view definition);
+	int loadTable (MySQLHandler *mysql, const std::string &table);
+	bool dispatch (command_context *context, std::string_view game);
+	size_t size (void);
+};
+
+#endif
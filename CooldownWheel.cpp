@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+
+#include "CooldownWheel.hpp"
+
+// Defines the masks for a level's slots, and how many timers a slot may keep room for once it's emptied
+#define COOLDOWN_LEVEL0_MASK	((1 << COOLDOWN_LEVEL0_BITS) - 1)
+#define COOLDOWN_LEVEL_MASK		((1 << COOLDOWN_LEVEL_BITS) - 1)
+#define COOLDOWN_SLOT_KEEP		64
+
+
+/**
+ * Creates a wheel with no cooldowns running
+ */
+CooldownWheel::CooldownWheel (void)
+{
+	tick = 0;
+	start = std::chrono::high_resolution_clock::now ();
+}
+
+
+/**
+ * Returns true if the cooldown is still running
+ */
+bool CooldownWheel::active (uint64_t key, std::chrono::high_resolution_clock::time_point now)
+{
+	advance (now);
+	return (running.find (key) != running.end ());
+}
+
+
+/**
+ * Starts a cooldown that runs for at least the seconds given, restarting it if it's already running
+ */
+void CooldownWheel::arm (uint64_t key, uint32_t seconds, std::chrono::high_resolution_clock::time_point now)
+{
+	cooldown_timer timer;
+
+	advance (now);
+
+	// The tick we're in has already started, so the cooldown is over at the end of the last whole second
+	timer.key = key;
+	timer.due = tick + std::min (std::max (seconds, (uint32_t)1), (uint32_t)COOLDOWN_MAX_SECONDS - 1) + 1;
+	running[key] = timer.due;
+	place (timer);
+}
+
+
+/**
+ * Returns how many cooldowns are running
+ */
+size_t CooldownWheel::size (void)
+{
+	return running.size ();
+}
+
+
+/**
+ * Returns roughly how many bytes the wheel is using, the map's nodes are counted as their key, value
+ * and a pointer
+ */
+size_t CooldownWheel::memoryUsed (void)
+{
+	size_t used = sizeof (CooldownWheel);
+
+	used += running.bucket_count () * sizeof (void *);
+	used += running.size () * (sizeof (std::pair<const uint64_t, uint32_t>) + sizeof (void *));
+	for (const std::vector<cooldown_timer> &slot : wheel)
+	{
+		used += slot.capacity () * sizeof (cooldown_timer);
+	}
+	for (const auto &level : upper)
+	{
+		for (const std::vector<cooldown_timer> &slot : level)
+		{
+			used += slot.capacity () * sizeof (cooldown_timer);
+		}
+	}
+
+	return used;
+}
+
+
+/**
+ * Returns the seconds since the wheel was created
+ */
+uint32_t CooldownWheel::ticks (std::chrono::high_resolution_clock::time_point now)
+{
+	return (now > start) ? (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(now - start).count () : 0;
+}
+
+
+/**
+ * Turns the wheel up to now, dropping the cooldowns that are over
+ */
+void CooldownWheel::advance (std::chrono::high_resolution_clock::time_point now)
+{
+	uint32_t target = ticks (now);
+
+	// With nothing running there's nothing to turn through, just drop anything left from restarted cooldowns
+	if ((running.empty ()) && (target > tick))
+	{
+		for (std::vector<cooldown_timer> &slot : wheel)
+		{
+			empty (&slot);
+		}
+		for (auto &level : upper)
+		{
+			for (std::vector<cooldown_timer> &slot : level)
+			{
+				empty (&slot);
+			}
+		}
+		std::unordered_map<uint64_t, uint32_t> ().swap (running);
+		tick = target;
+		return;
+	}
+
+	while (tick < target)
+	{
+		tick++;
+
+		// Each turn of a level brings the next slot of the level above down, the highest first so its
+		// cooldowns can fall all the way
+		if ((tick & COOLDOWN_LEVEL0_MASK) == 0)
+		{
+			if (((tick >> COOLDOWN_LEVEL0_BITS) & COOLDOWN_LEVEL_MASK) == 0)
+			{
+				cascade (2);
+			}
+			cascade (1);
+		}
+
+		// A cooldown that was restarted has a later tick in running, so it's left alone here
+		std::vector<cooldown_timer> *slot = &wheel[tick & COOLDOWN_LEVEL0_MASK];
+		for (const cooldown_timer &timer : *slot)
+		{
+			std::unordered_map<uint64_t, uint32_t>::iterator found = running.find (timer.key);
+			if ((found != running.end ()) && (found->second == timer.due))
+			{
+				running.erase (found);
+			}
+		}
+		empty (slot);
+	}
+}
+
+
+/**
+ * Puts a cooldown in the slot for its tick, on the lowest level whose turn reaches it
+ */
+void CooldownWheel::place (const cooldown_timer &timer)
+{
+	uint32_t delta = timer.due - tick;
+
+	if (delta < (1 << COOLDOWN_LEVEL0_BITS))
+	{
+		wheel[timer.due & COOLDOWN_LEVEL0_MASK].push_back (timer);
+	}
+	else if (delta < (1 << (COOLDOWN_LEVEL0_BITS + COOLDOWN_LEVEL_BITS)))
+	{
+		upper[0][(timer.due >> COOLDOWN_LEVEL0_BITS) & COOLDOWN_LEVEL_MASK].push_back (timer);
+	}
+	else
+	{
+		upper[1][(timer.due >> (COOLDOWN_LEVEL0_BITS + COOLDOWN_LEVEL_BITS)) & COOLDOWN_LEVEL_MASK].push_back (timer);
+	}
+}
+
+
+/**
+ * Moves the cooldowns in a level's current slot down to the levels below
+ */
+void CooldownWheel::cascade (uint8_t level)
+{
+	std::vector<cooldown_timer> *slot = &upper[level - 1][(tick >> (COOLDOWN_LEVEL0_BITS + (COOLDOWN_LEVEL_BITS * (level - 1)))) & COOLDOWN_LEVEL_MASK];
+	std::vector<cooldown_timer> moving;
+
+	moving.swap (*slot);
+	for (const cooldown_timer &timer : moving)
+	{
+		std::unordered_map<uint64_t, uint32_t>::iterator found = running.find (timer.key);
+		if ((found != running.end ()) && (found->second == timer.due))
+		{
+			place (timer);
+		}
+	}
+}
+
+
+/**
+ * Empties a slot, giving back its memory if a burst left it holding a lot
+ */
+void CooldownWheel::empty (std::vector<cooldown_timer> *slot)
+{
+	if (slot->capacity () > COOLDOWN_SLOT_KEEP)
+	{
+		std::vector<cooldown_timer> ().swap (*slot);
+	}
+	else
+	{
+		slot->clear ();
+	}
+}
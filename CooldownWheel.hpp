@@ -0,0 +1,58 @@
+#ifndef	_COOLDOWN_WHEEL_H
+#define _COOLDOWN_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+
+// Defines the wheel, a tick is a second and each level's slots span a whole turn of the level below it,
+// so 256 seconds, 4.5 hours and 12 days
+#define COOLDOWN_LEVELS			3
+#define COOLDOWN_LEVEL0_BITS	8
+#define COOLDOWN_LEVEL_BITS		6
+#define COOLDOWN_MAX_SECONDS	((1 << (COOLDOWN_LEVEL0_BITS + (COOLDOWN_LEVEL_BITS * (COOLDOWN_LEVELS - 1)))) - 1)
+
+// Define the CooldownWheel class
+class CooldownWheel;
+
+// Build the CooldownWheel class template, holds the cooldowns running in a room on a hierarchical timing
+// wheel. Arming or checking a cooldown costs the same however many are running, and a cooldown is
+// dropped once it's over, so the memory only grows with the cooldowns running now, not with everyone
+// that has ever used a command.
+class CooldownWheel
+{
+private:
+	// Private variables
+	typedef struct cooldown_timer
+	{
+		uint64_t key;
+		uint32_t due;						// The tick the cooldown is over
+	} cooldown_timer;
+	std::vector<cooldown_timer> wheel[1 << COOLDOWN_LEVEL0_BITS];	// Cooldowns over within a turn of the wheel
+	std::vector<cooldown_timer> upper[COOLDOWN_LEVELS - 1][1 << COOLDOWN_LEVEL_BITS];	// And ones further off
+	std::unordered_map<uint64_t, uint32_t> running;	// The tick each running cooldown is over, by key
+	uint32_t tick;
+	std::chrono::high_resolution_clock::time_point start;
+
+	// Private methods
+	uint32_t ticks (std::chrono::high_resolution_clock::time_point now);
+	void advance (std::chrono::high_resolution_clock::time_point now);
+	void place (const cooldown_timer &timer);
+	void cascade (uint8_t level);
+	void empty (std::vector<cooldown_timer> *slot);
+
+public:
+	// Constructors and destructor
+	CooldownWheel (void);
+
+	// Public methods
+	bool active (uint64_t key, std::chrono::high_resolution_clock::time_point now);
+	void arm (uint64_t key, uint32_t seconds, std::chrono::high_resolution_clock::time_point now);
+	size_t size (void);
+	size_t memoryUsed (void);
+};
+
+#endif
@@ -0,0 +1,431 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <deque>
+
+#include "Dispatcher.hpp"
+#include "IRCThread.hpp"
+#include "SkidBot.hpp"
+#include "Logger.hpp"
+
+// Local function prototypes
+static void *dispatchThread (void *index);
+static void dispatchWait (dispatch_worker *worker, int timeout_milli);
+static void dispatchWake (dispatch_worker *worker);
+static void dispatchSignal (dispatch_worker *worker);
+static void dispatchResumeTasks (dispatch_worker *worker);
+static void dispatchClose (dispatch_worker *worker);
+static void dispatchMadeRoom (dispatch_worker *worker);
+
+// Global varibles
+dispatch_worker dispatch_workers[DISPATCH_MAX_WORKERS];
+uint8_t dispatch_worker_count = 0;
+dispatch_handler dispatch_handle = NULL;
+dispatch_start dispatch_begin = NULL;
+std::atomic<bool> dispatch_running {false};
+pthread_mutex_t dispatch_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t dispatch_start_cond = PTHREAD_COND_INITIALIZER;
+bool dispatch_starting = false;		// Set while the workers are being created, they wait until it's cleared
+thread_local int dispatch_current = -1;
+
+extern Logger *logger;
+
+
+/**
+ * Starts the dispatch workers, each room is hashed to one of them so its lines are handled in order
+ * while other rooms are handled alongside it. Returns how many workers were started, or -1 if any of
+ * them couldn't be, in which case the ones that were are stopped again.
+ */
+int setupDispatcher (uint8_t workers, dispatch_handler handler, dispatch_start start)
+{
+	uint8_t t;
+
+	if ((workers < 1) || (workers > DISPATCH_MAX_WORKERS))
+	{
+		logger->logf (" Dispatcher: I can't use %d workers, so I'm using 1.\n", workers);
+		workers = 1;
+	}
+
+	dispatch_handle = handler;
+	dispatch_begin = start;
+	dispatch_running = true;
+
+	// The rooms are hashed across the count, so it's set before any worker starts, and the workers wait
+	// until they've all been created so none of them starts on rooms another might not be there for
+	dispatch_worker_count = workers;
+	lock (dispatch_start_mutex);
+	dispatch_starting = true;
+	release (dispatch_start_mutex);
+
+	for (t = 0; t < workers; t++)
+	{
+		dispatch_worker *worker = &dispatch_workers[t];
+		worker->queue = new SPSCQueue<irc_line> (DISPATCH_QUEUE_SIZE);
+		worker->timers = new TimerService ();
+		worker->wakeup = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if ((worker->wakeup < 0) || (pthread_create (&worker->thread, NULL, dispatchThread, (void *)(uintptr_t)t) != 0))
+		{
+			logger->logf (" Dispatcher: I was unable to start worker %d, reason: %s.\n", t, strerror(errno));
+			dispatchClose (worker);
+			break;
+		}
+		worker->started = true;
+	}
+
+	lock (dispatch_start_mutex);
+	dispatch_starting = false;
+	pthread_cond_broadcast (&dispatch_start_cond);
+	release (dispatch_start_mutex);
+
+	// Without every worker some rooms would have nobody to handle them, so the ones that started are stopped
+	if (t < workers)
+	{
+		dispatch_running = false;
+		while (t > 0)
+		{
+			t--;
+			dispatchSignal (&dispatch_workers[t]);
+			dispatchClose (&dispatch_workers[t]);
+		}
+		dispatch_worker_count = 0;
+		return -1;
+	}
+	logger->logf (" Dispatcher: I've started %d workers to handle chat.\n", dispatch_worker_count);
+
+	return dispatch_worker_count;
+}
+
+
+/**
+ * Returns how many workers there are
+ */
+uint8_t dispatchWorkers (void)
+{
+	return dispatch_worker_count;
+}
+
+
+/**
+ * Returns the worker a room's lines are handled on, lines that aren't in a room go to worker 0
+ */
+uint8_t dispatchWorker (int32_t room)
+{
+	return ((room < 0) || (dispatch_worker_count == 0)) ? 0 : (room % dispatch_worker_count);
+}
+
+
+/**
+ * Gives a line to the worker for its room, if the worker's queue is full the line waits with main until
+ * there's room, along with everything after it for that worker so the order is kept. Only main may call this.
+ */
+void dispatchLine (irc_line &&line)
+{
+	dispatch_worker *worker = &dispatch_workers[dispatchWorker (line.room)];
+
+	if ((!worker->overflow.empty ()) || (!worker->queue->push (std::move (line))))
+	{
+		worker->overflow.push_back (std::move (line));
+	}
+	worker->queued = true;
+}
+
+
+/**
+ * Moves along any lines waiting for room in the queues and wakes the workers that were given lines, so
+ * a batch costs each worker one wake. Returns true if lines are still waiting, the worker wakes main once
+ * it has made room for them.
+ */
+bool dispatchFlush (void)
+{
+	bool waiting = false;
+	uint8_t t;
+
+	for (t = 0; t < dispatch_worker_count; t++)
+	{
+		dispatch_worker *worker = &dispatch_workers[t];
+		while ((!worker->overflow.empty ()) && (worker->queue->push (std::move (worker->overflow.front ()))))
+		{
+			worker->overflow.pop_front ();
+		}
+
+		// Pairs with the fence in dispatchMadeRoom, if the worker emptied the queue before it saw the flag
+		// the lines go in now, otherwise it wakes us
+		if (!worker->overflow.empty ())
+		{
+			worker->full.store (true);
+			std::atomic_thread_fence (std::memory_order_seq_cst);
+			while ((!worker->overflow.empty ()) && (worker->queue->push (std::move (worker->overflow.front ()))))
+			{
+				worker->overflow.pop_front ();
+			}
+		}
+		waiting |= !worker->overflow.empty ();
+
+		if (worker->queued)
+		{
+			worker->queued = false;
+			dispatchWake (worker);
+		}
+	}
+
+	return waiting;
+}
+
+
+/**
+ * Hands the workers anything main still holds for them, lets them finish their queues and any tasks
+ * still waiting on the database or the api, and waits for them to close
+ */
+void stopDispatcher (void)
+{
+	uint8_t t;
+
+	if (dispatch_worker_count == 0)
+	{
+		return;
+	}
+
+	while (dispatchFlush ())
+	{
+		usleep (1000);
+	}
+
+	dispatch_running = false;
+	for (t = 0; t < dispatch_worker_count; t++)
+	{
+		dispatchSignal (&dispatch_workers[t]);
+	}
+	for (t = 0; t < dispatch_worker_count; t++)
+	{
+		dispatchClose (&dispatch_workers[t]);
+	}
+	dispatch_worker_count = 0;
+}
+
+
+/**
+ * Returns the worker the calling thread is, or -1 if it isn't one
+ */
+int dispatchCurrentWorker (void)
+{
+	return dispatch_current;
+}
+
+
+/**
+ * Returns a worker's timers, only that worker may use them once it has started
+ */
+TimerService *dispatchTimers (uint8_t worker)
+{
+	return dispatch_workers[worker].timers;
+}
+
+
+/**
+ * Notes that a task started on a worker is waiting for something, the worker won't close until it has
+ * carried on. Only the worker may call this.
+ */
+void dispatchSuspend (uint8_t worker)
+{
+	dispatch_workers[worker].suspended++;
+}
+
+
+/**
+ * Hands a task back to the worker it was started on once its wait is over, so it carries on alongside
+ * the room's other lines. Can be called from any thread.
+ */
+void dispatchResume (uint8_t worker, std::coroutine_handle<> task)
+{
+	dispatch_worker *target = &dispatch_workers[worker];
+
+	lock (target->resume_mutex);
+	target->resumes.push_back (task);
+	target->resumable++;
+	release (target->resume_mutex);
+
+	dispatchWake (target);
+}
+
+
+/**
+ * dispatchThread, handles the lines for the rooms hashed to this worker in the order they arrived,
+ * and sleeps until it's given more or its rooms have a timer due
+ */
+static void *dispatchThread (void *index)
+{
+	uint8_t number = (uint8_t)(uintptr_t)index;
+	dispatch_worker *worker = &dispatch_workers[number];
+	irc_line line;
+
+	// Wait for main to finish creating the workers
+	lock (dispatch_start_mutex);
+	while (dispatch_starting)
+	{
+		pthread_cond_wait (&dispatch_start_cond, &dispatch_start_mutex);
+	}
+	release (dispatch_start_mutex);
+
+	dispatch_current = number;
+	if (dispatch_begin != NULL)
+	{
+		dispatch_begin (number, dispatch_worker_count);
+	}
+
+	while (true)
+	{
+		while (worker->queue->pop (&line))
+		{
+			dispatch_handle (number, &line);
+			if ((worker->full.load (std::memory_order_relaxed)) && (worker->queue->size () <= DISPATCH_QUEUE_LOW_WATER))
+			{
+				dispatchMadeRoom (worker);
+			}
+		}
+		dispatchMadeRoom (worker);
+		dispatchResumeTasks (worker);
+
+		// Main gives us everything it has before stopping us, so once the queue is empty and none of our
+		// tasks are still waiting we're done
+		if ((!dispatch_running) && (worker->queue->size () == 0) && (worker->suspended == 0))
+		{
+			break;
+		}
+
+		dispatchWait (worker, dispatch_running ? worker->timers->run (hrc_now) : -1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Sleeps the worker until it's given lines, it's stopped, or the timeout in milliseconds passes,
+ * -1 waits for as long as it takes
+ */
+static void dispatchWait (dispatch_worker *worker, int timeout_milli)
+{
+	struct pollfd wakeup;
+	uint64_t wakeups;
+
+	// Say we're waiting before the last look at the queues, so anything queued after it wakes us
+	worker->waiting.store (true);
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	if ((worker->queue->size () > 0) || (worker->resumable > 0) || ((!dispatch_running) && (worker->suspended == 0)))
+	{
+		worker->waiting.store (false);
+		return;
+	}
+
+	wakeup.fd = worker->wakeup;
+	wakeup.events = POLLIN;
+	wakeup.revents = 0;
+	int ready = poll (&wakeup, 1, timeout_milli);
+	worker->waiting.store (false);
+
+	if ((ready < 0) && (errno != EINTR))
+	{
+		logger->logf (" Dispatcher: I had a problem waiting for lines, reason: %s.\n", strerror(errno));
+	}
+	else if (ready > 0)
+	{
+		if (read (worker->wakeup, &wakeups, sizeof (wakeups)) < 0)
+		{
+			logger->debugf (DEBUG_MINIMAL, " Dispatcher: I was unable to clear a worker's wakeup, reason: %s.\n", strerror(errno));
+		}
+	}
+}
+
+
+/**
+ * Wakes a worker if it's waiting, pairs with the fence in dispatchWait so either the worker sees the
+ * new lines or we see it waiting
+ */
+static void dispatchWake (dispatch_worker *worker)
+{
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	if (worker->waiting.exchange (false))
+	{
+		dispatchSignal (worker);
+	}
+}
+
+
+/**
+ * Writes to a worker's wakeup
+ */
+static void dispatchSignal (dispatch_worker *worker)
+{
+	uint64_t wakeup = 1;
+
+	if (write (worker->wakeup, &wakeup, sizeof (wakeup)) < 0)
+	{
+		logger->logf (" Dispatcher: I was unable to wake a worker, reason: %s.\n", strerror(errno));
+	}
+}
+
+
+/**
+ * Carries on with the worker's tasks whose wait is over
+ */
+static void dispatchResumeTasks (dispatch_worker *worker)
+{
+	std::deque<std::coroutine_handle<>> resumes;
+
+	if (worker->resumable == 0)
+	{
+		return;
+	}
+
+	lock (worker->resume_mutex);
+	resumes.swap (worker->resumes);
+	worker->resumable = 0;
+	release (worker->resume_mutex);
+
+	for (std::coroutine_handle<> &task : resumes)
+	{
+		worker->suspended--;
+		task.resume ();
+	}
+}
+
+
+/**
+ * Waits for a worker to close, if it was started, and frees what it was given
+ */
+static void dispatchClose (dispatch_worker *worker)
+{
+	if (worker->started)
+	{
+		pthread_join (worker->thread, NULL);
+		worker->started = false;
+	}
+	if (worker->wakeup >= 0)
+	{
+		close (worker->wakeup);
+		worker->wakeup = -1;
+	}
+	delete worker->queue;
+	worker->queue = NULL;
+	delete worker->timers;
+	worker->timers = NULL;
+}
+
+
+/**
+ * Wakes main if it's holding lines the worker's queue had no room for, pairs with the fence in dispatchFlush
+ */
+static void dispatchMadeRoom (dispatch_worker *worker)
+{
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	if ((worker->full.load ()) && (worker->full.exchange (false)))
+	{
+		wakeMain ();
+	}
+}
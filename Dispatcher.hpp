@@ -0,0 +1,57 @@
+#ifndef	_DISPATCHER_H
+#define _DISPATCHER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+
+#include "SPSCQueue.hpp"
+#include "IRCThread.hpp"
+#include "TimerService.hpp"
+
+// Defines the most dispatch workers, and how many lines each worker's queue holds
+#define DISPATCH_MAX_WORKERS	16
+#define DISPATCH_QUEUE_SIZE		4096
+#define DISPATCH_QUEUE_LOW_WATER	(DISPATCH_QUEUE_SIZE / 4)	// A worker wakes main once a queue it couldn't fill drains to this
+
+// Called on a worker for each line of a room it owns, lines that aren't in a room go to worker 0
+typedef void (*dispatch_handler) (uint8_t worker, irc_line *line);
+
+// Called on a worker once every worker has started, before it's given any lines, so it can schedule its rooms' timers,
+// the rooms are hashed across the number of workers given
+typedef void (*dispatch_start) (uint8_t worker, uint8_t workers);
+
+// Holds a dispatch worker, main is the only producer of its queue and the worker the only consumer
+typedef struct dispatch_worker
+{
+	pthread_t thread;
+	bool started = false;
+	SPSCQueue<irc_line> *queue = NULL;
+	std::deque<irc_line> overflow;			// Lines main couldn't fit in the queue yet, only main uses this
+	bool queued = false;					// Set by main when it has given the worker lines since it last woke it
+	std::atomic<bool> full {false};			// Set by main while it holds lines the queue had no room for, the worker wakes it once there is
+	int wakeup = -1;
+	std::atomic<bool> waiting {false};		// Set while the worker sleeps on its wakeup
+	pthread_mutex_t resume_mutex = PTHREAD_MUTEX_INITIALIZER;
+	std::deque<std::coroutine_handle<>> resumes;	// Tasks whose wait is over, to carry on with on the worker
+	std::atomic<uint32_t> resumable {0};	// How many are in resumes, so the worker can check without the lock
+	std::atomic<uint32_t> suspended {0};	// Tasks started on the worker that haven't carried on yet
+	TimerService *timers = NULL;			// The worker's timers, only the worker may use them
+} dispatch_worker;
+
+// Global function prototypes
+int setupDispatcher (uint8_t workers, dispatch_handler handler, dispatch_start start);
+uint8_t dispatchWorkers (void);
+uint8_t dispatchWorker (int32_t room);
+void dispatchLine (irc_line &&line);
+bool dispatchFlush (void);
+void stopDispatcher (void);
+TimerService *dispatchTimers (uint8_t worker);
+int dispatchCurrentWorker (void);
+void dispatchSuspend (uint8_t worker);
+void dispatchResume (uint8_t worker, std::coroutine_handle<> task);
+
+#endif
@@ -0,0 +1,444 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "IOURing.hpp"
+#include "SkidBot.hpp"
+
+
+/**
+ * Creates a ring that isn't set up yet
+ */
+IOURing::IOURing ()
+{
+	ring_fd = -1;
+	sq_map = MAP_FAILED;
+	sq_map_size = 0;
+	cq_map = MAP_FAILED;
+	cq_map_size = 0;
+	sqes = (struct io_uring_sqe *)MAP_FAILED;
+	sqes_size = 0;
+	sq_entries = 0;
+	buffers = NULL;
+	buffer_size = 0;
+	buffer_count = 0;
+	registered = false;
+	sq_mutex = PTHREAD_MUTEX_INITIALIZER;
+	owned = false;
+}
+
+
+/**
+ * Tears the ring down and destroys it
+ */
+IOURing::~IOURing ()
+{
+	stop ();
+}
+
+
+/**
+ * Creates the ring with room for the given number of queued operations, maps its queues, and allocates
+ * and registers the buffers, returns 1 on success or -1 with errno set if the kernel won't give us a ring
+ */
+int IOURing::setup (unsigned entries, unsigned new_buffer_count, size_t new_buffer_size)
+{
+	struct io_uring_params params;
+	int error;
+
+	memset (&params, 0, sizeof (params));
+	ring_fd = syscall (__NR_io_uring_setup, entries, &params);
+	if (ring_fd < 0)
+	{
+		return -1;
+	}
+
+	// We need to be able to wait with a timeout, which came along with the other features we use
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0)
+	{
+		stop ();
+		errno = ENOSYS;
+		return -1;
+	}
+
+	// Maps the submission and completion queues, newer kernels let us map both at once
+	sq_map_size = params.sq_off.array + (params.sq_entries * sizeof (unsigned));
+	cq_map_size = params.cq_off.cqes + (params.cq_entries * sizeof (struct io_uring_cqe));
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		sq_map_size = std::max (sq_map_size, cq_map_size);
+	}
+	sq_map = mmap (NULL, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_map == MAP_FAILED)
+	{
+		error = errno;
+		stop ();
+		errno = error;
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cq_map = sq_map;
+	}
+	else
+	{
+		cq_map = mmap (NULL, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	}
+	sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+	sqes = (struct io_uring_sqe *)mmap (NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if ((cq_map == MAP_FAILED) || (sqes == MAP_FAILED))
+	{
+		error = errno;
+		stop ();
+		errno = error;
+		return -1;
+	}
+
+	sq_head = (unsigned *)((char *)sq_map + params.sq_off.head);
+	sq_tail = (unsigned *)((char *)sq_map + params.sq_off.tail);
+	sq_mask = (unsigned *)((char *)sq_map + params.sq_off.ring_mask);
+	sq_array = (unsigned *)((char *)sq_map + params.sq_off.array);
+	sq_entries = params.sq_entries;
+	cq_head = (unsigned *)((char *)cq_map + params.cq_off.head);
+	cq_tail = (unsigned *)((char *)cq_map + params.cq_off.tail);
+	cq_mask = (unsigned *)((char *)cq_map + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((char *)cq_map + params.cq_off.cqes);
+
+	// The buffers are one block, registering them can fail if we're over the locked memory limit
+	buffer_count = new_buffer_count;
+	buffer_size = new_buffer_size;
+	if (buffer_count > 0)
+	{
+		if (posix_memalign ((void **)&buffers, sysconf (_SC_PAGESIZE), buffer_count * buffer_size) != 0)
+		{
+			stop ();
+			errno = ENOMEM;
+			return -1;
+		}
+
+		std::vector<struct iovec> iov (buffer_count);
+		for (unsigned t = 0; t < buffer_count; t++)
+		{
+			iov[t].iov_base = buffers + (t * buffer_size);
+			iov[t].iov_len = buffer_size;
+		}
+		registered = (syscall (__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov.data (), buffer_count) == 0);
+	}
+
+	return 1;
+}
+
+
+/**
+ * Unmaps the queues, frees the buffers and closes the ring, anything still in flight is cancelled by
+ * the kernel
+ */
+void IOURing::stop (void)
+{
+	if (sqes != MAP_FAILED)
+	{
+		munmap (sqes, sqes_size);
+		sqes = (struct io_uring_sqe *)MAP_FAILED;
+	}
+	if ((cq_map != MAP_FAILED) && (cq_map != sq_map))
+	{
+		munmap (cq_map, cq_map_size);
+	}
+	cq_map = MAP_FAILED;
+	if (sq_map != MAP_FAILED)
+	{
+		munmap (sq_map, sq_map_size);
+		sq_map = MAP_FAILED;
+	}
+	if (ring_fd >= 0)
+	{
+		close (ring_fd);
+		ring_fd = -1;
+	}
+	free (buffers);
+	buffers = NULL;
+	buffer_count = 0;
+	registered = false;
+	sq_entries = 0;
+}
+
+
+/**
+ * Returns true once the ring has been set up
+ */
+bool IOURing::ready (void)
+{
+	return (ring_fd >= 0);
+}
+
+
+/**
+ * Makes the calling thread the one that reaps completions, operations queued by it are submitted when
+ * it next waits rather than straight away
+ */
+void IOURing::setOwner (void)
+{
+	owner = pthread_self ();
+	owned = true;
+}
+
+
+/**
+ * Returns true if the calling thread is the ring's owner
+ */
+bool IOURing::isOwner (void)
+{
+	return ((owned) && (pthread_equal (owner, pthread_self ())));
+}
+
+
+/**
+ * Returns the registered buffer with the given index
+ */
+char *IOURing::buffer (unsigned index)
+{
+	return buffers + (index * buffer_size);
+}
+
+
+/**
+ * Returns the size of each registered buffer
+ */
+size_t IOURing::bufferSize (void)
+{
+	return buffer_size;
+}
+
+
+/**
+ * Finds the next free submission entry and clears it, the sq_mutex must be held, returns NULL if the
+ * submission queue is full
+ */
+struct io_uring_sqe *IOURing::nextSQE (void)
+{
+	unsigned tail = *sq_tail;
+
+	if ((ring_fd < 0) || ((tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE)) >= sq_entries))
+	{
+		return NULL;
+	}
+
+	struct io_uring_sqe *sqe = &sqes[tail & *sq_mask];
+	memset (sqe, 0, sizeof (*sqe));
+	return sqe;
+}
+
+
+/**
+ * Hands the entry filled in after nextSQE to the kernel, the sq_mutex must be held
+ */
+void IOURing::publish (void)
+{
+	unsigned tail = *sq_tail;
+
+	sq_array[tail & *sq_mask] = tail & *sq_mask;
+	__atomic_store_n (sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Queues a read in to a registered buffer, returns false if the submission queue is full
+ */
+bool IOURing::read (int fd, unsigned index, size_t length, uint64_t user_data)
+{
+	lock (sq_mutex);
+	struct io_uring_sqe *sqe = nextSQE ();
+	if (sqe == NULL)
+	{
+		release (sq_mutex);
+		return false;
+	}
+	sqe->opcode = registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uint64_t)(uintptr_t)buffer (index);
+	sqe->len = std::min (length, buffer_size);
+	sqe->buf_index = index;
+	sqe->user_data = user_data;
+	publish ();
+	release (sq_mutex);
+
+	return true;
+}
+
+
+/**
+ * Queues a read in to the caller's memory, which has to stay valid until the read completes, returns
+ * false if the submission queue is full
+ */
+bool IOURing::readInto (int fd, void *data, size_t length, uint64_t user_data)
+{
+	lock (sq_mutex);
+	struct io_uring_sqe *sqe = nextSQE ();
+	if (sqe == NULL)
+	{
+		release (sq_mutex);
+		return false;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uint64_t)(uintptr_t)data;
+	sqe->len = length;
+	sqe->user_data = user_data;
+	publish ();
+	release (sq_mutex);
+
+	return true;
+}
+
+
+/**
+ * Queues a write from a registered buffer, at the file's position, so a file opened for appending is
+ * appended to, returns false if the submission queue is full
+ */
+bool IOURing::write (int fd, unsigned index, size_t length, uint64_t user_data)
+{
+	lock (sq_mutex);
+	struct io_uring_sqe *sqe = nextSQE ();
+	if (sqe == NULL)
+	{
+		release (sq_mutex);
+		return false;
+	}
+	sqe->opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uint64_t)(uintptr_t)buffer (index);
+	sqe->len = std::min (length, buffer_size);
+	sqe->buf_index = index;
+	sqe->user_data = user_data;
+	publish ();
+	release (sq_mutex);
+
+	return true;
+}
+
+
+/**
+ * Queues a one shot poll, it completes once the descriptor has one of the given events, returns false
+ * if the submission queue is full
+ */
+bool IOURing::poll (int fd, short events, uint64_t user_data)
+{
+	lock (sq_mutex);
+	struct io_uring_sqe *sqe = nextSQE ();
+	if (sqe == NULL)
+	{
+		release (sq_mutex);
+		return false;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+	publish ();
+	release (sq_mutex);
+
+	return true;
+}
+
+
+/**
+ * Queues a cancel of the operation queued with the target user data, the cancel completes with its own
+ * user data, and the target completes with -ECANCELED unless it had already finished
+ */
+bool IOURing::cancel (uint64_t target, uint64_t user_data)
+{
+	lock (sq_mutex);
+	struct io_uring_sqe *sqe = nextSQE ();
+	if (sqe == NULL)
+	{
+		release (sq_mutex);
+		return false;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = user_data;
+	publish ();
+	release (sq_mutex);
+
+	return true;
+}
+
+
+/**
+ * Submits everything queued, and if wait is set waits for that many completions or the timeout in
+ * milliseconds, in the one system call. Returns how many completions are ready, or -1 on error.
+ */
+int IOURing::submit (unsigned wait, int timeout_milli)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec timeout;
+	unsigned flags = 0;
+	unsigned to_submit;
+	int enter_return;
+
+	if (ring_fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	memset (&arg, 0, sizeof (arg));
+	if (wait > 0)
+	{
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout_milli >= 0)
+		{
+			timeout.tv_sec = timeout_milli / 1000;
+			timeout.tv_nsec = (timeout_milli % 1000) * 1000000L;
+			arg.ts = (uint64_t)(uintptr_t)&timeout;
+		}
+	}
+
+	// Only ask for what has been published, the kernel won't wait if it submits fewer than we asked for,
+	// anything another thread publishes after this goes with its own submit
+	to_submit = __atomic_load_n (sq_tail, __ATOMIC_ACQUIRE) - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+	if ((to_submit == 0) && (wait == 0))
+	{
+		return __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE) - *cq_head;
+	}
+	enter_return = syscall (__NR_io_uring_enter, ring_fd, to_submit, wait, flags, (wait > 0) ? (void *)&arg : NULL, (wait > 0) ? sizeof (arg) : 0);
+	if ((enter_return < 0) && (errno != ETIME) && (errno != EINTR) && (errno != EBUSY))
+	{
+		return -1;
+	}
+
+	return __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE) - *cq_head;
+}
+
+
+/**
+ * Takes the next completion, returns false if there are none waiting, only the owner may call this
+ */
+bool IOURing::nextCompletion (uint64_t *user_data, int32_t *result)
+{
+	unsigned head = *cq_head;
+
+	if ((ring_fd < 0) || (head == __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE)))
+	{
+		return false;
+	}
+
+	struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+	*user_data = cqe->user_data;
+	*result = cqe->res;
+	__atomic_store_n (cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
@@ -0,0 +1,73 @@
+#ifndef	_IO_URING_H
+#define _IO_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <linux/io_uring.h>
+
+// Define the IOURing class
+class IOURing;
+
+// Build the IOURing class template, a small io_uring wrapper made straight from the system calls so we
+// don't need liburing. Any thread may queue operations, but only the owner reaps the completions.
+// The buffers are registered with the kernel once so reads and writes in to them skip the page pinning,
+// if the kernel won't take them they're used as normal buffers instead.
+class IOURing
+{
+private:
+	// Private variables
+	int ring_fd;
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;
+	size_t cq_map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	char *buffers;
+	size_t buffer_size;
+	unsigned buffer_count;
+	bool registered;
+	pthread_mutex_t sq_mutex;
+	pthread_t owner;
+	bool owned;
+
+	// Private methods
+	struct io_uring_sqe *nextSQE (void);
+	void publish (void);
+
+public:
+	// Constructors and destructor
+	IOURing ();
+	~IOURing ();
+	IOURing (const IOURing &) = delete;
+	IOURing &operator= (const IOURing &) = delete;
+
+	// Public methods
+	int setup (unsigned entries, unsigned new_buffer_count, size_t new_buffer_size);
+	void stop (void);
+	bool ready (void);
+	void setOwner (void);
+	bool isOwner (void);
+	char *buffer (unsigned index);
+	size_t bufferSize (void);
+	bool read (int fd, unsigned index, size_t length, uint64_t user_data);
+	bool readInto (int fd, void *data, size_t length, uint64_t user_data);
+	bool write (int fd, unsigned index, size_t length, uint64_t user_data);
+	bool poll (int fd, short events, uint64_t user_data);
+	bool cancel (uint64_t target, uint64_t user_data);
+	int submit (unsigned wait, int timeout_milli);
+	bool nextCompletion (uint64_t *user_data, int32_t *result);
+};
+
+#endif
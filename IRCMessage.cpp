@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include <string_view>
+
+#include "IRCMessage.hpp"
+
+
+/**
+ * Parses a single IRC line in one pass, in to its tags, prefix, command and parameters,
+ * nothing is copied or allocated, returns false if the line has no command
+ */
+bool parseIRCMessage (std::string_view line, irc_message_view *message)
+{
+	const char *position = line.data ();
+	const char *end = position + line.size ();
+	const char *found;
+
+	message->tag_count = 0;
+	message->nick = std::string_view ();
+	message->user = std::string_view ();
+	message->host = std::string_view ();
+	message->command = std::string_view ();
+	message->param_count = 0;
+	message->has_trailing = false;
+
+	// Tags, @key=value;key=value
+	if ((position < end) && (*position == '@'))
+	{
+		position++;
+		found = (const char *)memchr (position, ' ', end - position);
+		if (found == NULL)
+		{
+			return false;
+		}
+
+		while (position < found)
+		{
+			const char *tag_end = (const char *)memchr (position, ';', found - position);
+			if (tag_end == NULL)
+			{
+				tag_end = found;
+			}
+
+			if (message->tag_count < IRC_MAX_TAGS)
+			{
+				irc_tag *tag = &message->tags[message->tag_count++];
+				const char *equals = (const char *)memchr (position, '=', tag_end - position);
+				if (equals != NULL)
+				{
+					tag->key = std::string_view (position, equals - position);
+					tag->value = std::string_view (equals + 1, tag_end - equals - 1);
+				}
+				else
+				{
+					tag->key = std::string_view (position, tag_end - position);
+					tag->value = std::string_view ();
+				}
+			}
+			position = tag_end + 1;
+		}
+
+		position = found;
+		while ((position < end) && (*position == ' '))
+		{
+			position++;
+		}
+	}
+
+	// Prefix, :nick!user@host or :server
+	if ((position < end) && (*position == ':'))
+	{
+		position++;
+		found = (const char *)memchr (position, ' ', end - position);
+		if (found == NULL)
+		{
+			return false;
+		}
+
+		const char *at = (const char *)memchr (position, '@', found - position);
+		const char *nick_end = (at != NULL) ? at : found;
+		const char *bang = (const char *)memchr (position, '!', nick_end - position);
+		if (bang != NULL)
+		{
+			message->nick = std::string_view (position, bang - position);
+			message->user = std::string_view (bang + 1, nick_end - bang - 1);
+		}
+		else
+		{
+			message->nick = std::string_view (position, nick_end - position);
+		}
+		if (at != NULL)
+		{
+			message->host = std::string_view (at + 1, found - at - 1);
+		}
+
+		position = found;
+		while ((position < end) && (*position == ' '))
+		{
+			position++;
+		}
+	}
+
+	// Command
+	found = (const char *)memchr (position, ' ', end - position);
+	if (found == NULL)
+	{
+		found = end;
+	}
+	message->command = std::string_view (position, found - position);
+	if (message->command.empty ())
+	{
+		return false;
+	}
+	position = found;
+
+	// Parameters, the trailing one starts with a colon and may contain spaces
+	while ((position < end) && (message->param_count < IRC_MAX_PARAMS))
+	{
+		while ((position < end) && (*position == ' '))
+		{
+			position++;
+		}
+		if (position >= end)
+		{
+			break;
+		}
+
+		if (*position == ':')
+		{
+			message->params[message->param_count++] = std::string_view (position + 1, end - position - 1);
+			message->has_trailing = true;
+			break;
+		}
+
+		found = (const char *)memchr (position, ' ', end - position);
+		if (found == NULL)
+		{
+			found = end;
+		}
+		message->params[message->param_count++] = std::string_view (position, found - position);
+		position = found;
+	}
+
+	return true;
+}
+
+
+/**
+ * Returns the value of the given tag, or an empty view if the message doesn't have it
+ */
+std::string_view ircTag (const irc_message_view *message, std::string_view key)
+{
+	for (uint8_t t = 0; t < message->tag_count; t++)
+	{
+		if (message->tags[t].key == key)
+		{
+			return message->tags[t].value;
+		}
+	}
+
+	return std::string_view ();
+}
+
+
+/**
+ * Returns the last parameter, which is the text of a PRIVMSG, or an empty view if there are none
+ */
+std::string_view ircTrailing (const irc_message_view *message)
+{
+	if (message->param_count == 0)
+	{
+		return std::string_view ();
+	}
+
+	return message->params[message->param_count - 1];
+}
@@ -0,0 +1,39 @@
+#ifndef	_IRC_MESSAGE_H
+#define _IRC_MESSAGE_H
+
+#include <stdint.h>
+
+#include <string_view>
+
+// Defines the most tags and parameters kept from a single line, anything past these is ignored
+#define IRC_MAX_TAGS	32
+#define IRC_MAX_PARAMS	15
+
+// Holds a single IRCv3 message tag, the value is left escaped as it was received
+typedef struct irc_tag
+{
+	std::string_view key;
+	std::string_view value;
+} irc_tag;
+
+// Holds a parsed IRC line, every field is a view in to the line that was parsed so it is only
+// valid for as long as that line is
+typedef struct irc_message_view
+{
+	irc_tag tags[IRC_MAX_TAGS];
+	uint8_t tag_count;
+	std::string_view nick;			// Holds the server name when the prefix is a server
+	std::string_view user;
+	std::string_view host;
+	std::string_view command;
+	std::string_view params[IRC_MAX_PARAMS];	// Includes the trailing parameter as the last one
+	uint8_t param_count;
+	bool has_trailing;
+} irc_message_view;
+
+// Global function prototypes
+bool parseIRCMessage (std::string_view line, irc_message_view *message);
+std::string_view ircTag (const irc_message_view *message, std::string_view key);
+std::string_view ircTrailing (const irc_message_view *message);
+
+#endif
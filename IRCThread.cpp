@@ -3,413 +3,2817 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <random>
+#include <atomic>
 
 #include "IRCThread.hpp"
+#include "IRCMessage.hpp"
+#include "IOURing.hpp"
+#include "Resolver.hpp"
+#include "TLSTransport.hpp"
 #include "SkidBot.hpp"
 #include "Logger.hpp"
 
 // Function prototypes
-int send_command (std::string command, std::string data);
+static void ircService (irc_connection *connection);
+static void ircConnect (irc_connection *connection);
+static void ircAttempt (irc_connection *connection);
+static void ircAttemptReady (irc_connection *connection, uint8_t slot);
+static void ircHandshake (irc_connection *connection);
+static void ircAbortHandshake (irc_connection *connection);
+static void ircConnectFailed (irc_connection *connection);
+static void ircBackoff (irc_connection *connection);
+static bool ircConnecting (irc_connection *connection);
+static void ircWake (void);
+static void ircWakeMain (void);
+static void ircListenHandover (void);
+static void ircAcceptHandover (void);
+static void ircTakeOver (void);
+static bool ircWriteAll (int sock, const char *data, size_t length);
+static bool ircReadAll (int sock, std::string *data, size_t length);
+static void ircAuth (irc_connection *connection);
+static void ircProbe (irc_connection *connection);
+static bool ircProbeAnswered (irc_connection *connection, const irc_message_view *message);
+static bool ircControl (irc_connection *connection, const irc_message_view *message);
+static void ircJoinRooms (irc_connection *connection);
+static void ircRead (irc_connection *connection);
+static void ircTakeLine (irc_connection *connection, std::string_view message);
+static void ircRoomState (irc_connection *connection, const irc_message_view *message, int32_t room);
+static irc_room_state *ircLineRoom (const std::string &line);
+static const char *ircRefused (const irc_room_state *state);
+static bool ircPack (irc_connection *connection, std::string &line, uint8_t priority);
+static void ircPromote (irc_connection *connection);
+static void ircQueue (irc_connection *connection);
+static void ircClose (irc_connection *connection);
+static void ircFlush (irc_connection *connection);
+static void ircWritePending (irc_connection *connection);
+static void ircUpdateEvents (irc_connection *connection);
+static void ircHandleEvents (struct epoll_event *events, int event_count);
+static void ircTakeLines (irc_connection *connection);
+static void ircWritten (irc_connection *connection, size_t written);
+static bool ircRingDriven (irc_connection *connection);
+static uint64_t ircRingTag (uint8_t operation, irc_connection *connection);
+static void ircRingWait (int timeout);
+static void ircRingComplete (void);
+static void ircRingRead (irc_connection *connection, int32_t result);
+static void ircRingWrite (irc_connection *connection);
+static void ircRingWritten (irc_connection *connection, int32_t result);
+static void ircRingDetach (irc_connection *connection);
+static void ircRingStop (void);
+static int ircNextTimeout (void);
+static void ircSend (irc_connection *connection, const std::string &command, const std::string &data);
+static int ircSchedule (irc_connection *connection, std::string &&line, uint8_t priority);
+static std::string ircLine (const std::string &command, const std::string &data);
+static std::string ircRoomLine (const std::string &room, const std::string &message);
+static irc_connection *ircRoomConnection (const std::string &room);
 
 // Global varibles
 bool irc_running = true;
 pthread_mutex_t irc_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Used for normal twitch IRC
-uint8_t irc_task = 0;
-int irc_return;
-int irc_sock;
-int irc_port = DEFAULT_IRC_PORT;
-struct sockaddr_in irc_serv_addr;
-hostent *irc_server;
-std::chrono::high_resolution_clock::time_point irc_timeout;
+// Used by the reactor to wait on the sockets, and to be woken when closing
+int irc_epoll = -1;
+int irc_wakeup = -1;
 
-std::deque<std::string> irc_recv_buffer (20);
+// Used to wake main when the reactor has queued lines for it, main sets irc_main_waiting before it
+// sleeps, so the reactor only writes to the eventfd while main is actually waiting on it
+int irc_main_wakeup = -1;
+std::atomic<bool> irc_main_waiting {false};
+
+// Set by the reactor while it's holding lines back because a receive queue was full, main clears it and
+// wakes the reactor once the queues have drained to IRC_QUEUE_LOW_WATER
+std::atomic<bool> irc_recv_full {false};
+
+// Used instead of waiting on epoll when the uring backend is picked, the reactor owns it and reaps every
+// completion, it reads the wakeup itself and polls epoll for whatever the ring doesn't drive
+bool irc_uring = false;
+IOURing irc_ring;
+bool irc_ring_waking = false;
+bool irc_ring_polling = false;
+uint64_t irc_ring_wakeups = 0;
+irc_connection *irc_ring_detaching = NULL;
+
+// Looks the servers up off the reactor thread, and wakes the reactor when a lookup finishes
+Resolver irc_resolver (ircWake);
+
+// Used to add jitter to the reconnect backoff, so the shards don't all retry in step
+std::minstd_rand irc_random (std::random_device{}());
+
+// Used for normal twitch IRC, the reactor is the only producer and main is the only consumer, every chat
+// connection shares it so lines are tagged with the connection and room they came from
+SPSCQueue<irc_line> irc_recv_buffer (IRC_QUEUE_SIZE);
 
 // Used for groups twitch IRC
-uint8_t girc_task = 0;
-int girc_return;
-int girc_sock;
-int girc_port = DEFAULT_IRC_PORT;
-struct sockaddr_in girc_serv_addr;
-hostent *girc_server;
-std::chrono::high_resolution_clock::time_point girc_timeout;
+SPSCQueue<irc_line> girc_recv_buffer (IRC_QUEUE_SIZE);
+
+// Holds the connections the reactor drives, the groups connection followed by the chat shards
+irc_connection irc_connections[IRC_MAX_CONNECTIONS];
+uint8_t irc_connection_count = IRC_CHAT + 1;
+uint8_t irc_shards = 1;
+
+// Holds every room we join, these don't change once the connections are set up, so the room ids and
+// the views used to look them up stay valid
+std::vector<std::string> irc_rooms;
+std::unordered_map<std::string_view, uint16_t> irc_room_ids;
+
+// Holds each room's modes and our badges in it by room id, only the reactor uses these
+std::vector<irc_room_state> irc_room_states;
+
+// Holds when our recent JOINs were sent, twitch limits these per account across every connection
+std::deque<std::chrono::high_resolution_clock::time_point> irc_joins;
+
+// Holds the PRIVMSG token bucket, twitch limits these per account too so every connection draws from it
+pthread_mutex_t irc_rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+double irc_tokens = IRC_RATE_MODERATOR / 2;
+std::chrono::high_resolution_clock::time_point irc_refilled;	// Last time tokens were added to the bucket
+
+// Holds the Twitch username and OAuth of the bot user account, and the room to connect to by default
+std::string bot_user = "bot_username";
+std::string bot_oauth = "oauth:bot_oauth";
+std::string default_room = "#target_room";
+
+// Set to connect to the servers over TLS
+bool irc_tls = false;
+
+// Overrides the twitch servers when set, IE to test against a local stand-in
+std::string irc_host = "";
+int irc_port = 0;
+
+// Set to give every chat connection a warm standby, so a dropped connection is replaced straight away
+bool irc_standby = false;
+
+// How long a reply waits for others to the same room to be packed in to it, in milliseconds, 0 turns packing off,
+// the packed replies are split by the separator with a space either side
+uint16_t irc_pack_milli = 0;
+std::string irc_pack_separator = "|";
+
+// Set by the -r flag, so the connections are taken over from the running process instead of made
+bool irc_takeover = false;
+
+// Listens for a new process that wants our connections, and holds its socket once one has asked
+int irc_handover_listener = -1;
+std::atomic<int> irc_handover {-1};
+
+// How often each connection is probed, in seconds, and how many probes may be missed before it's dropped
+uint16_t irc_probe_interval = IRC_PROBE_SECONDS;
+uint8_t irc_probe_misses = IRC_PROBE_MISSES;
+
+extern Logger *logger;
+
+
+/**
+ * Sets up the groups connection and the chat shards, and spreads the rooms across the shards,
+ * this must be called once the configuration has been read and before IRCThread is started
+ */
+int setupIRCConnections (void)
+{
+	struct epoll_event event;
+	uint8_t t;
+
+	if ((irc_shards < 1) || (irc_shards > IRC_MAX_SHARDS))
+	{
+		logger->logf (" IRCThread: I can't use %d chat connections, so I'm using 1.\n", irc_shards);
+		irc_shards = 1;
+	}
+	irc_connection_count = IRC_CHAT + (irc_shards * (irc_standby ? 2 : 1));
+
+	// Sets up the connections
+	irc_connections[IRC_GROUPS].name = "GIRCThread";
+	irc_connections[IRC_GROUPS].description = "groups IRC server";
+	irc_connections[IRC_GROUPS].host = irc_host.empty () ? "irc.chat.twitch.tv" : irc_host.c_str ();
+	irc_connections[IRC_GROUPS].port = (irc_port > 0) ? irc_port : (irc_tls ? DEFAULT_IRC_TLS_PORT : DEFAULT_IRC_PORT);
+	irc_connections[IRC_GROUPS].recv_buffer = &girc_recv_buffer;
+	for (t = IRC_CHAT; t < IRC_CHAT + irc_shards; t++)
+	{
+		irc_connection *connection = &irc_connections[t];
+		if (t == IRC_CHAT)
+		{
+			snprintf (connection->name_buffer, sizeof (connection->name_buffer), "IRCThread");
+		}
+		else
+		{
+			snprintf (connection->name_buffer, sizeof (connection->name_buffer), "IRCThread %d", t);
+		}
+		connection->name = connection->name_buffer;
+		connection->description = "IRC server";
+		connection->host = irc_host.empty () ? "irc.twitch.tv" : irc_host.c_str ();
+		connection->port = (irc_port > 0) ? irc_port : (irc_tls ? DEFAULT_IRC_TLS_PORT : DEFAULT_IRC_PORT);
+		connection->recv_buffer = &irc_recv_buffer;
+	}
+
+	// The default room is always joined, and duplicates are skipped
+	irc_rooms.insert (irc_rooms.begin (), default_room);
+	for (std::vector<std::string>::iterator room = irc_rooms.begin (); room != irc_rooms.end ();)
+	{
+		if ((room->empty ()) || (std::find (irc_rooms.begin (), room, *room) != room))
+		{
+			room = irc_rooms.erase (room);
+		}
+		else
+		{
+			room++;
+		}
+	}
+
+	// Shards the rooms across the chat connections
+	for (size_t room = 0; room < irc_rooms.size (); room++)
+	{
+		irc_room_ids[irc_rooms[room]] = room;
+		ircRoomConnection (irc_rooms[room])->rooms.push_back (room);
+	}
+	irc_room_states.resize (irc_rooms.size ());
+	logger->logf (" IRCThread: I'm going to join %zu rooms across %d connections.\n", irc_rooms.size (), irc_shards);
+
+	// Each standby logs in and joins the same rooms as its chat connection, but stays quiet
+	for (t = IRC_CHAT; (irc_standby) && (t < IRC_CHAT + irc_shards); t++)
+	{
+		irc_connection *connection = &irc_connections[t];
+		irc_connection *standby = &irc_connections[t + irc_shards];
+		snprintf (standby->name_buffer, sizeof (standby->name_buffer), "%s standby", connection->name);
+		standby->name = standby->name_buffer;
+		standby->description = connection->description;
+		standby->host = connection->host;
+		standby->port = connection->port;
+		standby->recv_buffer = connection->recv_buffer;
+		standby->rooms = connection->rooms;
+		standby->passive = true;
+		connection->standby = standby;
+		connection->delivered.assign (IRC_STANDBY_BACKLOG, 0);
+	}
+
+	// Creates the epoll instance, and the eventfd used to wake it when there is something to send or when closing
+	irc_epoll = epoll_create1 (EPOLL_CLOEXEC);
+	irc_wakeup = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	irc_main_wakeup = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((irc_epoll < 0) || (irc_wakeup < 0) || (irc_main_wakeup < 0))
+	{
+		logger->logf (" IRCThread: I was unable to create my epoll reactor, reason: %s.\n", strerror(errno));
+		return -1;
+	}
+
+	// The uring backend shares one ring between the sockets and the log, if we can't have one we stay on epoll
+	if ((irc_uring) && (irc_ring.setup (IRC_RING_ENTRIES, (irc_connection_count * 2) + 1, IRC_RING_BUFFER) < 0))
+	{
+		logger->logf (" IRCThread: I was unable to set up io_uring, so I'm using epoll, reason: %s.\n", strerror(errno));
+	}
+	else if (irc_uring)
+	{
+		logger->log (" IRCThread: I'm using io_uring for my sockets and log file.\n");
+	}
+
+	// The ring reads the wakeup itself
+	if (!irc_ring.ready ())
+	{
+		memset (&event, 0, sizeof (event));
+		event.events = EPOLLIN;
+		event.data.u32 = IRC_MAX_CONNECTIONS;
+		epoll_ctl (irc_epoll, EPOLL_CTL_ADD, irc_wakeup, &event);
+	}
+
+	// Takes the connections over from the process we're replacing, then waits for our own replacement
+	if (irc_takeover)
+	{
+		ircTakeOver ();
+	}
+	ircListenHandover ();
+
+	if (irc_resolver.start () < 0)
+	{
+		return -1;
+	}
+	if ((irc_tls) && (setupTLS () < 0))
+	{
+		return -1;
+	}
+
+	return 1;
+}
+
+
+/**
+ * IRCThread, a single epoll reactor that drives the groups connection and every chat connection,
+ * waking only when a socket is ready or a connection has a timer due. With the uring backend it
+ * waits on the ring instead, which reads and writes the running sockets for it.
+ */
+void *IRCThread (void *)
+{
+	struct epoll_event events[IRC_MAX_EVENTS];
+	int event_count;
+	int t;
+
+	if (irc_epoll < 0)
+	{
+		return NULL;
+	}
+
+	// Log lines go through the ring too, we reap their completions along with the sockets
+	if (irc_ring.ready ())
+	{
+		irc_ring.setOwner ();
+		logger->useRing (&irc_ring, irc_connection_count * 2, (uint64_t)IRC_RING_LOG << 8);
+	}
+
+	lock (irc_mutex);
+	while (irc_running)
+	{
+		release (irc_mutex);
+
+		// Move along any connections that have state changes or timers due
+		for (t = 0; t < irc_connection_count; t++)
+		{
+			ircService (&irc_connections[t]);
+		}
+
+		// Let main know about everything queued since we last slept, in one go
+		ircWakeMain ();
+
+		// Sleep until a socket is ready or the next timer is due
+		if (irc_ring.ready ())
+		{
+			ircRingWait (ircNextTimeout ());
+		}
+		else
+		{
+			event_count = epoll_wait (irc_epoll, events, IRC_MAX_EVENTS, ircNextTimeout ());
+			ircHandleEvents (events, event_count);
+		}
+
+		lock (irc_mutex);
+	}
+	release (irc_mutex);
+
+	// Everything after this goes back to plain system calls
+	if (irc_ring.ready ())
+	{
+		ircRingStop ();
+	}
+
+	for (t = 0; t < irc_connection_count; t++)
+	{
+		irc_connection *connection = &irc_connections[t];
+		if (connection->sock >= 0)
+		{
+			// Send anything we still can before leaving
+			if (connection->task == IRC_RUNNING)
+			{
+				ircFlush (connection);
+			}
+
+			// A plain connection that's running is left open for the new process, TLS state can't be
+			// handed over so those leave like normal and the new process reconnects them
+			if ((irc_handover >= 0) && (connection->task == IRC_RUNNING) && (connection->ssl == NULL))
+			{
+				epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->sock, NULL);
+				logger->logf (" %s: I'm leaving the %s connection open for my new process.\n", connection->name, connection->description);
+				continue;
+			}
+
+			if (connection->task != IRC_HANDSHAKE)
+			{
+				ircSend (connection, "PART", "Bye Bye ^^");
+				ircSend (connection, "QUIT", "SkidBot");
+				ircWritePending (connection);
+			}
+			tlsClose (connection->ssl, false);
+			connection->ssl = NULL;
+			close (connection->sock);
+			connection->sock = -1;
+		}
+		for (uint8_t slot = 0; slot < IRC_MAX_ATTEMPTS; slot++)
+		{
+			if (connection->attempts[slot] >= 0)
+			{
+				close (connection->attempts[slot]);
+				connection->attempts[slot] = -1;
+			}
+		}
+		connection->overflow.clear ();
+
+		logger->logf (" %s: I've stopped the %s connection.\n", connection->name, connection->description);
+	}
+
+	// The socket's path belongs to the new process once it has asked for our connections
+	if (irc_handover_listener >= 0)
+	{
+		close (irc_handover_listener);
+		if (irc_handover < 0)
+		{
+			unlink (IRC_HANDOVER_PATH);
+		}
+	}
+
+	irc_resolver.stop ();
+	cleanupTLS ();
+	close (irc_wakeup);
+	close (irc_epoll);
+
+	return NULL;
+}
+
+
+/**
+ * Handles the sockets epoll found ready, the wakeup, the handover listener, connection attempts, TLS
+ * handshakes and the running connections
+ */
+static void ircHandleEvents (struct epoll_event *events, int event_count)
+{
+	int t;
+
+	for (t = 0; t < event_count; t++)
+	{
+		if (events[t].data.u32 == IRC_MAX_CONNECTIONS)
+		{
+			uint64_t wakeups;
+			while (read (irc_wakeup, &wakeups, sizeof (wakeups)) > 0);
+			continue;
+		}
+		if (events[t].data.u32 == IRC_MAX_CONNECTIONS + 1)
+		{
+			ircAcceptHandover ();
+			continue;
+		}
+
+		// Sockets that are still connecting are tagged with their attempt slot above the connection index
+		irc_connection *connection = &irc_connections[events[t].data.u32 & 0xFF];
+		if ((events[t].data.u32 >> 8) != 0)
+		{
+			ircAttemptReady (connection, (events[t].data.u32 >> 8) - 1);
+			continue;
+		}
+		if (connection->task == IRC_HANDSHAKE)
+		{
+			ircHandshake (connection);
+			continue;
+		}
+		if (connection->task != IRC_RUNNING)
+		{
+			continue;
+		}
+
+		// The ring reads and writes sockets it drives, epoll only tells us if one fails
+		if ((ircRingDriven (connection)) && ((events[t].events & (EPOLLERR | EPOLLHUP)) == 0))
+		{
+			continue;
+		}
+
+		if (events[t].events & EPOLLOUT)
+		{
+			ircWritePending (connection);
+		}
+		if (events[t].events & EPOLLIN)
+		{
+			ircRead (connection);
+		}
+		else if (events[t].events & (EPOLLERR | EPOLLHUP))
+		{
+			logger->logf (" %s: The %s dropped the connection, so I'm reconnecting.\n", connection->name, connection->description);
+			connection->task = IRC_CLOSE;
+		}
+	}
+}
+
+
+/**
+ * Asks the reactor to stop, and wakes it so it notices straight away
+ */
+void stopIRCThread (void)
+{
+	uint64_t wakeup = 1;
+
+	lock (irc_mutex);
+	irc_running = false;
+	release (irc_mutex);
+
+	if (write (irc_wakeup, &wakeup, sizeof (wakeup)) < 0)
+	{
+		logger->logf (" IRCThread: I was unable to wake my reactor, reason: %s.\n", strerror(errno));
+	}
+}
+
+
+/**
+ * Sleeps main until the reactor has queued lines for it, wakeMain is called, or the timeout in
+ * milliseconds passes, -1 waits for as long as it takes
+ */
+void waitIRCLines (int timeout_milli)
+{
+	struct pollfd wakeup;
+	uint64_t wakeups;
+
+	// Main empties the queues before waiting, so if the reactor is holding lines back this is where it's
+	// told there's room for them, pairs with the fence in ircNextTimeout
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	if ((irc_recv_buffer.size () <= IRC_QUEUE_LOW_WATER) && (girc_recv_buffer.size () <= IRC_QUEUE_LOW_WATER) && (irc_recv_full.exchange (false)))
+	{
+		ircWake ();
+	}
+
+	// Say we're waiting before the last look at the queues, so anything queued after it wakes us
+	irc_main_waiting.store (true);
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	if ((irc_recv_buffer.size () > 0) || (girc_recv_buffer.size () > 0) || (irc_handover >= 0))
+	{
+		irc_main_waiting.store (false);
+		return;
+	}
+
+	wakeup.fd = irc_main_wakeup;
+	wakeup.events = POLLIN;
+	wakeup.revents = 0;
+	int ready = poll (&wakeup, 1, timeout_milli);
+	irc_main_waiting.store (false);
+
+	if ((ready < 0) && (errno != EINTR))
+	{
+		logger->logf (" IRCThread: I had a problem waiting for lines, reason: %s.\n", strerror(errno));
+	}
+	else if (ready > 0)
+	{
+		// Clear the wakeup, main looks at everything that could have set it before waiting again
+		if (read (irc_main_wakeup, &wakeups, sizeof (wakeups)) < 0)
+		{
+			logger->debugf (DEBUG_MINIMAL, " IRCThread: I was unable to clear main's wakeup, reason: %s.\n", strerror(errno));
+		}
+	}
+}
+
+
+/**
+ * Wakes main from waitIRCLines, this only makes a system call so it's safe to use in a signal handler
+ */
+void wakeMain (void)
+{
+	uint64_t wakeup = 1;
+	ssize_t written = write (irc_main_wakeup, &wakeup, sizeof (wakeup));
+	(void)written;
+}
+
+
+/**
+ * Returns true once a new process has asked for our connections, main should then stop the reactor
+ * and call handOverIRCConnections
+ */
+bool handingOverIRC (void)
+{
+	return (irc_handover >= 0);
+}
+
+
+/**
+ * Hands the running plain connections to the new process that asked for them, each socket is passed
+ * with SCM_RIGHTS along with the lines main hadn't handled yet, the partial line and anything that
+ * wasn't sent, so the new process carries on without logging in again or losing anything. This must
+ * be called from main once the reactor has stopped.
+ */
+void handOverIRCConnections (void)
+{
+	std::string lines[IRC_MAX_CONNECTIONS];
+	irc_line received;
+	int sock = irc_handover;
+	int handed = 0;
+	uint8_t t;
+
+	if (sock < 0)
+	{
+		return;
+	}
+
+	// Main is the consumer, so the lines it hadn't got to yet are ours to give away
+	while (irc_recv_buffer.pop (&received))
+	{
+		lines[received.connection] += received.line + "\r\n";
+	}
+	while (girc_recv_buffer.pop (&received))
+	{
+		lines[received.connection] += received.line + "\r\n";
+	}
+
+	for (t = 0; t < irc_connection_count; t++)
+	{
+		irc_connection *connection = &irc_connections[t];
+		if (connection->sock < 0)
+		{
+			continue;
+		}
+
+		// Lines held back by the reactor come after the ones main already had
+		for (irc_line &line : connection->overflow)
+		{
+			lines[t] += line.line + "\r\n";
+		}
+		connection->overflow.clear ();
+		std::string_view partial = connection->lines.unread ();
+
+		// Whatever was part way out goes first, then the lanes in the order they would have been sent
+		std::string unsent;
+		lock (connection->send_mutex);
+		for (std::deque<std::string>::iterator line = connection->outbound.begin (); line != connection->outbound.end (); line++)
+		{
+			unsent.append (*line, (line == connection->outbound.begin ()) ? connection->outbound_offset : 0);
+		}
+		const uint8_t order[IRC_LANES] = {IRC_PRIORITY_CONTROL, IRC_PRIORITY_HIGH, IRC_PRIORITY_NORMAL, IRC_PRIORITY_LOW};
+		for (uint8_t lane : order)
+		{
+			for (std::string &line : connection->lanes[lane])
+			{
+				unsent += line;
+			}
+			connection->lanes[lane].clear ();
+		}
+		irc_handover_record record;
+		record.connection = t;
+		record.shards = irc_shards;
+		record.caps = connection->caps;
+		record.joined = connection->joined;
+		lock (irc_rate_mutex);
+		record.tokens = irc_tokens;
+		release (irc_rate_mutex);
+		record.lines = lines[t].size ();
+		record.partial = partial.size ();
+		record.unsent = unsent.size ();
+		release (connection->send_mutex);
+
+		// The socket rides along with the record
+		char control[CMSG_SPACE (sizeof (int))];
+		struct iovec iov = {&record, sizeof (record)};
+		struct msghdr message;
+		memset (&message, 0, sizeof (message));
+		memset (control, 0, sizeof (control));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof (control);
+		struct cmsghdr *header = CMSG_FIRSTHDR (&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN (sizeof (int));
+		memcpy (CMSG_DATA (header), &connection->sock, sizeof (int));
+
+		if ((sendmsg (sock, &message, MSG_NOSIGNAL) != sizeof (record)) || (!ircWriteAll (sock, lines[t].data (), lines[t].size ())) ||
+			(!ircWriteAll (sock, partial.data (), partial.size ())) || (!ircWriteAll (sock, unsent.data (), unsent.size ())))
+		{
+			logger->logf (" %s: I was unable to hand the %s connection over, reason: %s.\n", connection->name, connection->description, strerror(errno));
+			break;
+		}
+		logger->logf (" %s: I've handed the %s connection over with %zu bytes still to handle and %zu to send.\n", connection->name, connection->description, lines[t].size () + partial.size (), unsent.size ());
+
+		// Our copy of the socket can go, the new process has its own
+		close (connection->sock);
+		connection->sock = -1;
+		connection->lines.clear ();
+		handed++;
+	}
+
+	irc_handover_record record;
+	ircWriteAll (sock, (const char *)&record, sizeof (record));
+	close (sock);
+	irc_handover = -1;
+
+	// Anything we couldn't hand over is closed, the server will notice
+	for (t = 0; t < irc_connection_count; t++)
+	{
+		if (irc_connections[t].sock >= 0)
+		{
+			close (irc_connections[t].sock);
+			irc_connections[t].sock = -1;
+		}
+	}
+
+	logger->logf (" IRCThread: I've handed %d connections over to my new process.\n", handed);
+}
+
+
+/**
+ * Listens on IRC_HANDOVER_PATH for the process that will replace us, only our own user may connect
+ */
+static void ircListenHandover (void)
+{
+	struct sockaddr_un address;
+	struct epoll_event event;
+
+	memset (&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	strncpy (address.sun_path, IRC_HANDOVER_PATH, sizeof (address.sun_path) - 1);
+
+	// Any socket left here is either stale or belonged to the process we just took over from
+	unlink (IRC_HANDOVER_PATH);
+	irc_handover_listener = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ((irc_handover_listener < 0) || (bind (irc_handover_listener, (struct sockaddr *)&address, sizeof (address)) < 0) ||
+		(chmod (IRC_HANDOVER_PATH, 0600) < 0) || (listen (irc_handover_listener, 1) < 0))
+	{
+		logger->logf (" IRCThread: I was unable to listen for a new process to hand over to, reason: %s.\n", strerror(errno));
+		if (irc_handover_listener >= 0)
+		{
+			close (irc_handover_listener);
+			irc_handover_listener = -1;
+		}
+		return;
+	}
+
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN;
+	event.data.u32 = IRC_MAX_CONNECTIONS + 1;
+	epoll_ctl (irc_epoll, EPOLL_CTL_ADD, irc_handover_listener, &event);
+}
+
+
+/**
+ * Accepts a new process asking for our connections, main notices and starts the handover
+ */
+static void ircAcceptHandover (void)
+{
+	struct ucred credentials;
+	socklen_t credentials_length = sizeof (credentials);
+	int sock;
+
+	while ((sock = accept4 (irc_handover_listener, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+	{
+		if ((getsockopt (sock, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) < 0) || (credentials.uid != getuid ()))
+		{
+			logger->log (" IRCThread: A process that isn't running as me asked for my connections, so I ignored it.\n");
+			close (sock);
+			continue;
+		}
+		if (irc_handover >= 0)
+		{
+			close (sock);
+			continue;
+		}
+
+		logger->logf (" IRCThread: Process %d has asked for my connections, I'm going to hand them over.\n", (int)credentials.pid);
+		irc_handover = sock;
+		wakeMain ();
+	}
+}
+
+
+/**
+ * Takes the connections over from the process we're replacing, they carry on running without logging
+ * in again, any that can't be taken over are connected as normal
+ */
+static void ircTakeOver (void)
+{
+	struct sockaddr_un address;
+	struct epoll_event event;
+	std::string lines;
+	std::string partial;
+	std::string unsent;
+	int taken = 0;
+	int sock;
+
+	memset (&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	strncpy (address.sun_path, IRC_HANDOVER_PATH, sizeof (address.sun_path) - 1);
+
+	sock = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ((sock < 0) || (connect (sock, (struct sockaddr *)&address, sizeof (address)) < 0))
+	{
+		logger->logf (" IRCThread: I couldn't find a process to take over from, so I'm connecting like normal, reason: %s.\n", strerror(errno));
+		if (sock >= 0)
+		{
+			close (sock);
+		}
+		return;
+	}
+	logger->log (" IRCThread: I'm waiting for the running process to hand its connections over.\n");
+
+	while (true)
+	{
+		irc_handover_record record;
+		char control[CMSG_SPACE (sizeof (int))];
+		struct iovec iov = {&record, sizeof (record)};
+		struct msghdr message;
+		int received = -1;
+
+		memset (&message, 0, sizeof (message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof (control);
+		ssize_t length = recvmsg (sock, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+		if (length <= 0)
+		{
+			logger->logf (" IRCThread: The old process stopped handing its connections over part way through, reason: %s.\n", strerror(errno));
+			break;
+		}
+		struct cmsghdr *header = CMSG_FIRSTHDR (&message);
+		if ((header != NULL) && (header->cmsg_level == SOL_SOCKET) && (header->cmsg_type == SCM_RIGHTS))
+		{
+			memcpy (&received, CMSG_DATA (header), sizeof (int));
+		}
+
+		// A record laid out differently would have us read the wrong lengths and send junk down live sockets,
+		// so we stop taking connections over and connect the rest like normal
+		if ((length != sizeof (record)) || (record.magic != IRC_HANDOVER_MAGIC) || (record.version != IRC_HANDOVER_VERSION) || (record.size != sizeof (record)))
+		{
+			logger->logf (" IRCThread: The old process hands its connections over in a different format, version %d, so I'm connecting like normal.\n", (record.magic == IRC_HANDOVER_MAGIC) ? record.version : 0);
+			if (received >= 0)
+			{
+				close (received);
+			}
+			break;
+		}
+		if (record.connection == IRC_HANDOVER_END)
+		{
+			break;
+		}
+		if ((!ircReadAll (sock, &lines, record.lines)) || (!ircReadAll (sock, &partial, record.partial)) || (!ircReadAll (sock, &unsent, record.unsent)))
+		{
+			logger->logf (" IRCThread: The old process stopped handing its connections over part way through, reason: %s.\n", strerror(errno));
+			if (received >= 0)
+			{
+				close (received);
+			}
+			break;
+		}
+
+		// The rooms are sharded by the connection count, so a changed count means they're on the wrong connections
+		if ((received < 0) || (record.connection >= irc_connection_count) || (record.shards != irc_shards))
+		{
+			logger->logf (" IRCThread: I can't take over connection %d as the number of connections has changed, so I'm dropping it.\n", record.connection);
+			if (received >= 0)
+			{
+				close (received);
+			}
+			continue;
+		}
+
+		irc_connection *connection = &irc_connections[record.connection];
+		connection->sock = received;
+		connection->task = IRC_RUNNING;
+		connection->caps = record.caps;
+		connection->joined = std::min ((size_t)record.joined, connection->rooms.size ());
+		lock (irc_rate_mutex);
+		irc_tokens = std::min (irc_tokens, record.tokens);
+		irc_refilled = hrc_now;
+		release (irc_rate_mutex);
+		connection->timeout = hrc_now;
+		connection->connected = hrc_now;
+		connection->probe_sent = hrc_now;
+		connection->probing = false;
+		connection->missed = 0;
+
+		memset (&event, 0, sizeof (event));
+		event.events = ircRingDriven (connection) ? 0 : (EPOLLIN | EPOLLRDHUP);
+		event.data.u32 = record.connection;
+		epoll_ctl (irc_epoll, EPOLL_CTL_ADD, connection->sock, &event);
+
+		// Send what the old process couldn't, then carry on with what it had received
+		if (!unsent.empty ())
+		{
+			connection->outbound.push_back (std::move (unsent));
+			unsent.clear ();
+		}
+		std::string_view remaining (lines);
+		std::size_t end;
+		while ((end = remaining.find ('\n')) != std::string_view::npos)
+		{
+			std::string_view line = remaining.substr (0, end);
+			if ((!line.empty ()) && (line.back () == '\r'))
+			{
+				line.remove_suffix (1);
+			}
+			if (!line.empty ())
+			{
+				ircTakeLine (connection, line);
+			}
+			remaining.remove_prefix (end + 1);
+		}
+		connection->lines.append (partial.data (), partial.size ());
+		ircWritePending (connection);
+
+		logger->logf (" %s: I've taken over the %s connection with %zu bytes still to handle and %zu to send.\n", connection->name, connection->description, lines.size () + partial.size (), connection->outbound.empty () ? 0 : connection->outbound.front ().size ());
+		taken++;
+	}
+
+	close (sock);
+	logger->logf (" IRCThread: I've taken over %d connections from the old process.\n", taken);
+}
+
+
+/**
+ * Writes all of the data to a blocking socket, returns false if it couldn't
+ */
+static bool ircWriteAll (int sock, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t write_return = send (sock, data, length, MSG_NOSIGNAL);
+		if (write_return < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		data += write_return;
+		length -= write_return;
+	}
+
+	return true;
+}
+
+
+/**
+ * Reads exactly length bytes from a blocking socket in to data, returns false if it couldn't
+ */
+static bool ircReadAll (int sock, std::string *data, size_t length)
+{
+	data->resize (length);
+	size_t offset = 0;
+
+	while (offset < length)
+	{
+		ssize_t read_return = read (sock, &(*data)[offset], length - offset);
+		if (read_return <= 0)
+		{
+			if ((read_return < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			if (read_return == 0)
+			{
+				errno = ECONNRESET;
+			}
+			return false;
+		}
+		offset += read_return;
+	}
+
+	return true;
+}
+
+
+/**
+ * Runs the IRC_CONNECT/IRC_HANDSHAKE/IRC_AUTH/IRC_RUNNING/IRC_CLOSE state machine for a connection,
+ * this is called every time the reactor wakes
+ */
+static void ircService (irc_connection *connection)
+{
+	switch (connection->task)
+	{
+		case (IRC_CLOSE):
+		{
+			// A standby that has joined everything takes over without us having to reconnect
+			if ((connection->standby != NULL) && (connection->standby->task == IRC_RUNNING) && (connection->standby->joined >= connection->standby->rooms.size ()))
+			{
+				ircPromote (connection);
+				break;
+			}
+			ircClose (connection);
+		}
+		// Fall through, so we start reconnecting straight away
+
+		case (IRC_CONNECT):
+		{
+			if (hrc_now < connection->retry)
+			{
+				break;
+			}
+
+			ircConnect (connection);
+			if (connection->task == IRC_CONNECT)
+			{
+				break;
+			}
+		}
+		// Fall through, so we start the handshake or authorise as soon as we've connected
+
+		case (IRC_HANDSHAKE):
+		{
+			if (connection->task == IRC_HANDSHAKE)
+			{
+				// The handshake is moved along by the socket events, so only check it hasn't stalled
+				if (hrc_now >= connection->deadline)
+				{
+					logger->logf (" %s: I timed out securing the connection to the %s.\n", connection->name, connection->description);
+					ircAbortHandshake (connection);
+				}
+				break;
+			}
+		}
+		// Fall through, so we authorise as soon as the connection is ready
+
+		case (IRC_AUTH):
+		{
+			ircAuth (connection);
+		}
+		break;
+
+		case (IRC_RUNNING):
+		{
+			// If lines were held back because the receive queue was full, try to hand them over again
+			if (!connection->overflow.empty ())
+			{
+				ircQueue (connection);
+			}
+
+			// Join any rooms the join limit allows, and send anything waiting that the rate limit allows
+			ircJoinRooms (connection);
+			ircFlush (connection);
+
+			// Check the server is still answering
+			ircProbe (connection);
+		}
+		break;
+	}
+}
+
+
+/**
+ * Starts connecting to the server without blocking the reactor, the host is looked up by the resolver
+ * and its addresses are raced against each other, the first socket to connect is kept
+ */
+static void ircConnect (irc_connection *connection)
+{
+	std::chrono::high_resolution_clock::time_point now = hrc_now;
+	int resolve_error = 0;
+	int resolve_return;
+
+	// Already connecting, race the next address if the others are slow, or give up at the deadline
+	if (ircConnecting (connection))
+	{
+		if (now >= connection->deadline)
+		{
+			logger->logf (" %s: I timed out connecting to the %s.\n", connection->name, connection->description);
+			ircConnectFailed (connection);
+		}
+		else if (now >= connection->next_attempt)
+		{
+			ircAttempt (connection);
+		}
+		return;
+	}
+
+	if (!connection->resolving)
+	{
+		connection->deadline = now + std::chrono::seconds(IRC_CONNECT_TIMEOUT);
+	}
+	resolve_return = irc_resolver.lookup (connection->host, connection->port, &connection->addresses, &resolve_error);
+	if (resolve_return == RESOLVER_PENDING)
+	{
+		// The resolver wakes us when it's done
+		if ((connection->resolving) && (now >= connection->deadline))
+		{
+			logger->logf (" %s: I timed out finding the %s.\n", connection->name, connection->description);
+			connection->resolving = false;
+			ircBackoff (connection);
+			return;
+		}
+		connection->resolving = true;
+		return;
+	}
+	connection->resolving = false;
+	if (resolve_return == RESOLVER_FAILED)
+	{
+		logger->logf (" %s: I was unable to find the %s, reason: %s.\n", connection->name, connection->description, gai_strerror (resolve_error));
+		ircBackoff (connection);
+		return;
+	}
+
+	connection->next_address = 0;
+	connection->deadline = now + std::chrono::seconds(IRC_CONNECT_TIMEOUT);
+	connection->connecting = now;
+	ircAttempt (connection);
+}
+
+
+/**
+ * Starts a non-blocking connect to the next address, skipping any that fail straight away
+ */
+static void ircAttempt (irc_connection *connection)
+{
+	struct epoll_event event;
+	uint8_t slot;
+	int sock;
+
+	while (connection->next_address < connection->addresses.size ())
+	{
+		for (slot = 0; (slot < IRC_MAX_ATTEMPTS) && (connection->attempts[slot] >= 0); slot++);
+		if (slot == IRC_MAX_ATTEMPTS)
+		{
+			break;
+		}
+
+		const struct sockaddr_storage &address = connection->addresses[connection->next_address++];
+		socklen_t address_length = (address.ss_family == AF_INET6) ? sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in);
+		sock = socket (address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (sock < 0)
+		{
+			logger->logf (" %s: I was unable to open a socket, reason: %s.\n", connection->name, strerror(errno));
+			continue;
+		}
+
+		if ((connect (sock, (const struct sockaddr *)&address, address_length) == 0) || (errno == EINPROGRESS))
+		{
+			// Epoll tells us it's writable once the connect has finished, either way
+			memset (&event, 0, sizeof (event));
+			event.events = EPOLLOUT;
+			event.data.u32 = (connection - irc_connections) | ((slot + 1) << 8);
+			epoll_ctl (irc_epoll, EPOLL_CTL_ADD, sock, &event);
+
+			connection->attempts[slot] = sock;
+			connection->next_attempt = hrc_now + std::chrono::milliseconds(IRC_ATTEMPT_MILLI);
+			return;
+		}
+
+		logger->logf (" %s: I was unable to connect to the %s, reason: %s.\n", connection->name, connection->description, strerror(errno));
+		close (sock);
+	}
+
+	// Nothing left to race, so just wait on the attempts we have
+	connection->next_attempt = connection->deadline;
+	if (!ircConnecting (connection))
+	{
+		ircConnectFailed (connection);
+	}
+}
+
+
+/**
+ * Called when a connecting socket becomes writable, the first to connect becomes the connections
+ * socket and the rest are closed, if it failed the next address is tried straight away
+ */
+static void ircAttemptReady (irc_connection *connection, uint8_t slot)
+{
+	struct epoll_event event;
+	socklen_t error_length;
+	int sock;
+	int error;
+
+	if ((slot >= IRC_MAX_ATTEMPTS) || (connection->attempts[slot] < 0))
+	{
+		return;
+	}
+	sock = connection->attempts[slot];
+	connection->attempts[slot] = -1;
+	epoll_ctl (irc_epoll, EPOLL_CTL_DEL, sock, NULL);
+
+	error = 0;
+	error_length = sizeof (error);
+	if (getsockopt (sock, SOL_SOCKET, SO_ERROR, &error, &error_length) < 0)
+	{
+		error = errno;
+	}
+	if (error != 0)
+	{
+		logger->logf (" %s: I was unable to connect to the %s, reason: %s.\n", connection->name, connection->description, strerror(error));
+		close (sock);
+		ircAttempt (connection);
+		return;
+	}
+
+	// We have a winner, stop the others
+	for (slot = 0; slot < IRC_MAX_ATTEMPTS; slot++)
+	{
+		if (connection->attempts[slot] >= 0)
+		{
+			epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->attempts[slot], NULL);
+			close (connection->attempts[slot]);
+			connection->attempts[slot] = -1;
+		}
+	}
+
+	// From here on nothing may block the reactor, writes that don't fit wait for EPOLLOUT, and as
+	// we gather lines ourselves Nagle would only hold the last of them back
+	connection->sock = sock;
+	int nodelay = 1;
+	setsockopt (connection->sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+
+	// Let the kernel spot a dead link too, even while we're not sending, and stop it retrying
+	// unacknowledged writes for longer than the probes would wait
+	int keepalive = 1;
+	int keepalive_idle = irc_probe_interval;
+	int keepalive_count = irc_probe_misses;
+	unsigned int user_timeout = irc_probe_interval * irc_probe_misses * 1000;
+	setsockopt (connection->sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof (keepalive));
+	setsockopt (connection->sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive_idle, sizeof (keepalive_idle));
+	setsockopt (connection->sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepalive_idle, sizeof (keepalive_idle));
+	setsockopt (connection->sock, IPPROTO_TCP, TCP_KEEPCNT, &keepalive_count, sizeof (keepalive_count));
+	setsockopt (connection->sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof (user_timeout));
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.u32 = connection - irc_connections;
+	epoll_ctl (irc_epoll, EPOLL_CTL_ADD, connection->sock, &event);
+
+	connection->timeout = hrc_now;
+	connection->connected = hrc_now;
+	logger->logf (" %s: I've connected to the %s.\n", connection->name, connection->description);
+
+	if (!irc_tls)
+	{
+		connection->task = IRC_AUTH;
+		return;
+	}
+
+	connection->ssl = tlsOpen (connection->sock, connection->host);
+	if (connection->ssl == NULL)
+	{
+		logger->logf (" %s: I was unable to start TLS, reason: %s.\n", connection->name, tlsError ());
+		epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->sock, NULL);
+		close (connection->sock);
+		connection->sock = -1;
+		ircBackoff (connection);
+		return;
+	}
+	connection->task = IRC_HANDSHAKE;
+	ircHandshake (connection);
+}
+
+
+/**
+ * Moves the TLS handshake along whenever the socket is ready, waiting on whichever direction OpenSSL
+ * asks for, once it's done the connection carries on to authorise
+ */
+static void ircHandshake (irc_connection *connection)
+{
+	struct epoll_event event;
+	int handshake_return;
+
+	handshake_return = tlsHandshake (connection->ssl);
+	if (handshake_return == TLS_DONE)
+	{
+		logger->debugf (DEBUG_MINIMAL, " %s: I've secured the connection to the %s in %.2f ms, %s.\n", connection->name, connection->description,
+			std::chrono::duration<double, std::milli>(hrc_now - connection->connecting).count (), SSL_session_reused (connection->ssl) ? "resuming the last session" : "with a full handshake");
+		connection->task = IRC_AUTH;
+		ircUpdateEvents (connection);
+		return;
+	}
+
+	if (handshake_return == TLS_FAILED)
+	{
+		logger->logf (" %s: I was unable to secure the connection to the %s, reason: %s.\n", connection->name, connection->description, tlsError ());
+		ircAbortHandshake (connection);
+		return;
+	}
+
+	memset (&event, 0, sizeof (event));
+	event.events = (handshake_return == TLS_WANT_WRITE) ? EPOLLOUT : EPOLLIN;
+	event.data.u32 = connection - irc_connections;
+	epoll_ctl (irc_epoll, EPOLL_CTL_MOD, connection->sock, &event);
+}
+
+
+/**
+ * Drops a connection whose handshake failed or stalled, and backs off before trying again
+ */
+static void ircAbortHandshake (irc_connection *connection)
+{
+	tlsClose (connection->ssl, true);
+	connection->ssl = NULL;
+	epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->sock, NULL);
+	close (connection->sock);
+	connection->sock = -1;
+	connection->task = IRC_CONNECT;
+	ircBackoff (connection);
+}
+
+
+/**
+ * Closes any sockets still connecting, and backs off before trying again
+ */
+static void ircConnectFailed (irc_connection *connection)
+{
+	uint8_t slot;
+
+	for (slot = 0; slot < IRC_MAX_ATTEMPTS; slot++)
+	{
+		if (connection->attempts[slot] >= 0)
+		{
+			epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->attempts[slot], NULL);
+			close (connection->attempts[slot]);
+			connection->attempts[slot] = -1;
+		}
+	}
+
+	ircBackoff (connection);
+}
+
+
+/**
+ * Sets when the connection may try again, doubling the wait for every failure in a row up to
+ * IRC_RETRY_MAX_MILLI, and picking somewhere in the top half of it at random
+ */
+static void ircBackoff (irc_connection *connection)
+{
+	uint32_t delay;
+
+	if (connection->failures < 16)
+	{
+		connection->failures++;
+	}
+	delay = std::min ((uint32_t)IRC_RETRY_MAX_MILLI, (uint32_t)IRC_RETRY_MILLI << std::min (connection->failures - 1, 10));
+	delay = (delay / 2) + (irc_random () % ((delay / 2) + 1));
+
+	connection->retry = hrc_now + std::chrono::milliseconds(delay);
+	logger->logf (" %s: I'll try connecting to the %s again in %u ms.\n", connection->name, connection->description, delay);
+}
+
+
+/**
+ * Returns true if the connection has sockets that are still connecting
+ */
+static bool ircConnecting (irc_connection *connection)
+{
+	uint8_t slot;
+
+	for (slot = 0; slot < IRC_MAX_ATTEMPTS; slot++)
+	{
+		if (connection->attempts[slot] >= 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Wakes the reactor, used by the resolver when a lookup has finished, and by main once it has made room
+ * in a full receive queue
+ */
+static void ircWake (void)
+{
+	uint64_t wakeup = 1;
+
+	if (write (irc_wakeup, &wakeup, sizeof (wakeup)) < 0)
+	{
+		logger->logf (" IRCThread: I was unable to wake my reactor, reason: %s.\n", strerror(errno));
+	}
+}
+
+
+/**
+ * Wakes main if it's waiting and there are lines in the receive queues for it
+ */
+static void ircWakeMain (void)
+{
+	if ((irc_recv_buffer.size () == 0) && (girc_recv_buffer.size () == 0))
+	{
+		return;
+	}
+
+	// Pairs with the fence in waitIRCLines, either main sees the lines or we see it waiting
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+	if (irc_main_waiting.exchange (false))
+	{
+		wakeMain ();
+	}
+}
+
+
+/**
+ * Sends the login details and joins the rooms for the connection
+ */
+static void ircAuth (irc_connection *connection)
+{
+	ircSend (connection, "PASS", bot_oauth.c_str());
+	ircSend (connection, "NICK", bot_user.c_str());
+	if (connection != &irc_connections[IRC_GROUPS])
+	{
+		// The rooms are joined once we're running, so the join limit can pace them
+		ircSend (connection, "CAP REQ", ":twitch.tv/commands");
+		ircSend (connection, "CAP REQ", ":twitch.tv/membership");
+		ircSend (connection, "CAP REQ", ":twitch.tv/tags");
+		connection->joined = 0;
+	}
+	else
+	{
+		ircSend (connection, "JOIN", "#jtv");
+		ircSend (connection, "CAP REQ", ":twitch.tv/commands");
+	}
+	ircWritePending (connection);
+
+	// The first probe goes out once the connection has had a probe interval to settle
+	connection->probing = false;
+	connection->missed = 0;
+	connection->probe_sent = hrc_now;
+	connection->caps = 0;
+
+	logger->logf (" %s: I've successfully authorised myself on the %s.\n", connection->name, connection->description);
+	connection->task = IRC_RUNNING;
+	if (ircRingDriven (connection))
+	{
+		ircUpdateEvents (connection);
+	}
+}
+
+
+/**
+ * Sends a PING probe every probe interval, and drops the connection if too many go unanswered in a
+ * row, so a half open connection is noticed in seconds rather than when twitch next talks to us
+ */
+static void ircProbe (irc_connection *connection)
+{
+	char token[32];
+
+	if ((hrc_now - connection->probe_sent) < std::chrono::seconds(irc_probe_interval))
+	{
+		return;
+	}
+
+	if (connection->probing)
+	{
+		connection->missed++;
+		if (connection->missed >= irc_probe_misses)
+		{
+			logger->logf (" %s: Master, the %s hasn't answered my last %d pings, I'm dropping the connection incase the socket is dead.\n", connection->name, connection->description, connection->missed);
+
+			// Closed like any other failure, so a standby that's ready takes over instead
+			connection->task = IRC_CLOSE;
+			return;
+		}
+		logger->debugf (DEBUG_MINIMAL, " %s: The %s hasn't answered my ping, that's %d in a row.\n", connection->name, connection->description, connection->missed);
+	}
+
+	connection->probe++;
+	snprintf (token, sizeof (token), ":" IRC_PROBE_TOKEN "%u", connection->probe);
+	ircSend (connection, "PING", token);
+	ircWritePending (connection);
+	connection->probing = true;
+	connection->probe_sent = hrc_now;
+}
+
+
+/**
+ * Checks if a received line is the answer to our last probe, if it is the round trip time is added
+ * to the smoothed average, returns true if the line was one of our probes and needs no more handling
+ */
+static bool ircProbeAnswered (irc_connection *connection, const irc_message_view *message)
+{
+	char token[32];
+
+	if ((message->command != "PONG") || (ircTrailing (message).compare (0, strlen (IRC_PROBE_TOKEN), IRC_PROBE_TOKEN) != 0))
+	{
+		return false;
+	}
+
+	snprintf (token, sizeof (token), IRC_PROBE_TOKEN "%u", connection->probe);
+	if ((connection->probing) && (ircTrailing (message) == token))
+	{
+		double sample = std::chrono::duration<double, std::milli>(hrc_now - connection->probe_sent).count ();
+		double rtt = connection->rtt.load (std::memory_order_relaxed);
+
+		// Smoothed the same way TCP does, each sample moves the average an eighth of the way
+		rtt = (rtt == 0) ? sample : ((rtt * 7) + sample) / 8;
+		connection->rtt.store (rtt, std::memory_order_relaxed);
+		connection->probing = false;
+		connection->missed = 0;
+		logger->debugf (DEBUG_STANDARD, " %s: The %s answered my ping in %.2f ms, averaging %.2f ms.\n", connection->name, connection->description, sample, rtt);
+	}
+
+	return true;
+}
+
+
+/**
+ * Handles the messages that keep the connection itself alive straight away on the reactor, so they
+ * never wait behind chat in the receive queue, returns true if the line needs no more handling
+ */
+static bool ircControl (irc_connection *connection, const irc_message_view *message)
+{
+	// The server checking we're still here
+	if (message->command == "PING")
+	{
+		logger->debugf (DEBUG_STANDARD, " %s: Playing ping pong with the %s.\n", connection->name, connection->description);
+		std::string pong = ":";
+		pong.append (ircTrailing (message));
+		ircSend (connection, "PONG", pong);
+		ircWritePending (connection);
+		return true;
+	}
+
+	// The server is going down for maintenance, move to another one before it drops us
+	if (message->command == "RECONNECT")
+	{
+		logger->logf (" %s: The %s asked me to reconnect, so I'm reconnecting.\n", connection->name, connection->description);
+		connection->task = IRC_CLOSE;
+		return true;
+	}
+
+	// The server answering our CAP REQs		// :tmi.twitch.tv CAP * ACK :twitch.tv/membership
+	if ((message->command == "CAP") && (message->param_count >= 3))
+	{
+		std::string_view capability = ircTrailing (message);
+		uint8_t cap = 0;
+		if (capability == "twitch.tv/commands")
+		{
+			cap = IRC_CAP_COMMANDS;
+		}
+		else if (capability == "twitch.tv/membership")
+		{
+			cap = IRC_CAP_MEMBERSHIP;
+		}
+		else if (capability == "twitch.tv/tags")
+		{
+			cap = IRC_CAP_TAGS;
+		}
+
+		if (message->params[1] == "ACK")
+		{
+			connection->caps |= cap;
+			logger->debugf (DEBUG_MINIMAL, " %s: The %s acknowledged %.*s.\n", connection->name, connection->description, (int)capability.size (), capability.data ());
+		}
+		else
+		{
+			logger->logf (" %s: The %s refused %.*s.\n", connection->name, connection->description, (int)capability.size (), capability.data ());
+		}
+		return true;
+	}
+
+	return false;
+}
+
+
+/**
+ * Joins the rooms assigned to the connection that haven't been joined yet, as fast as twitch's join
+ * limit allows, the limit is shared by every connection
+ */
+static void ircJoinRooms (irc_connection *connection)
+{
+	std::chrono::high_resolution_clock::time_point now = hrc_now;
+
+	while (connection->joined < connection->rooms.size ())
+	{
+		// Forget any JOINs that have left the window
+		while ((!irc_joins.empty ()) && ((now - irc_joins.front ()) >= std::chrono::seconds(IRC_JOIN_WINDOW)))
+		{
+			irc_joins.pop_front ();
+		}
+		if (irc_joins.size () >= IRC_JOIN_LIMIT)
+		{
+			break;
+		}
+
+		const std::string &room = irc_rooms[connection->rooms[connection->joined++]];
+		ircSend (connection, "JOIN", room);
+		irc_joins.push_back (now);
+		logger->logf (" %s: I'm joining %s.\n", connection->name, room.c_str());
+	}
+	ircWritePending (connection);
+}
+
+
+/**
+ * Reads whatever is waiting on a readable socket and queues the complete lines, any partial line is
+ * kept in the line buffer until the rest of it arrives
+ */
+static void ircRead (irc_connection *connection)
+{
+	ssize_t read_return;
+
+	read_return = (connection->ssl != NULL) ? connection->lines.readFrom (connection->ssl) : connection->lines.readFrom (connection->sock);
+	if (read_return > 0)
+	{
+		ircTakeLines (connection);
+
+		// OpenSSL may already hold more than one record, and epoll won't tell us about those
+		if ((connection->ssl != NULL) && (!connection->paused) && (connection->task == IRC_RUNNING) && (SSL_pending (connection->ssl) > 0))
+		{
+			ircRead (connection);
+		}
+	}
+	else if (read_return == 0)
+	{
+		// The server closed the connection, otherwise epoll would keep waking us for it
+		logger->logf (" %s: The %s closed the connection, so I'm reconnecting.\n", connection->name, connection->description);
+		connection->task = IRC_CLOSE;
+	}
+	else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+	{
+		// Failed to read the message
+		logger->logf (" %s: I had a problem reading the %s socket, so I'm reconnecting, reason: %s.\n", connection->name, connection->description, strerror(errno));
+		connection->task = IRC_CLOSE;
+	}
+}
+
+
+/**
+ * Handles every complete line in the line buffer, and hands them over to the receive queue
+ */
+static void ircTakeLines (irc_connection *connection)
+{
+	std::string_view message;
+
+	while (connection->lines.nextLine (&message))
+	{
+		ircTakeLine (connection, message);
+	}
+	if (!connection->overflow.empty ())
+	{
+		ircQueue (connection);
+	}
+}
+
+
+/**
+ * Handles a received line, control lines are answered here and anything else is tagged with the
+ * connection and room it came from and queued for main
+ */
+static void ircTakeLine (irc_connection *connection, std::string_view message)
+{
+	irc_message_view parsed;
+
+	// TODO: Disable this debug message
+	logger->debugf (DEBUG_DETAILED, " %s: I received: %.*s\r\n", connection->name, (int)message.size(), message.data());
+	connection->timeout = hrc_now;
+
+	// Tag the line with where it came from
+	irc_line line;
+	line.line = message;
+	line.connection = connection - irc_connections;
+	line.room = -1;
+	if (!parseIRCMessage (message, &parsed))
+	{
+		parsed.param_count = 0;
+	}
+	else if ((ircProbeAnswered (connection, &parsed)) || (ircControl (connection, &parsed)))
+	{
+		return;
+	}
+	if (parsed.param_count > 0)
+	{
+		std::unordered_map<std::string_view, uint16_t>::iterator room = irc_room_ids.find (parsed.params[0]);
+		if (room != irc_room_ids.end ())
+		{
+			line.room = room->second;
+		}
+	}
+
+	// Keep track of the room's modes and our badges so the outbound path can follow them, main still gets the lines
+	if ((line.room >= 0) && ((parsed.command == "ROOMSTATE") || (parsed.command == "USERSTATE") || (parsed.command == "NOTICE")))
+	{
+		ircRoomState (connection, &parsed, line.room);
+	}
+
+	// Chat is seen by both a connection and its standby, so it's what we use to find the gap on failover
+	if ((line.room >= 0) && ((connection->passive) || (connection->standby != NULL)) &&
+		((parsed.command == "PRIVMSG") || (parsed.command == "USERNOTICE") || (parsed.command == "CLEARCHAT") || (parsed.command == "CLEARMSG")))
+	{
+		if (connection->passive)
+		{
+			connection->backlog.push_back (std::move (line));
+			if (connection->backlog.size () > IRC_STANDBY_BACKLOG)
+			{
+				connection->backlog.pop_front ();
+			}
+			return;
+		}
+
+		size_t hash = std::hash<std::string_view>() (message);
+		if (!connection->duplicates.empty ())
+		{
+			if (hrc_now >= connection->dedup_until)
+			{
+				connection->duplicates.clear ();
+			}
+			else if (connection->duplicates.erase (hash) > 0)
+			{
+				return;
+			}
+		}
+		connection->delivered[connection->delivered_next++ % IRC_STANDBY_BACKLOG] = hash;
+	}
+	if (connection->passive)
+	{
+		return;
+	}
+
+	// Once anything is held back, everything after it has to queue behind it to keep the order
+	if ((!connection->overflow.empty ()) || (!connection->recv_buffer->push (std::move (line))))
+	{
+		connection->overflow.push_back (std::move (line));
+	}
+}
+
+
+/**
+ * Updates a room's state from a ROOMSTATE or USERSTATE, ROOMSTATE only carries the modes that changed
+ * after the first one. NOTICEs refusing our messages tell us about modes we couldn't see, like not following.
+ */
+static void ircRoomState (irc_connection *connection, const irc_message_view *message, int32_t room)
+{
+	irc_room_state *state = &irc_room_states[room];
+	std::string_view value;
+
+	if (message->command == "ROOMSTATE")		// @emote-only=0;followers-only=-1;r9k=0;room-id=1234;slow=0;subs-only=0 :tmi.twitch.tv ROOMSTATE #room
+	{
+		if (!(value = ircTag (message, "emote-only")).empty ())
+		{
+			state->emote_only = (value == "1");
+		}
+		if (!(value = ircTag (message, "subs-only")).empty ())
+		{
+			state->subs_only = (value == "1");
+		}
+		if (!(value = ircTag (message, "r9k")).empty ())
+		{
+			state->r9k = (value == "1");
+		}
+		if (!(value = ircTag (message, "followers-only")).empty ())
+		{
+			state->followers_only = atoi (std::string (value).c_str ());
+			state->unfollowed = false;
+		}
+		if (!(value = ircTag (message, "slow")).empty ())
+		{
+			state->slow = atoi (std::string (value).c_str ());
+		}
+	}
+	else if (message->command == "USERSTATE")	// @badges=moderator/1,subscriber/12;mod=1;subscriber=1;... :tmi.twitch.tv USERSTATE #room
+	{
+		std::string badges = ",";
+		badges.append (ircTag (message, "badges"));
+		bool moderator = (ircTag (message, "mod") == "1") || (badges.find (",broadcaster/") != std::string::npos);
+
+		if (moderator != state->moderator)
+		{
+			logger->logf (" %s: I'm %sa moderator in %s, so I can send %d messages every %d seconds there.\n", connection->name,
+				moderator ? "" : "not ", irc_rooms[room].c_str (), moderator ? IRC_RATE_MODERATOR : IRC_RATE_USER, IRC_RATE_WINDOW);
+		}
+		state->moderator = moderator;
+		state->vip = (badges.find (",vip/") != std::string::npos);
+		state->subscriber = (ircTag (message, "subscriber") == "1") || (badges.find (",subscriber/") != std::string::npos);
+	}
+	else										// @msg-id=msg_subsonly :tmi.twitch.tv NOTICE #room :This room is in subscribers-only mode...
+	{
+		value = ircTag (message, "msg-id");
+		if (value == "msg_emoteonly")
+		{
+			state->emote_only = true;
+		}
+		else if (value == "msg_subsonly")
+		{
+			state->subs_only = true;
+		}
+		else if (value.compare (0, 17, "msg_followersonly") == 0)
+		{
+			state->followers_only = std::max (state->followers_only, (int16_t)0);
+			state->unfollowed = true;
+		}
+	}
+}
+
+
+/**
+ * Finds the state of the room a PRIVMSG line is for, or NULL if it isn't for one of our rooms
+ */
+static irc_room_state *ircLineRoom (const std::string &line)
+{
+	std::string_view view (line);
+	size_t end = view.find (' ', 8);
+
+	if (end == std::string_view::npos)
+	{
+		return NULL;
+	}
+	std::unordered_map<std::string_view, uint16_t>::iterator room = irc_room_ids.find (view.substr (8, end - 8));
+	if (room == irc_room_ids.end ())
+	{
+		return NULL;
+	}
+
+	return &irc_room_states[room->second];
+}
+
+
+/**
+ * Works out if twitch would refuse any message we sent to a room, returns the reason or NULL if it wouldn't
+ */
+static const char *ircRefused (const irc_room_state *state)
+{
+	if (state->moderator)
+	{
+		return NULL;
+	}
+	if (state->emote_only)
+	{
+		return "in emote-only mode";
+	}
+	if (state->vip)
+	{
+		return NULL;
+	}
+	if ((state->subs_only) && (!state->subscriber))
+	{
+		return "in subscribers-only mode";
+	}
+	if ((state->followers_only >= 0) && (state->unfollowed))
+	{
+		return "in followers-only mode";
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Swaps a chat connection that has failed for its standby, the standby's socket is already logged in
+ * and joined so chat carries on straight away. Chat the standby saw after the last line the connection
+ * queued is replayed, lines still waiting to be sent go out on the new socket, and a new standby is
+ * started in the background.
+ */
+static void ircPromote (irc_connection *connection)
+{
+	irc_connection *standby = connection->standby;
+	std::unordered_set<size_t> delivered;
+	size_t replayed = 0;
+
+	// Neither socket may have anything on the ring while they change hands
+	ircRingDetach (connection);
+	ircRingDetach (standby);
+
+	// The old socket is gone or going, there's no one to say goodbye to
+	if (connection->sock >= 0)
+	{
+		tlsClose (connection->ssl, false);
+		epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->sock, NULL);
+		close (connection->sock);
+	}
+
+	// Take over the standby's socket and everything we know about it
+	connection->sock = standby->sock;
+	connection->ssl = standby->ssl;
+	connection->lines.swap (standby->lines);
+	connection->caps = standby->caps;
+	connection->joined = standby->joined;
+	connection->connected = standby->connected;
+	connection->timeout = standby->timeout;
+	connection->probe = standby->probe;
+	connection->probing = standby->probing;
+	connection->missed = standby->missed;
+	connection->probe_sent = standby->probe_sent;
+	connection->rtt.store (standby->rtt.load (std::memory_order_relaxed), std::memory_order_relaxed);
+	connection->task = IRC_RUNNING;
+	connection->failures = 0;
+
+	// Anything part way out has to be sent again in full on the new socket
+	connection->outbound_offset = 0;
+	connection->writable = true;
+	ircUpdateEvents (connection);
+	ircWritePending (connection);
+
+	// Find the newest line both connections saw, the standby's lines after that were missed
+	for (size_t hash : connection->delivered)
+	{
+		if (hash != 0)
+		{
+			delivered.insert (hash);
+		}
+	}
+	std::deque<irc_line>::iterator first = standby->backlog.begin ();
+	for (std::deque<irc_line>::iterator line = standby->backlog.end (); line != standby->backlog.begin ();)
+	{
+		line--;
+		if (delivered.count (std::hash<std::string_view>() (line->line)) > 0)
+		{
+			first = line + 1;
+			break;
+		}
+	}
+	for (std::deque<irc_line>::iterator line = first; line != standby->backlog.end (); line++)
+	{
+		line->connection = connection - irc_connections;
+		connection->overflow.push_back (std::move (*line));
+		replayed++;
+	}
+	if (!connection->overflow.empty ())
+	{
+		ircQueue (connection);
+	}
+
+	// Lines the old connection had that haven't reached the standby yet will still arrive, skip them
+	for (std::deque<irc_line>::iterator line = standby->backlog.begin (); line != first; line++)
+	{
+		delivered.erase (std::hash<std::string_view>() (line->line));
+	}
+	connection->duplicates.swap (delivered);
+	connection->dedup_until = hrc_now + std::chrono::milliseconds(IRC_STANDBY_DEDUP_MILLI);
+
+	// The standby starts over as a new connection
+	standby->sock = -1;
+	standby->ssl = NULL;
+	standby->lines.clear ();
+	standby->backlog.clear ();
+	standby->outbound.clear ();
+	standby->outbound_offset = 0;
+	standby->writable = true;
+	standby->task = IRC_CONNECT;
+	standby->retry = hrc_now;
+	standby->failures = 0;
+
+	logger->logf (" %s: I've switched to my standby connection to the %s and replayed %zu lines it saw that I missed.\n", connection->name, connection->description, replayed);
+}
+
+
+/**
+ * Moves the received lines in to the receive queue, if the queue fills up the rest are held back, and
+ * if too many are held back reading is paused until main catches up, so nothing is dropped. Until then
+ * we keep reading, so control messages behind a burst of chat are still handled straight away.
+ */
+static void ircQueue (irc_connection *connection)
+{
+	bool was_paused = connection->paused;
+
+	while (!connection->overflow.empty ())
+	{
+		if (!connection->recv_buffer->push (std::move (connection->overflow.front ())))
+		{
+			break;
+		}
+		connection->overflow.pop_front ();
+	}
+
+	connection->paused = (connection->overflow.size () >= IRC_OVERFLOW_LIMIT);
+	if (connection->paused != was_paused)
+	{
+		ircUpdateEvents (connection);
+
+		if (connection->paused)
+		{
+			logger->debugf (DEBUG_MINIMAL, " %s: My receive queue is full with %zu lines, I'm pausing reads until they're handled.\n", connection->name, connection->recv_buffer->size ());
+		}
+		else if ((connection->ssl != NULL) && (SSL_pending (connection->ssl) > 0))
+		{
+			// Anything OpenSSL read ahead while we were paused won't wake epoll
+			ircRead (connection);
+		}
+	}
+}
+
+
+/**
+ * Leaves the server, removes the socket from the reactor and closes it
+ */
+static void ircClose (irc_connection *connection)
+{
+	ircRingDetach (connection);
+	if (connection->sock >= 0)
+	{
+		ircSend (connection, "PART", "Bye Bye ^^");
+		ircSend (connection, "QUIT", "SkidBot");
+		ircWritePending (connection);
+		tlsClose (connection->ssl, false);
+		connection->ssl = NULL;
+		epoll_ctl (irc_epoll, EPOLL_CTL_DEL, connection->sock, NULL);
+		close (connection->sock);
+		connection->sock = -1;
+	}
+	connection->lines.clear ();
+	connection->overflow.clear ();
+	connection->paused = false;
+	connection->outbound.clear ();
+	connection->outbound_offset = 0;
+	connection->writable = true;
+
+	// A connection that dropped soon after connecting counts as a failure, so a server that keeps
+	// kicking us doesn't get hammered
+	connection->task = IRC_CONNECT;
+	if ((hrc_now - connection->connected) < std::chrono::seconds(IRC_STABLE_SECONDS))
+	{
+		ircBackoff (connection);
+	}
+	else
+	{
+		connection->failures = 0;
+		connection->retry = hrc_now;
+	}
+}
+
+
+/**
+ * Tops up the token bucket, and moves whatever the rate limit allows from the lanes in priority order
+ * on to the outbound buffer, anything that isn't a PRIVMSG is moved straight away. Only called from
+ * the reactor.
+ */
+static void ircFlush (irc_connection *connection)
+{
+	std::chrono::high_resolution_clock::time_point now = hrc_now;
+	bool moved = false;
+	uint8_t lane;
+
+	lock (connection->send_mutex);
+	lock (irc_rate_mutex);
+
+	// The bucket holds half the limit and refills the other half across the window, so even a full
+	// burst followed by a steady stream can never pass the limit in any one window
+	double burst = IRC_RATE_MODERATOR / 2.0;
+	double elapsed = std::chrono::duration<double>(now - irc_refilled).count ();
+	irc_tokens = std::min (burst, irc_tokens + ((elapsed * burst) / IRC_RATE_WINDOW));
+	irc_refilled = now;
+
+	while (!connection->lanes[IRC_PRIORITY_CONTROL].empty ())
+	{
+		connection->outbound.push_back (std::move (connection->lanes[IRC_PRIORITY_CONTROL].front ()));
+		connection->lanes[IRC_PRIORITY_CONTROL].pop_front ();
+		moved = true;
+	}
+
+	// Lines twitch would refuse are dropped, and lines for a room in slow mode are held while the lines behind
+	// them for other rooms go ahead. Rooms we moderate cost a token, others cost their share of the user limit.
+	connection->blocked_cost = 0;
+	connection->holding = false;
+	for (lane = IRC_PRIORITY_HIGH; (lane <= IRC_PRIORITY_LOW) && (connection->blocked_cost == 0); lane++)
+	{
+		std::deque<std::string>::iterator line = connection->lanes[lane].begin ();
+		while (line != connection->lanes[lane].end ())
+		{
+			irc_room_state *state = ircLineRoom (*line);
+			uint8_t cost = IRC_RATE_MODERATOR / IRC_RATE_USER;
+			if (state != NULL)
+			{
+				const char *refused = ircRefused (state);
+				if (refused != NULL)
+				{
+					logger->logf (" %s: The room is %s, so I've dropped: %s", connection->name, refused, line->c_str());
+					line = connection->lanes[lane].erase (line);
+					continue;
+				}
+
+				// Replies being packed wait for the window, moderation never does
+				std::chrono::high_resolution_clock::time_point release = (lane != IRC_PRIORITY_HIGH) ? state->pack_until : std::chrono::high_resolution_clock::time_point ();
+				if ((!state->moderator) && (!state->vip) && (state->slow > 0))
+				{
+					release = std::max (release, state->last_sent + std::chrono::seconds(state->slow));
+				}
+				if (now < release)
+				{
+					connection->held_until = connection->holding ? std::min (connection->held_until, release) : release;
+					connection->holding = true;
+					line++;
+					continue;
+				}
+				cost = state->moderator ? 1 : cost;
+			}
+
+			if (irc_tokens < cost)
+			{
+				connection->blocked_cost = cost;
+				break;
+			}
+			connection->outbound.push_back (std::move (*line));
+			line = connection->lanes[lane].erase (line);
+			irc_tokens -= cost;
+			moved = true;
+			if (state != NULL)
+			{
+				state->last_sent = now;
+			}
+		}
+	}
+
+	release (irc_rate_mutex);
+	release (connection->send_mutex);
+
+	if (moved)
+	{
+		ircWritePending (connection);
+	}
+}
+
+
+/**
+ * Writes as much of the outbound buffer as the socket will take, gathering the lines in to one
+ * writev, if the socket fills up the rest waits for EPOLLOUT. Only called from the reactor.
+ */
+static void ircWritePending (irc_connection *connection)
+{
+	struct iovec iov[IRC_MAX_IOV];
+	ssize_t write_return;
+	size_t count;
+
+	if (ircRingDriven (connection))
+	{
+		ircRingWrite (connection);
+		return;
+	}
+
+	while (!connection->outbound.empty ())
+	{
+		// Gather the waiting lines, skipping whatever was already sent of the first one
+		count = 0;
+		for (std::deque<std::string>::iterator line = connection->outbound.begin (); (line != connection->outbound.end ()) && (count < IRC_MAX_IOV); line++, count++)
+		{
+			iov[count].iov_base = (void *)line->data ();
+			iov[count].iov_len = line->size ();
+		}
+		iov[0].iov_base = (char *)iov[0].iov_base + connection->outbound_offset;
+		iov[0].iov_len -= connection->outbound_offset;
+
+		if (connection->ssl != NULL)
+		{
+			// Copy the lines in to one record, a retry has to offer at least what was offered before,
+			// which it will as lines are only ever added to the end
+			connection->gathered.clear ();
+			for (size_t t = 0; (t < count) && (connection->gathered.size () < TLS_RECORD_SIZE); t++)
+			{
+				connection->gathered.append ((const char *)iov[t].iov_base, std::min (iov[t].iov_len, TLS_RECORD_SIZE - connection->gathered.size ()));
+			}
+			write_return = tlsWrite (connection->ssl, connection->gathered.data (), connection->gathered.size ());
+		}
+		else
+		{
+			write_return = writev (connection->sock, iov, count);
+		}
+		if (write_return < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				break;
+			}
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			logger->logf (" %s: I was unable to send %zu lines to the %s, so I'm reconnecting, reason: %s.\n", connection->name, connection->outbound.size (), connection->description, strerror(errno));
+			connection->task = IRC_CLOSE;
+			return;
+		}
+
+		ircWritten (connection, write_return);
+	}
+
+	// Only ask epoll about writability while there's something waiting
+	if (connection->writable == connection->outbound.empty ())
+	{
+		return;
+	}
+	connection->writable = connection->outbound.empty ();
+	ircUpdateEvents (connection);
+}
+
+
+/**
+ * Drops the lines that have been written, and remembers how far we got through a partial one
+ */
+static void ircWritten (irc_connection *connection, size_t written)
+{
+	written += connection->outbound_offset;
+	while ((!connection->outbound.empty ()) && (written >= connection->outbound.front ().size ()))
+	{
+		written -= connection->outbound.front ().size ();
+		connection->outbound.pop_front ();
+	}
+	connection->outbound_offset = written;
+}
+
+
+/**
+ * Tells epoll which events we want for a connection, reads unless the receive queue is full, and
+ * writes while the outbound buffer has lines the socket wouldn't take
+ */
+static void ircUpdateEvents (irc_connection *connection)
+{
+	struct epoll_event event;
+
+	memset (&event, 0, sizeof (event));
+	event.events = connection->paused ? 0 : (EPOLLIN | EPOLLRDHUP);
+	if (!connection->writable)
+	{
+		event.events |= EPOLLOUT;
+	}
+	if (ircRingDriven (connection))
+	{
+		// The ring reads and writes for us, epoll still tells us if the socket fails
+		event.events = 0;
+	}
+	event.data.u32 = connection - irc_connections;
+	epoll_ctl (irc_epoll, EPOLL_CTL_MOD, connection->sock, &event);
+}
 
-std::deque<std::string> girc_recv_buffer (20);
 
-// Holds the Twitch username and OAuth of the bot user account, and the room to connect to by default
-std::string bot_user = "bot_username";
-std::string bot_oauth = "oauth:bot_oauth";
-std::string default_room = "#target_room";
+/**
+ * Returns true if the ring reads and writes the connection's socket, it does for plain sockets once
+ * we're authorising, TLS has to go through OpenSSL so those stay on epoll
+ */
+static bool ircRingDriven (irc_connection *connection)
+{
+	return ((irc_ring.ready ()) && (connection->ssl == NULL) && (connection->sock >= 0) && ((connection->task == IRC_AUTH) || (connection->task == IRC_RUNNING)));
+}
 
-extern Logger *logger;
+
+/**
+ * Builds the user data for a ring operation on a connection
+ */
+static uint64_t ircRingTag (uint8_t operation, irc_connection *connection)
+{
+	return ((uint64_t)operation << 8) | (uint64_t)(connection - irc_connections);
+}
 
 
 /**
- * IRCThread, handles connecting to twitch irc and parsing incoming messages.
+ * Keeps a read in flight for every running connection the ring drives, along with a read of the wakeup
+ * and a poll of epoll, then submits them and sleeps until something completes or the timeout, all in
+ * one system call
  */
-void *IRCThread (void *)
+static void ircRingWait (int timeout)
 {
-	char irc_recv[MAXDATAREAD];
-	uint32_t available;
+	uint8_t t;
 
-	lock (irc_mutex);
-	while (irc_running)
+	for (t = 0; t < irc_connection_count; t++)
 	{
-		release (irc_mutex);
-		switch (irc_task)
+		irc_connection *connection = &irc_connections[t];
+		if ((connection->task == IRC_RUNNING) && (ircRingDriven (connection)) && (!connection->paused) && (!connection->ring_reading))
+		{
+			connection->ring_reading = irc_ring.read (connection->sock, (unsigned)(t * 2), IRC_RING_BUFFER, ircRingTag (IRC_RING_READ, connection));
+		}
+	}
+	if (!irc_ring_waking)
+	{
+		irc_ring_waking = irc_ring.readInto (irc_wakeup, &irc_ring_wakeups, sizeof (irc_ring_wakeups), (uint64_t)IRC_RING_WAKEUP << 8);
+	}
+	if (!irc_ring_polling)
+	{
+		irc_ring_polling = irc_ring.poll (irc_epoll, POLLIN, (uint64_t)IRC_RING_EPOLL << 8);
+	}
+
+	if (irc_ring.submit (1, timeout) < 0)
+	{
+		logger->logf (" IRCThread: I had a problem waiting on my ring, reason: %s.\n", strerror(errno));
+	}
+	ircRingComplete ();
+}
+
+
+/**
+ * Handles every completion waiting on the ring
+ */
+static void ircRingComplete (void)
+{
+	struct epoll_event events[IRC_MAX_EVENTS];
+	uint64_t user_data;
+	int32_t result;
+
+	while (irc_ring.nextCompletion (&user_data, &result))
+	{
+		irc_connection *connection = &irc_connections[user_data & 0xFF];
+		switch (user_data >> 8)
 		{
-			case (IRC_CONNECT):
+			case (IRC_RING_READ):
 			{
-				irc_recv_buffer.empty ();
-				irc_sock = socket(AF_INET, SOCK_STREAM, 0);
-				irc_server = gethostbyname("irc.twitch.tv");
-				if ((irc_sock >= 0) && (irc_server != NULL))
-				{
-					// Sets up the server address
-					bzero((char *) &irc_serv_addr, sizeof(irc_serv_addr));
-					irc_serv_addr.sin_family = AF_INET;
-					bcopy((char *)irc_server->h_addr, (char *)&irc_serv_addr.sin_addr.s_addr, irc_server->h_length);
-					irc_serv_addr.sin_port = htons(irc_port);
-
-					irc_return = connect (irc_sock, (struct sockaddr *) &irc_serv_addr, sizeof (irc_serv_addr));
-					if (irc_return >= 0)
-					{
-						irc_task = IRC_AUTH;
-						irc_timeout = hrc_now;
-						logger->log (" IRCThread: I've connected to the IRC server.\n");
-						break;
-					}
-					else
-					{
-						logger->logf (" IRCThread: I was unable to get the server host, reason: %s.\n", strerror(errno));
-					}
-				}
-				else
-				{
-					logger->logf (" IRCThread: I was unable to open a socket, or find the server, reason: %s.\n", strerror(errno));
-				}
+				ircRingRead (connection, result);
 			}
 			break;
 
-			case (IRC_AUTH):
+			case (IRC_RING_READABLE):
 			{
-				irc_return = send_command ("PASS", bot_oauth.c_str());
-				irc_return = send_command ("NICK", bot_user.c_str());
-				irc_return = send_command ("CAP REQ", ":twitch.tv/commands");
-				irc_return = send_command ("CAP REQ", ":twitch.tv/membership");
-				irc_return = send_command ("JOIN", default_room.c_str());
+				// The socket has data, so the read goes again when we next wait
+				connection->ring_reading = false;
+			}
+			break;
 
-				logger->log (" IRCThread: I've successfully authorised myself on the server.\n");
-				irc_task = IRC_RUNNING;
+			case (IRC_RING_WRITE):
+			{
+				ircRingWritten (connection, result);
 			}
 			break;
 
-			case (IRC_RUNNING):
+			case (IRC_RING_WRITABLE):
 			{
-				irc_return = ioctl(irc_sock, FIONREAD, &available);
-				if (available > 0)
+				// The socket has room again, so the same bytes go again
+				if ((result < 0) || (connection == irc_ring_detaching) || (!irc_ring.write (connection->sock, ((connection - irc_connections) * 2) + 1, connection->ring_sending, ircRingTag (IRC_RING_WRITE, connection))))
 				{
-					memset (irc_recv, 0, MAXDATAREAD);
-					irc_return = read(irc_sock, irc_recv, MAXDATAREAD);
-					if (irc_return > 0)
-					{
-						std::string received (irc_recv);
-						std::string message;
-						size_t last_found = 0;
-						size_t found = 0;
-
-						found = received.find ("\r\n");
-						while (found != std::string::npos)
-						{
-							message = received.substr(last_found, found-last_found);
-							irc_recv_buffer.push_back(message);
-							// TODO: Disable this debug message
-							logger->debugf (DEBUG_DETAILED, " IRCThread: I received: %s\r\n", message.c_str());
-							last_found = found+2;
-							found = received.find ("\r\n", last_found);
-							irc_timeout = hrc_now;
-						}
-					}
-					else if ((irc_return != -EAGAIN) && (irc_return != -EWOULDBLOCK) && (irc_return != -1) && (irc_return != 0))
-					{
-						// Failed to read the message
-						logger->logf (" IRCThread: I had a problem reading the IRC socket, so I'm reconnecting, reason: %s.\n", strerror(errno));
-						irc_task = IRC_CLOSE;
-					}
+					connection->ring_sending = 0;
 				}
+			}
+			break;
 
-				// Check if we have lost comms, no messages after 10 minutes (ping should be every 5)
-				if ((hrc_now - irc_timeout) > std::chrono::minutes(10))
-				{
-					logger->log (" IRCThread: Master, the IRC socket has been quiet for 10 minutes, I'm going to reconnect incase the socket is dread.\n");
-					irc_task = IRC_CLOSE;
-				}
+			case (IRC_RING_LOG):
+			{
+				logger->ringWritten (result);
 			}
 			break;
 
-			case (IRC_CLOSE):
+			case (IRC_RING_WAKEUP):
 			{
-				send_command ("PART", "Bye Bye ^^");
-				send_command ("QUIT", "SkidBot");
-				close (irc_sock);
-				irc_sock = -1;
+				irc_ring_waking = false;
+			}
+			break;
 
-				irc_task = IRC_CONNECT;
+			case (IRC_RING_EPOLL):
+			{
+				irc_ring_polling = false;
+				ircHandleEvents (events, epoll_wait (irc_epoll, events, IRC_MAX_EVENTS, 0));
 			}
 			break;
 		}
-
-		usleep (100000);
-		lock (irc_mutex);
 	}
-	release (irc_mutex);
+}
 
-	send_command ("PART", "Bye Bye ^^");
-	send_command ("QUIT", "SkidBot");
-	close (irc_sock);
 
-	irc_recv_buffer.clear ();
+/**
+ * Handles a read the ring finished for a connection, the lines are handled just like ircRead would
+ */
+static void ircRingRead (irc_connection *connection, int32_t result)
+{
+	connection->ring_reading = false;
 
-	logger->log (" IRCThread: I've stopped the IRC thread.\n");
+	// Anything read after the connection started closing, or that was cancelled, is of no use to us
+	if ((connection->task != IRC_RUNNING) || (result == -ECANCELED))
+	{
+		return;
+	}
 
-	return NULL;
+	if (result > 0)
+	{
+		if (!connection->lines.append (irc_ring.buffer ((connection - irc_connections) * 2), result))
+		{
+			logger->logf (" %s: I had a problem reading the %s socket, so I'm reconnecting, reason: %s.\n", connection->name, connection->description, strerror(EMSGSIZE));
+			connection->task = IRC_CLOSE;
+			return;
+		}
+		ircTakeLines (connection);
+	}
+	else if (result == 0)
+	{
+		logger->logf (" %s: The %s closed the connection, so I'm reconnecting.\n", connection->name, connection->description);
+		connection->task = IRC_CLOSE;
+	}
+	else if ((result == -EAGAIN) && (connection != irc_ring_detaching))
+	{
+		// Older kernels hand a non-blocking socket straight back, so wait for it to have data first
+		connection->ring_reading = irc_ring.poll (connection->sock, POLLIN, ircRingTag (IRC_RING_READABLE, connection));
+	}
+	else if ((result != -EAGAIN) && (result != -EINTR))
+	{
+		logger->logf (" %s: I had a problem reading the %s socket, so I'm reconnecting, reason: %s.\n", connection->name, connection->description, strerror(-result));
+		connection->task = IRC_CLOSE;
+	}
 }
 
 
 /**
- * Sends a irc command to the server
+ * Copies as much of the outbound buffer as fits in to the connection's send buffer and writes it through
+ * the ring, unless a write is already in flight, in which case its completion starts the next one
  */
-int send_command (std::string command, std::string data)
+static void ircRingWrite (irc_connection *connection)
 {
-	int command_return;
+	unsigned index = ((connection - irc_connections) * 2) + 1;
+	char *buffer = irc_ring.buffer (index);
+	size_t offset = connection->outbound_offset;
+	size_t length = 0;
 
-	std::string message;
+	if ((connection->ring_sending > 0) || (connection->outbound.empty ()) || (connection == irc_ring_detaching))
+	{
+		return;
+	}
 
-	message = command;
-	if (!data.empty())
+	// Skip whatever was already sent of the first line
+	for (std::deque<std::string>::iterator line = connection->outbound.begin (); (line != connection->outbound.end ()) && (length < IRC_RING_BUFFER); line++)
 	{
-		message.append (" ");
-		message.append (data);
+		size_t copy = std::min (line->size () - offset, IRC_RING_BUFFER - length);
+		memcpy (buffer + length, line->data () + offset, copy);
+		length += copy;
+		offset = 0;
 	}
-	message.append ("\r\n");
 
-	lock (irc_mutex);
-	command_return = write (irc_sock, message.c_str(), message.size());
-	release (irc_mutex);
+	// A full submission queue only has what we queued since we last waited, so submitting makes room
+	uint64_t user_data = ircRingTag (IRC_RING_WRITE, connection);
+	if ((!irc_ring.write (connection->sock, index, length, user_data)) && ((irc_ring.submit (0, 0) < 0) || (!irc_ring.write (connection->sock, index, length, user_data))))
+	{
+		logger->logf (" %s: My ring is full, so I'll send %zu lines to the %s later.\n", connection->name, connection->outbound.size (), connection->description);
+		return;
+	}
+	connection->ring_sending = length;
+}
+
+
+/**
+ * Handles a write the ring finished for a connection, and starts the next if there's more waiting
+ */
+static void ircRingWritten (irc_connection *connection, int32_t result)
+{
+	size_t sending = connection->ring_sending;
+	connection->ring_sending = 0;
 
-	if (command_return < 0)
+	if (((connection->task != IRC_AUTH) && (connection->task != IRC_RUNNING)) || (result == -ECANCELED))
 	{
-		logger->logf (" IRCThread: I was unable to send the following message to the IRC server: %s, reason: %s.\n", message.c_str(), strerror(errno));
+		return;
 	}
-	else
+
+	if (result >= 0)
+	{
+		ircWritten (connection, result);
+		ircRingWrite (connection);
+	}
+	else if ((result == -EAGAIN) && (connection != irc_ring_detaching))
+	{
+		// Older kernels hand a non-blocking socket straight back, so wait for it to have room first
+		if (irc_ring.poll (connection->sock, POLLOUT, ircRingTag (IRC_RING_WRITABLE, connection)))
+		{
+			connection->ring_sending = sending;
+		}
+	}
+	else if (result == -EINTR)
 	{
-		// TODO: Disable this debug message
-		//logger->debugf (DEBUG_MINIMAL, " IRCThread: I sent: %s", message.c_str());
+		ircRingWrite (connection);
+	}
+	else if (result != -EAGAIN)
+	{
+		logger->logf (" %s: I was unable to send %zu lines to the %s, so I'm reconnecting, reason: %s.\n", connection->name, connection->outbound.size (), connection->description, strerror(-result));
+		connection->task = IRC_CLOSE;
+	}
+}
+
+
+/**
+ * Cancels whatever the ring has in flight for a connection and waits for it to finish, so the socket can
+ * be closed or change hands, a read that finished first is still handled if the connection is running
+ */
+static void ircRingDetach (irc_connection *connection)
+{
+	if ((!irc_ring.ready ()) || ((!connection->ring_reading) && (connection->ring_sending == 0)))
+	{
+		return;
 	}
 
-	return command_return;
+	irc_ring_detaching = connection;
+	irc_ring.cancel (ircRingTag (IRC_RING_READ, connection), (uint64_t)IRC_RING_CANCEL << 8);
+	irc_ring.cancel (ircRingTag (IRC_RING_READABLE, connection), (uint64_t)IRC_RING_CANCEL << 8);
+	irc_ring.cancel (ircRingTag (IRC_RING_WRITE, connection), (uint64_t)IRC_RING_CANCEL << 8);
+	irc_ring.cancel (ircRingTag (IRC_RING_WRITABLE, connection), (uint64_t)IRC_RING_CANCEL << 8);
+	while ((connection->ring_reading) || (connection->ring_sending > 0))
+	{
+		if (irc_ring.submit (1, IRC_RING_DRAIN_MILLI) <= 0)
+		{
+			logger->logf (" %s: I gave up waiting for my ring to let go of the %s socket.\n", connection->name, connection->description);
+			connection->ring_reading = false;
+			connection->ring_sending = 0;
+			break;
+		}
+		ircRingComplete ();
+	}
+	irc_ring_detaching = NULL;
 }
 
 
 /**
- * Sends a message to a given room
+ * Lets go of every socket and the log file, and tears the ring down, so whatever the reactor does while
+ * closing is done with plain system calls
  */
-int send_room (std::string room, std::string message)
+static void ircRingStop (void)
 {
-	std::string output;
-	output.append (room);
-	output.append (" :");
-	output.append (message);
-	return send_command ("PRIVMSG", output);
+	uint8_t t;
+
+	for (t = 0; t < irc_connection_count; t++)
+	{
+		ircRingDetach (&irc_connections[t]);
+	}
+	while (logger->ringBusy ())
+	{
+		if (irc_ring.submit (1, IRC_RING_DRAIN_MILLI) <= 0)
+		{
+			break;
+		}
+		ircRingComplete ();
+	}
+	logger->useRing (NULL, 0, 0);
+	irc_ring.stop ();
 }
 
 
 /**
- * GIRCThread, handles connecting to twitch groups irc and parsing incoming messages.
+ * Works out how long the reactor can sleep for before a connection has a timer due, in milliseconds
  */
-void *GIRCThread (void *)
+static int ircNextTimeout (void)
 {
-	char girc_recv[MAXDATAREAD];
-	uint32_t available;
+	std::chrono::high_resolution_clock::time_point now = hrc_now;
+	std::chrono::high_resolution_clock::time_point next = now + std::chrono::minutes(10);
+	uint8_t t;
 
-	lock (irc_mutex);
-	while (irc_running)
+	for (t = 0; t < irc_connection_count; t++)
 	{
-		release (irc_mutex);
-		switch (girc_task)
+		irc_connection *connection = &irc_connections[t];
+		if ((connection->task == IRC_RUNNING) && (!connection->overflow.empty ()))
 		{
-			case (IRC_CONNECT):
+			// Main wakes us once it has made room in the receive queue, unless it already had before it saw
+			// the flag, then we try again straight away
+			irc_recv_full.store (true);
+			std::atomic_thread_fence (std::memory_order_seq_cst);
+			if (connection->recv_buffer->size () <= IRC_QUEUE_LOW_WATER)
 			{
-				girc_recv_buffer.empty ();
-				girc_sock = socket(AF_INET, SOCK_STREAM, 0);
-				girc_server = gethostbyname("irc.chat.twitch.tv");
-				if ((girc_sock >= 0) && (girc_server != NULL))
-				{
-					// Sets up the server address
-					bzero((char *) &girc_serv_addr, sizeof(girc_serv_addr));
-					girc_serv_addr.sin_family = AF_INET;
-					bcopy((char *)girc_server->h_addr, (char *)&girc_serv_addr.sin_addr.s_addr, girc_server->h_length);
-					girc_serv_addr.sin_port = htons(girc_port);
-
-					girc_return = connect (girc_sock, (struct sockaddr *) &girc_serv_addr, sizeof (girc_serv_addr));
-					if (girc_return >= 0)
-					{
-						girc_task = IRC_AUTH;
-						girc_timeout = hrc_now;
-						logger->log (" GIRCThread: I've connected to the groups IRC server.\n");
-						break;
-					}
-					else
-					{
-						logger->logf (" GIRCThread: I was unable to get the groups server host, reason: %s.\n", strerror(errno));
-					}
-				}
-				else
-				{
-					logger->logf (" GIRCThread: I was unable to open a socket, or find the groups server, reason: %s.\n", strerror(errno));
-				}
+				next = now;
 			}
-			break;
+		}
+		else if (connection->task == IRC_RUNNING)
+		{
+			next = std::min (next, connection->probe_sent + std::chrono::seconds(irc_probe_interval));
 
-			case (IRC_AUTH):
+			// If rooms are waiting to be joined, join now or when the oldest JOIN leaves the window
+			if (connection->joined < connection->rooms.size ())
 			{
-				girc_return = gsend_command ("PASS", bot_oauth.c_str());
-				girc_return = gsend_command ("NICK", bot_user.c_str());
-				girc_return = gsend_command ("JOIN", "#jtv");
-				girc_return = gsend_command ("CAP REQ", ":twitch.tv/commands");
-
-				logger->log (" GIRCThread: I've successfully authorised myself on the groups server.\n");
-				girc_task = IRC_RUNNING;
+				next = (irc_joins.size () < IRC_JOIN_LIMIT) ? now : std::min (next, irc_joins.front () + std::chrono::seconds(IRC_JOIN_WINDOW));
 			}
-			break;
 
-			case (IRC_RUNNING):
+			// If lines are waiting on the rate limit, wake when the shared bucket has enough tokens for the first, and
+			// if lines are held for slow mode, wake when the first may go
+			lock (connection->send_mutex);
+			if (connection->blocked_cost > 0)
 			{
-				girc_return = ioctl(girc_sock, FIONREAD, &available);
-				if (available > 0)
-				{
-					memset (girc_recv, 0, MAXDATAREAD);
-					girc_return = read(girc_sock, girc_recv, MAXDATAREAD);
-					if (girc_return > 0)
-					{
-						std::string received (girc_recv);
-						std::string message;
-						size_t last_found = 0;
-						size_t found = 0;
-
-						found = received.find ("\r\n");
-						while (found != std::string::npos)
-						{
-							message = received.substr(last_found, found-last_found);
-							girc_recv_buffer.push_back(message);
-							logger->debugf (DEBUG_DETAILED, " GIRCThread: I received on groups: %s\r\n", message.c_str());
-							last_found = found+2;
-							found = received.find ("\r\n", last_found);
-							girc_timeout = hrc_now;
-						}
-					}
-					else if ((girc_return != -EAGAIN) && (girc_return != -EWOULDBLOCK) && (girc_return != -1) && (girc_return != 0))
-					{
-						// Failed to read the message
-						logger->logf (" GIRCThread: I had a problem reading the groups IRC socket, so I'm reconnecting, reason: %s.\n", strerror(errno));
-						girc_task = IRC_CLOSE;
-					}
-				}
-
-				// Check if we have lost comms, no messages after 10 minutes (ping should be every 5)
-				if ((hrc_now - girc_timeout) > std::chrono::minutes(10))
-				{
-					logger->log (" GIRCThread: Master, the groups IRC socket has been quiet for 10 minutes, I'm going to reconnect incase the socket is dead.\n");
-					girc_task = IRC_CLOSE;
-				}
+				lock (irc_rate_mutex);
+				double wait = ((connection->blocked_cost - irc_tokens) * IRC_RATE_WINDOW) / (IRC_RATE_MODERATOR / 2.0);
+				next = std::min (next, irc_refilled + std::chrono::microseconds((int64_t)(wait * 1000000)));
+				release (irc_rate_mutex);
 			}
-			break;
-
-			case (IRC_CLOSE):
+			if (connection->holding)
 			{
-				gsend_command ("PART", "Bye Bye ^^");
-				gsend_command ("QUIT", "SkidBot");
-				close (girc_sock);
-				girc_sock = -1;
+				next = std::min (next, connection->held_until);
+			}
+			release (connection->send_mutex);
+		}
+		else if ((connection->task == IRC_CONNECT) && (ircConnecting (connection)))
+		{
+			next = std::min (next, std::min (connection->next_attempt, connection->deadline));
+		}
+		else if (connection->task == IRC_HANDSHAKE)
+		{
+			next = std::min (next, connection->deadline);
+		}
+		else if ((connection->task == IRC_CONNECT) && (connection->resolving))
+		{
+			// The resolver wakes us when it's done
+			next = std::min (next, connection->deadline);
+		}
+		else if (connection->task == IRC_CONNECT)
+		{
+			next = std::min (next, connection->retry);
+		}
+		else
+		{
+			next = now;
+		}
+	}
+
+	if (next <= now)
+	{
+		return 0;
+	}
+
+	// Round up, otherwise we wake a fraction early and spin until the timer is due
+	return (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+}
+
+
+/**
+ * Puts a irc command straight on to the outbound buffer of the given connection, skipping the lanes,
+ * only used by the reactor itself while logging in and out. Nothing is written until ircWritePending
+ * is called, so a burst of commands goes out together.
+ */
+static void ircSend (irc_connection *connection, const std::string &command, const std::string &data)
+{
+	connection->outbound.push_back (ircLine (command, data));
+}
+
+
+/**
+ * Moves a complete irc line in to the lane for its priority and wakes the reactor to send it, PRIVMSGs
+ * wait for the rate limit, anything else goes out straight away. Returns the length queued, or
+ * 0 if it was dropped as a duplicate of a low priority line that is still waiting.
+ */
+static int ircSchedule (irc_connection *connection, std::string &&line, uint8_t priority)
+{
+	uint64_t wakeup = 1;
+	int length = line.size ();
+	bool wake;
+
+	if (line.compare (0, 8, "PRIVMSG ") != 0)
+	{
+		priority = IRC_PRIORITY_CONTROL;
+	}
 
-				girc_task = IRC_CONNECT;
+	lock (connection->send_mutex);
+
+	// A low priority line is only still waiting on the bucket or a room's slow mode, so there's no point queuing
+	// the same information twice
+	if (priority == IRC_PRIORITY_LOW)
+	{
+		for (std::string &waiting : connection->lanes[IRC_PRIORITY_LOW])
+		{
+			if (waiting.compare (line) == 0)
+			{
+				release (connection->send_mutex);
+				logger->debugf (DEBUG_STANDARD, " %s: I'm rate limited, so I've dropped a duplicate of: %s", connection->name, line.c_str());
+				return 0;
 			}
-			break;
 		}
+	}
 
-		usleep (100000);
-		lock (irc_mutex);
+	// A reply that was packed in to one still waiting will go out with it
+	if ((irc_pack_milli > 0) && ((priority == IRC_PRIORITY_NORMAL) || (priority == IRC_PRIORITY_LOW)) && (ircPack (connection, line, priority)))
+	{
+		release (connection->send_mutex);
+		return length;
 	}
-	release (irc_mutex);
 
-	gsend_command ("PART", "Bye Bye ^^");
-	gsend_command ("QUIT", "SkidBot");
-	close (girc_sock);
+	// If the lane already had lines in it, the reactor has either been woken for them or is waiting on the
+	// rate limit, so only the first line needs to wake it, unless the lines are held for a room's slow mode
+	wake = (connection->lanes[priority].empty ()) || (connection->holding);
+	connection->lanes[priority].push_back (std::move (line));
 
-	girc_recv_buffer.clear ();
+	release (connection->send_mutex);
 
-	logger->log (" GIRCThread: I've stopped the groups IRC thread.\n");
+	if ((wake) && (write (irc_wakeup, &wakeup, sizeof (wakeup)) < 0))
+	{
+		logger->logf (" %s: I was unable to wake my reactor, reason: %s.\n", connection->name, strerror(errno));
+	}
 
-	return NULL;
+	return length;
 }
 
 
 /**
- * Sends a irc command to the groups server
+ * Packs a reply in to the last line still waiting for the same room in the lane, so long as both are plain
+ * chat and the result fits in one message, the send_mutex must be held. Returns false if the reply has to
+ * go on its own, and if it does it opens the packing window for the room.
  */
-int gsend_command (std::string command, std::string data)
+static bool ircPack (irc_connection *connection, std::string &line, uint8_t priority)
 {
-	int command_return;
+	std::string_view view (line);
+	size_t colon = view.find (" :", 8);
+	irc_room_state *state = ircLineRoom (line);
+
+	// Commands and actions have to be sent on their own
+	if ((state == NULL) || (colon == std::string_view::npos) || (view.size () < colon + 5) || (view[colon + 2] == '/') || (view[colon + 2] == '.') || (view[colon + 2] == '\x01'))
+	{
+		return false;
+	}
+	std::string_view prefix = view.substr (0, colon + 2);
+	std::string_view text = view.substr (colon + 2, view.size () - colon - 4);
+
+	for (std::deque<std::string>::reverse_iterator waiting = connection->lanes[priority].rbegin (); waiting != connection->lanes[priority].rend (); waiting++)
+	{
+		if (waiting->compare (0, prefix.size (), prefix) != 0)
+		{
+			continue;
+		}
+
+		// Only the room's last line is packed in to, so its replies keep their order
+		size_t waiting_length = waiting->size () - prefix.size () - 2;
+		char first = (*waiting)[prefix.size ()];
+		if ((first != '/') && (first != '.') && (first != '\x01') && (waiting_length + irc_pack_separator.size () + 2 + text.size () <= IRC_MESSAGE_LIMIT))
+		{
+			std::string packed = " ";
+			packed.append (irc_pack_separator);
+			packed.append (" ");
+			packed.append (text);
+			waiting->insert (waiting->size () - 2, packed);
+			return true;
+		}
+		break;
+	}
+
+	if (hrc_now >= state->pack_until)
+	{
+		state->pack_until = hrc_now + std::chrono::milliseconds(irc_pack_milli);
+	}
+	return false;
+}
 
-	std::string message;
 
-	message = command;
+/**
+ * Builds a complete irc line from a command and its data
+ */
+static std::string ircLine (const std::string &command, const std::string &data)
+{
+	std::string line;
+
+	line.reserve (command.size() + data.size() + 3);
+	line.append (command);
 	if (!data.empty())
 	{
-		message.append (" ");
-		message.append (data);
+		line.append (" ");
+		line.append (data);
 	}
-	message.append ("\r\n");
+	line.append ("\r\n");
+
+	return line;
+}
+
+
+/**
+ * Builds a complete PRIVMSG line for a room
+ */
+static std::string ircRoomLine (const std::string &room, const std::string &message)
+{
+	std::string line;
+
+	line.reserve (room.size() + message.size() + 12);
+	line.append ("PRIVMSG ");
+	line.append (room);
+	line.append (" :");
+	line.append (message);
+	line.append ("\r\n");
+
+	return line;
+}
 
-	lock (irc_mutex);
-	command_return = write (girc_sock, message.c_str(), message.size());
-	release (irc_mutex);
 
-	if (command_return < 0)
+/**
+ * Finds the chat connection a room is sharded on to
+ */
+static irc_connection *ircRoomConnection (const std::string &room)
+{
+	std::unordered_map<std::string_view, uint16_t>::iterator found = irc_room_ids.find (room);
+	if (found != irc_room_ids.end ())
 	{
-		logger->logf (" GIRCThread: I was unable to send the following message to the groups IRC server: %s, reason: %s.\n", message.c_str(), strerror(errno));
+		return &irc_connections[IRC_CHAT + (found->second % irc_shards)];
 	}
-	else
+
+	// Rooms we weren't set up with are hashed, so they always land on the same connection
+	return &irc_connections[IRC_CHAT + (std::hash<std::string>() (room) % irc_shards)];
+}
+
+
+/**
+ * Sends a irc command to the server, on the first chat connection
+ */
+int send_command (const std::string &command, const std::string &data, uint8_t priority)
+{
+	return ircSchedule (&irc_connections[IRC_CHAT], ircLine (command, data), priority);
+}
+
+
+/**
+ * Sends a irc command on the given connection, used to answer the server that sent us something
+ */
+int send_connection (uint8_t connection, const std::string &command, const std::string &data, uint8_t priority)
+{
+	if (connection >= irc_connection_count)
 	{
-		// TODO: Disable this debug message
-		//logger->debugf (DEBUG_MINIMAL, " GIRCThread: I sent on groups: %s", message.c_str());
+		return -1;
 	}
 
-	return command_return;
+	return ircSchedule (&irc_connections[connection], ircLine (command, data), priority);
+}
+
+
+/**
+ * Sends a message to a given room, on the chat connection that room is sharded on to
+ */
+int send_room (const std::string &room, const std::string &message, uint8_t priority)
+{
+	return ircSchedule (ircRoomConnection (room), ircRoomLine (room, message), priority);
+}
+
+
+/**
+ * Leaves a given room, on the chat connection that room is sharded on to
+ */
+int part_room (const std::string &room)
+{
+	return ircSchedule (ircRoomConnection (room), ircLine ("PART", room), IRC_PRIORITY_CONTROL);
+}
+
+
+/**
+ * Returns the smoothed round trip time in milliseconds of the connection the room is on, or 0 if it
+ * hasn't been measured yet
+ */
+double room_latency (const std::string &room)
+{
+	return ircRoomConnection (room)->rtt.load (std::memory_order_relaxed);
+}
+
+
+/**
+ * Sends a irc command to the groups server
+ */
+int gsend_command (const std::string &command, const std::string &data, uint8_t priority)
+{
+	return ircSchedule (&irc_connections[IRC_GROUPS], ircLine (command, data), priority);
 }
 
 
 /**
  * Sends a message to a given room on the groups server
  */
-int gsend_room (std::string room, std::string message)
+int gsend_room (const std::string &room, const std::string &message, uint8_t priority)
 {
-	std::string output;
-	output.append (room);
-	output.append (" :");
-	output.append (message);
-	return gsend_command ("PRIVMSG", output);
+	return ircSchedule (&irc_connections[IRC_GROUPS], ircRoomLine (room, message), priority);
 }
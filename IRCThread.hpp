@@ -1,21 +1,224 @@
 #ifndef	_IRC_Thread_H
 #define _IRC_Thread_H
 
-#define MAXDATAREAD	512
+#include <stdint.h>
+#include <pthread.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+#include <chrono>
+#include <atomic>
+
+#include <sys/socket.h>
+
+#include "LineBuffer.hpp"
+#include "SPSCQueue.hpp"
+
 #define DEFAULT_IRC_PORT	6667
+#define DEFAULT_IRC_TLS_PORT	6697
+#define IRC_MAX_EVENTS	16
+#define IRC_RETRY_MILLI	100
+#define IRC_RETRY_MAX_MILLI	30000
+#define IRC_QUEUE_SIZE	4096
+#define IRC_QUEUE_LOW_WATER	(IRC_QUEUE_SIZE / 4)	// Main wakes the reactor once a full receive queue drains to this
+#define IRC_OVERFLOW_LIMIT	16384		// Lines held back per connection before reads are paused
+#define IRC_MAX_IOV		64
+
+// Connecting defines, a slow address gets raced by the next one after IRC_ATTEMPT_MILLI, and a connection
+// has to stay up for IRC_STABLE_SECONDS before the reconnect backoff is reset
+#define IRC_CONNECT_TIMEOUT	10
+#define IRC_ATTEMPT_MILLI	250
+#define IRC_MAX_ATTEMPTS	4
+#define IRC_STABLE_SECONDS	30
+
+// Liveness defines, a PING probe is sent every IRC_PROBE_SECONDS and the connection is dropped after
+// IRC_PROBE_MISSES probes go unanswered, both can be changed in the configuration
+#define IRC_PROBE_SECONDS	5
+#define IRC_PROBE_MISSES	3
+#define IRC_PROBE_TOKEN		"skidbot-probe-"
+
+// Capability defines, set once the server has acknowledged our CAP REQ
+#define IRC_CAP_COMMANDS	1
+#define IRC_CAP_MEMBERSHIP	2
+#define IRC_CAP_TAGS		4
+
+// Twitch allows 20 PRIVMSGs per 30 seconds, or 100 in rooms we moderate, per account rather than per connection, so
+// every connection draws from one bucket sized for the moderator limit and a PRIVMSG to a room we don't moderate
+// costs IRC_RATE_MODERATOR / IRC_RATE_USER tokens
+#define IRC_RATE_USER		20
+#define IRC_RATE_MODERATOR	100
+#define IRC_RATE_WINDOW		30
+
+// Packing defines, when packing is on short replies to the same room are joined in to one PRIVMSG of up to
+// IRC_MESSAGE_LIMIT characters, the first reply waits up to IRC_PACK_MAX_MILLI for the others to catch up
+#define IRC_MESSAGE_LIMIT	500
+#define IRC_PACK_MAX_MILLI	5000
+
+// Outbound priority defines, moderation jumps ahead of normal replies, which jump ahead of information
+#define IRC_PRIORITY_HIGH	0
+#define IRC_PRIORITY_NORMAL	1
+#define IRC_PRIORITY_LOW	2
+#define IRC_PRIORITY_CONTROL	3		// Used internally for anything that isn't a PRIVMSG, never rate limited
+#define IRC_LANES			4
 
 // Socket task defines
 #define IRC_CONNECT	0
-#define IRC_AUTH	1
-#define IRC_RUNNING	2
-#define IRC_CLOSE	3
+#define IRC_HANDSHAKE	1
+#define IRC_AUTH	2
+#define IRC_RUNNING	3
+#define IRC_CLOSE	4
+
+// Connection defines, the reactor owns the groups connection and up to 32 chat connections that the rooms are sharded across,
+// each chat connection may have a warm standby after the shards
+#define IRC_GROUPS	0
+#define IRC_CHAT	1
+#define IRC_MAX_SHARDS	32
+#define IRC_MAX_CONNECTIONS	(IRC_CHAT + (IRC_MAX_SHARDS * 2))
+
+// Standby defines, a standby keeps its last IRC_STANDBY_BACKLOG chat lines so whatever the chat connection missed
+// can be replayed when it's promoted, then for IRC_STANDBY_DEDUP_MILLI lines the old connection already had are skipped
+#define IRC_STANDBY_BACKLOG	1024
+#define IRC_STANDBY_DEDUP_MILLI	2000
+
+// Handover defines, a new process started with -r connects to IRC_HANDOVER_PATH to take the live
+// connections over, the last record sent has its connection set to IRC_HANDOVER_END. Each record starts
+// with IRC_HANDOVER_MAGIC and IRC_HANDOVER_VERSION, the version has to go up whenever the record changes.
+#define IRC_HANDOVER_PATH	"SkidBot.sock"
+#define IRC_HANDOVER_END	0xFF
+#define IRC_HANDOVER_MAGIC	0x534B4842		// "SKHB"
+#define IRC_HANDOVER_VERSION	1
+
+// io_uring defines, with the uring backend running plain sockets are read and written, and the log is appended,
+// through one ring, each connection has a receive and a send buffer of IRC_RING_BUFFER registered with it
+#define IRC_RING_ENTRIES	256
+#define IRC_RING_BUFFER		16384
+#define IRC_RING_DRAIN_MILLI	1000
+
+// Ring operation defines, kept in the user data above the connection index
+#define IRC_RING_READ		1
+#define IRC_RING_READABLE	2		// Only used if the kernel won't wait on a non-blocking socket for us
+#define IRC_RING_WRITE		3
+#define IRC_RING_WRITABLE	4
+#define IRC_RING_LOG		5
+#define IRC_RING_WAKEUP		6
+#define IRC_RING_EPOLL		7
+#define IRC_RING_CANCEL		8
+
+// Twitch allows 20 JOINs per 10 seconds
+#define IRC_JOIN_LIMIT	20
+#define IRC_JOIN_WINDOW	10
+
+// Holds a received line, tagged with the connection it came in on and the room it's for, or -1 if it isn't for a room
+typedef struct irc_line
+{
+	std::string line;
+	uint8_t connection = 0;
+	int32_t room = -1;
+} irc_line;
+
+// Holds what twitch has told us about a room and our place in it, from ROOMSTATE and USERSTATE
+typedef struct irc_room_state
+{
+	bool emote_only = false;
+	bool subs_only = false;
+	bool r9k = false;
+	int16_t followers_only = -1;	// Minutes someone has to have followed for, -1 when it's off
+	bool unfollowed = false;		// Set when twitch refuses us for followers-only, we can't see if we follow
+	uint16_t slow = 0;				// Seconds between messages, 0 when it's off
+	bool moderator = false;			// Set when we're a moderator or the broadcaster, we're exempt from all of it
+	bool vip = false;				// Set when we're a VIP, exempt from slow, subs and followers-only
+	bool subscriber = false;
+	std::chrono::high_resolution_clock::time_point last_sent;	// When our last PRIVMSG to the room was sent
+	std::chrono::high_resolution_clock::time_point pack_until;	// Replies are held for packing until then, guarded by the connection's send_mutex
+} irc_room_state;
+
+// Holds what a new process needs to carry on with a connection, sent along with the socket, and followed
+// by the received lines main hadn't handled, the partial line, and the lines that weren't sent yet
+typedef struct irc_handover_record
+{
+	uint32_t magic = IRC_HANDOVER_MAGIC;		// Checked before anything else, the old process may be a different build
+	uint16_t version = IRC_HANDOVER_VERSION;
+	uint16_t size = sizeof (irc_handover_record);
+	uint8_t connection = IRC_HANDOVER_END;
+	uint8_t shards = 0;
+	uint8_t caps = 0;
+	uint16_t joined = 0;
+	double tokens = 0;
+	uint32_t lines = 0;
+	uint32_t partial = 0;
+	uint32_t unsent = 0;
+} irc_handover_record;
+
+// Holds the state of one IRC connection driven by the reactor
+typedef struct irc_connection
+{
+	const char *name;			// Name used when logging, IE "IRCThread"
+	char name_buffer[24];
+	const char *description;	// Description used when logging, IE "IRC server"
+	const char *host;
+	int port;
+	uint8_t task = IRC_CONNECT;
+	int sock = -1;
+	SSL *ssl = NULL;						// Set while the connection is using TLS
+	int attempts[IRC_MAX_ATTEMPTS] = {-1, -1, -1, -1};		// Sockets still connecting, the first to finish wins
+	std::vector<struct sockaddr_storage> addresses;			// Addresses found for the host, in the order to try them
+	size_t next_address = 0;
+	bool resolving = false;					// Set while the resolver is looking the host up
+	uint8_t failures = 0;					// Failed connections in a row, used for the backoff
+	std::chrono::high_resolution_clock::time_point next_attempt;	// When to race the next address
+	std::chrono::high_resolution_clock::time_point deadline;		// When to give up connecting
+	std::chrono::high_resolution_clock::time_point connecting;		// When we started connecting
+	std::chrono::high_resolution_clock::time_point connected;		// When the socket connected
+	std::chrono::high_resolution_clock::time_point timeout;		// Last time we heard from the server
+	std::chrono::high_resolution_clock::time_point retry;		// Earliest time we may try to connect again
+	LineBuffer lines;		// Carries partial lines over between reads
+	std::deque<irc_line> overflow;			// Lines waiting for room in the receive queue
+	bool paused = false;					// Set while reads are paused because too many lines are held back
+	SPSCQueue<irc_line> *recv_buffer;
+	std::vector<uint16_t> rooms;				// Ids of the rooms sharded on to this connection
+	size_t joined = 0;							// How many of those rooms have been joined since connecting
+	pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;		// Guards the lanes
+	std::deque<std::string> lanes[IRC_LANES];					// Lines waiting to be sent, one lane per priority
+	uint8_t blocked_cost = 0;					// Tokens the first line that didn't fit in the bucket needs, 0 if nothing is waiting on it
+	bool holding = false;						// Set while lines are held back for a room's slow mode
+	std::chrono::high_resolution_clock::time_point held_until;	// When the first held line may go
+	std::deque<std::string> outbound;			// Lines taken from the lanes that the socket hasn't accepted yet, reactor only
+	size_t outbound_offset = 0;					// How much of the first outbound line has already been written
+	bool writable = true;						// Cleared while we're waiting on EPOLLOUT
+	std::string gathered;						// TLS can't gather with writev, so the lines are copied in to one record here
+	bool ring_reading = false;					// Set while a read on the ring is in flight
+	size_t ring_sending = 0;					// Bytes in the write on the ring in flight, 0 when there isn't one
+	uint8_t caps = 0;							// Capabilities the server has acknowledged
+	uint32_t probe = 0;							// Number of the last PING probe sent
+	bool probing = false;						// Set while the last probe hasn't been answered
+	uint8_t missed = 0;							// Probes in a row that went unanswered
+	std::chrono::high_resolution_clock::time_point probe_sent;
+	std::atomic<double> rtt {0};				// Smoothed round trip time in milliseconds, 0 until measured
+	irc_connection *standby = NULL;				// The chat connection's warm standby, if it has one
+	bool passive = false;						// Set on a standby, it joins the rooms but only keeps the chat for gap replay
+	std::deque<irc_line> backlog;				// The standby's last chat lines
+	std::vector<size_t> delivered;				// Hashes of the last chat lines the chat connection queued, a ring of IRC_STANDBY_BACKLOG
+	size_t delivered_next = 0;
+	std::unordered_set<size_t> duplicates;		// Lines the old connection had that the promoted standby may still be sent
+	std::chrono::high_resolution_clock::time_point dedup_until;
+} irc_connection;
 
 // Global function prototypes
+int setupIRCConnections (void);
 void *IRCThread (void *);
-int send_command (std::string command, std::string data);
-int send_room (std::string room, std::string message);
-void *GIRCThread (void *);
-int gsend_command (std::string command, std::string data);
-int gsend_room (std::string room, std::string message);
+void stopIRCThread (void);
+void waitIRCLines (int timeout_milli);
+void wakeMain (void);
+bool handingOverIRC (void);
+void handOverIRCConnections (void);
+int send_command (const std::string &command, const std::string &data, uint8_t priority = IRC_PRIORITY_NORMAL);
+int send_connection (uint8_t connection, const std::string &command, const std::string &data, uint8_t priority = IRC_PRIORITY_NORMAL);
+int send_room (const std::string &room, const std::string &message, uint8_t priority = IRC_PRIORITY_NORMAL);
+int part_room (const std::string &room);
+double room_latency (const std::string &room);
+int gsend_command (const std::string &command, const std::string &data, uint8_t priority = IRC_PRIORITY_NORMAL);
+int gsend_room (const std::string &room, const std::string &message, uint8_t priority = IRC_PRIORITY_NORMAL);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string_view>
+
+#include "LineBuffer.hpp"
+#include "TLSTransport.hpp"
+
+
+/**
+ * Creates an empty line buffer, the storage is allocated on the first read
+ */
+LineBuffer::LineBuffer ()
+{
+	buffer = NULL;
+	capacity = 0;
+	head = 0;
+	tail = 0;
+	scanned = 0;
+}
+
+
+/**
+ * Frees the buffer storage
+ */
+LineBuffer::~LineBuffer ()
+{
+	free (buffer);
+	buffer = NULL;
+}
+
+
+/**
+ * Makes sure there is at least LINE_BUFFER_READ bytes free after the tail, by first moving the
+ * partial line to the front, and then growing the buffer if that isn't enough
+ */
+bool LineBuffer::makeSpace (void)
+{
+	if (capacity - tail >= LINE_BUFFER_READ)
+	{
+		return true;
+	}
+
+	// Move the partial line back to the start, it's normally only a few bytes
+	if (head > 0)
+	{
+		memmove (buffer, buffer + head, tail - head);
+		tail -= head;
+		scanned -= head;
+		head = 0;
+	}
+
+	if (capacity - tail >= LINE_BUFFER_READ)
+	{
+		return true;
+	}
+
+	// Still not enough room, so the partial line is huge, grow the buffer
+	size_t new_capacity = (capacity == 0) ? (LINE_BUFFER_READ * 2) : (capacity * 2);
+	if (new_capacity > LINE_BUFFER_MAX)
+	{
+		return false;
+	}
+
+	char *new_buffer = (char *)realloc (buffer, new_capacity);
+	if (new_buffer == NULL)
+	{
+		return false;
+	}
+	buffer = new_buffer;
+	capacity = new_capacity;
+
+	return true;
+}
+
+
+/**
+ * Reads as much as will fit from the given file descriptor in to the buffer, returns the value of
+ * read, or -1 with errno set to EMSGSIZE if a single line has grown past LINE_BUFFER_MAX
+ */
+ssize_t LineBuffer::readFrom (int fd)
+{
+	if (!makeSpace ())
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	ssize_t read_return = read (fd, buffer + tail, capacity - tail);
+	if (read_return > 0)
+	{
+		tail += read_return;
+	}
+
+	return read_return;
+}
+
+
+/**
+ * Reads as much as will fit from the given TLS connection in to the buffer, returns like readFrom
+ * does for a file descriptor
+ */
+ssize_t LineBuffer::readFrom (SSL *ssl)
+{
+	if (!makeSpace ())
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	ssize_t read_return = tlsRead (ssl, buffer + tail, capacity - tail);
+	if (read_return > 0)
+	{
+		tail += read_return;
+	}
+
+	return read_return;
+}
+
+
+/**
+ * Hands out the next complete line without its line ending, returns false if there isn't one yet
+ */
+bool LineBuffer::nextLine (std::string_view *line)
+{
+	while (scanned < tail)
+	{
+		char *found = (char *)memchr (buffer + scanned, '\n', tail - scanned);
+		if (found == NULL)
+		{
+			scanned = tail;
+			return false;
+		}
+
+		size_t end = found - buffer;
+		size_t start = head;
+		head = end + 1;
+		scanned = head;
+
+		// Strip the carriage return, and skip over any blank lines
+		if ((end > start) && (buffer[end - 1] == '\r'))
+		{
+			end--;
+		}
+		if (end > start)
+		{
+			*line = std::string_view (buffer + start, end - start);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Adds bytes that were read somewhere else, IE by the process we took the connection over from,
+ * returns false if they don't fit
+ */
+bool LineBuffer::append (const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		if (!makeSpace ())
+		{
+			return false;
+		}
+
+		size_t copy = std::min (length, capacity - tail);
+		memcpy (buffer + tail, data, copy);
+		tail += copy;
+		data += copy;
+		length -= copy;
+	}
+
+	return true;
+}
+
+
+/**
+ * Returns the bytes that haven't been handed out as a line yet, valid until the next read
+ */
+std::string_view LineBuffer::unread (void)
+{
+	return std::string_view (buffer + head, tail - head);
+}
+
+
+/**
+ * Returns how many bytes are waiting that haven't been handed out as a line yet
+ */
+size_t LineBuffer::pending (void)
+{
+	return tail - head;
+}
+
+
+/**
+ * Throws away anything in the buffer, used when the connection is closed
+ */
+void LineBuffer::clear (void)
+{
+	head = 0;
+	tail = 0;
+	scanned = 0;
+}
+
+
+/**
+ * Swaps the contents with another line buffer, used when a standby's socket takes over a connection
+ */
+void LineBuffer::swap (LineBuffer &other)
+{
+	std::swap (buffer, other.buffer);
+	std::swap (capacity, other.capacity);
+	std::swap (head, other.head);
+	std::swap (tail, other.tail);
+	std::swap (scanned, other.scanned);
+}
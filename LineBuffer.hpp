@@ -0,0 +1,53 @@
+#ifndef	_LINE_BUFFER_H
+#define _LINE_BUFFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <string_view>
+
+// Lets the TLS reads be declared without pulling OpenSSL in to everything that uses a line buffer
+typedef struct ssl_st SSL;
+
+// Defines how much space is kept free for each read, and the most a single partial line may use
+#define LINE_BUFFER_READ	16384
+#define LINE_BUFFER_MAX		1048576
+
+// Define the LineBuffer class
+class LineBuffer;
+
+// Build the LineBuffer class template, frames a byte stream into lines, carrying any partial line
+// over to the next read. Lines are handed out as views into the buffer, and stay valid until the
+// next call to readFrom or clear.
+class LineBuffer
+{
+private:
+	// Private variables
+	char *buffer;
+	size_t capacity;
+	size_t head;		// Start of the data that hasn't been handed out yet
+	size_t tail;		// End of the data that has been read
+	size_t scanned;		// How far we've already searched for a line ending
+
+	// Private methods
+	bool makeSpace (void);
+
+public:
+	// Constructors and destructor
+	LineBuffer ();
+	~LineBuffer ();
+	LineBuffer (const LineBuffer &) = delete;
+	LineBuffer &operator= (const LineBuffer &) = delete;
+
+	// Public methods
+	ssize_t readFrom (int fd);
+	ssize_t readFrom (SSL *ssl);
+	bool nextLine (std::string_view *line);
+	bool append (const char *data, size_t length);
+	std::string_view unread (void);
+	size_t pending (void);
+	void clear (void);
+	void swap (LineBuffer &other);
+};
+
+#endif
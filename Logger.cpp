@@ -2,10 +2,14 @@
 #include <stdarg.h>
 #include <string.h>
 #include <string>
+#include <algorithm>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include "Logger.hpp"
+#include "IOURing.hpp"
 #include "SkidBot.hpp"
 
 /**
@@ -20,6 +24,11 @@ Logger::Logger ()
 	last_log_line = "";
 	last_log_count = 0;
 	log_mutex = PTHREAD_MUTEX_INITIALIZER;
+	ring = NULL;
+	ring_fd = -1;
+	ring_buffer = 0;
+	ring_user_data = 0;
+	ring_writing = 0;
 
 	// Report logger initialisation
 	//logf (": Initialised with log file: %s.\n", log_file_name.c_str ());
@@ -38,6 +47,11 @@ Logger::Logger (const char *log_file_location)
 	last_log_line = "";
 	last_log_count = 0;
 	log_mutex = PTHREAD_MUTEX_INITIALIZER;
+	ring = NULL;
+	ring_fd = -1;
+	ring_buffer = 0;
+	ring_user_data = 0;
+	ring_writing = 0;
 
 	// Report logger initialisation
 	logf (": Initialised with log file: %s\n", log_file_name.c_str ());
@@ -112,34 +126,31 @@ void Logger::log (const char *line)
 	}
 	else
 	{
-		if (initLogFile() == 1)
-		{
-			char time_buffer[21];
+		char time_buffer[21];
+		std::string entry;
 
-			memset(time_buffer, 0, 21);
-			time_t time_of_day;
-			time (&time_of_day);
-			strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S ", gmtime(&time_of_day));
-			
-			// Store how many times the last message repeated
-			last_log_line = line;
-			if (last_log_count > 0)
-			{
-				char buffer[64];
-				std::string log_repeat;
-				
-				snprintf (buffer, 64, "(Last message repeated %d times.)\n", last_log_count);
-				log_repeat = buffer;
-				
-				fprintf (log_file, "%s%s", time_buffer, log_repeat.c_str ());
-				
-				last_log_count = 0;
-			}
+		memset(time_buffer, 0, 21);
+		time_t time_of_day;
+		time (&time_of_day);
+		strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S ", gmtime(&time_of_day));
+
+		// Store how many times the last message repeated
+		last_log_line = line;
+		if (last_log_count > 0)
+		{
+			char buffer[64];
 
-			fprintf (log_file, "%s%s%s", time_buffer, line_prefix, line);
+			snprintf (buffer, 64, "(Last message repeated %d times.)\n", last_log_count);
+			entry.append (time_buffer);
+			entry.append (buffer);
 
-			closeLogFile ();
+			last_log_count = 0;
 		}
+
+		entry.append (time_buffer);
+		entry.append (line_prefix);
+		entry.append (line);
+		writeLogFile (entry);
 	}
 
 	release (log_mutex);
@@ -176,16 +187,9 @@ void Logger::logx (unsigned char hex, bool end_line)
 	{
 		printf ("\n");
 	}
-	if (initLogFile() == 1)
-	{
-		fprintf (log_file, "%02x ", hex);
-		if (end_line)
-		{
-			fprintf (log_file, "\n");
-		}
-
-		closeLogFile ();
-	}
+	char buffer[8];
+	snprintf (buffer, 8, end_line ? "%02x \n" : "%02x ", hex);
+	writeLogFile (buffer);
 
 	release (log_mutex);
 }
@@ -209,34 +213,34 @@ void Logger::debug (uint8_t debug_level, const char *line)
 		}
 		else
 		{
-			if (initLogFile() == 1)
-			{
-				char time_buffer[21];
-
-				memset(time_buffer, 0, 21);
-				time_t time_of_day;
-				time (&time_of_day);
-				strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S ", gmtime(&time_of_day));
-
-				// Store how many times the last message repeated
-				last_log_line = line;
-				if (last_log_count > 0)
-				{
-					char buffer[64];
-					std::string log_repeat;
-
-					snprintf (buffer, 64, "(Last message repeated %d times.)\n", last_log_count);
-					log_repeat = buffer;
+			char time_buffer[21];
+			char level_buffer[16];
+			std::string entry;
 
-					fprintf (log_file, "%s%s", time_buffer, log_repeat.c_str ());
+			memset(time_buffer, 0, 21);
+			time_t time_of_day;
+			time (&time_of_day);
+			strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S ", gmtime(&time_of_day));
 
-					last_log_count = 0;
-				}
+			// Store how many times the last message repeated
+			last_log_line = line;
+			if (last_log_count > 0)
+			{
+				char buffer[64];
 
-				fprintf (log_file, "%s%s DEBUG %d%s", time_buffer, line_prefix, debug_level, line);
+				snprintf (buffer, 64, "(Last message repeated %d times.)\n", last_log_count);
+				entry.append (time_buffer);
+				entry.append (buffer);
 
-				closeLogFile ();
+				last_log_count = 0;
 			}
+
+			snprintf (level_buffer, 16, " DEBUG %d", debug_level);
+			entry.append (time_buffer);
+			entry.append (line_prefix);
+			entry.append (level_buffer);
+			entry.append (line);
+			writeLogFile (entry);
 		}
 	}
 
@@ -279,16 +283,9 @@ void Logger::debugx (uint8_t debug_level, unsigned char hex, bool end_line)
 		{
 			printf ("\n");
 		}
-		if (initLogFile() == 1)
-		{
-			fprintf (log_file, "%02x ", hex);
-			if (end_line)
-			{
-				fprintf (log_file, "\n");
-			}
-
-			closeLogFile ();
-		}
+		char buffer[8];
+		snprintf (buffer, 8, end_line ? "%02x \n" : "%02x ", hex);
+		writeLogFile (buffer);
 	}
 
 	release (log_mutex);
@@ -302,3 +299,148 @@ void Logger::closeLogFile (void)
 {
 	fclose (log_file);
 }
+
+
+/**
+ * Appends the text to the log file, through the ring if we have one, otherwise the file is opened,
+ * written and closed again, the log_mutex must be held
+ */
+void Logger::writeLogFile (const std::string &text)
+{
+	if (ring != NULL)
+	{
+		ring_pending.append (text);
+		ringSubmit ();
+	}
+	else if (initLogFile() == 1)
+	{
+		fputs (text.c_str (), log_file);
+		closeLogFile ();
+	}
+}
+
+
+/**
+ * Appends the log file through the given ring from now on, so writing a line never blocks on the disk
+ * and lines logged while a write is in flight go out together in the next one. The completions have to
+ * be passed to ringWritten. Passing NULL goes back to opening the file for each line, the ring's
+ * owner has to wait until ringBusy is false first. Returns false if the log file couldn't be opened.
+ */
+bool Logger::useRing (IOURing *new_ring, unsigned buffer_index, uint64_t user_data)
+{
+	lock (log_mutex);
+
+	if (new_ring != NULL)
+	{
+		ring_fd = open (log_file_name.c_str (), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (ring_fd < 0)
+		{
+			printf ("%s: Logger unable to open log file.\n", line_prefix);
+			release (log_mutex);
+			return false;
+		}
+		ring = new_ring;
+		ring_buffer = buffer_index;
+		ring_user_data = user_data;
+		ring_writing = 0;
+	}
+	else if (ring != NULL)
+	{
+		// Anything that didn't get a turn is written the old way
+		std::string pending;
+		pending.swap (ring_pending);
+		ring = NULL;
+		close (ring_fd);
+		ring_fd = -1;
+		if (!pending.empty ())
+		{
+			writeLogFile (pending);
+		}
+	}
+
+	release (log_mutex);
+	return true;
+}
+
+
+/**
+ * Starts the next write from the lines waiting if there isn't one in flight, the log_mutex must be held
+ */
+void Logger::ringSubmit (void)
+{
+	if ((ring_writing > 0) || (ring_pending.empty ()))
+	{
+		return;
+	}
+
+	size_t length = std::min (ring_pending.size (), ring->bufferSize ());
+	memcpy (ring->buffer (ring_buffer), ring_pending.data (), length);
+	if (!ring->write (ring_fd, ring_buffer, length, ring_user_data))
+	{
+		// The ring is full, so write it ourselves rather than holding the lines back
+		if (::write (ring_fd, ring_pending.data (), ring_pending.size ()) < 0)
+		{
+			printf ("%s: Logger unable to write to the log file.\n", line_prefix);
+		}
+		ring_pending.clear ();
+		return;
+	}
+	ring_writing = length;
+	ring_pending.erase (0, length);
+
+	// The owner submits when it next waits, anyone else has to submit now
+	if (!ring->isOwner ())
+	{
+		ring->submit (0, 0);
+	}
+}
+
+
+/**
+ * Handles the completion of a write to the log file, the rest of a short write goes again
+ */
+void Logger::ringWritten (int32_t result)
+{
+	lock (log_mutex);
+
+	if (result < 0)
+	{
+		printf ("%s: Logger unable to write to the log file, reason: %s\n", line_prefix, strerror(-result));
+		ring_writing = 0;
+	}
+	else if ((size_t)result < ring_writing)
+	{
+		char *buffer = ring->buffer (ring_buffer);
+		memmove (buffer, buffer + result, ring_writing - result);
+		ring_writing -= result;
+		if (!ring->write (ring_fd, ring_buffer, ring_writing, ring_user_data))
+		{
+			ring_pending.insert (0, buffer, ring_writing);
+			ring_writing = 0;
+		}
+		else if (!ring->isOwner ())
+		{
+			ring->submit (0, 0);
+		}
+	}
+	else
+	{
+		ring_writing = 0;
+	}
+	ringSubmit ();
+
+	release (log_mutex);
+}
+
+
+/**
+ * Returns true while a write to the log file is in flight
+ */
+bool Logger::ringBusy (void)
+{
+	lock (log_mutex);
+	bool busy = (ring_writing > 0);
+	release (log_mutex);
+
+	return busy;
+}
@@ -1,6 +1,9 @@
 #ifndef	_LOGGER_H
 #define _LOGGER_H
 
+#include <stdint.h>
+#include <pthread.h>
+
 #include <string>
 
 // Defines the max buffer size of the Logger
@@ -14,6 +17,7 @@
 
 // Define the Logger class
 class Logger;
+class IOURing;
 
 // Build the Logger class Template
 class Logger
@@ -27,10 +31,18 @@ private:
 	std::string last_log_line;
 	uint32_t last_log_count;
 	pthread_mutex_t log_mutex;
+	IOURing *ring;					// Set while the log file is appended to through a ring, kept open until then
+	int ring_fd;
+	unsigned ring_buffer;
+	uint64_t ring_user_data;
+	std::string ring_pending;		// Lines waiting for the write in flight to finish
+	size_t ring_writing;			// Bytes in the write in flight, 0 when there isn't one
 
 	// Private methods
 	int initLogFile (void);
 	void closeLogFile (void);
+	void writeLogFile (const std::string &text);
+	void ringSubmit (void);
 
 public:
 	// Constructors and destructor
@@ -48,6 +60,9 @@ public:
 	void debugf (uint8_t debug_level, const char *format, ...);
 	void debug (uint8_t debug_level, const char *line);
 	void debugx (uint8_t debug_level, unsigned char hex, bool end_line);
+	bool useRing (IOURing *new_ring, unsigned buffer_index, uint64_t user_data);
+	void ringWritten (int32_t result);
+	bool ringBusy (void);
 };
 
 #endif
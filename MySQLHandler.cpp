@@ -50,11 +50,13 @@ void MySQLHandler::setLogger (Logger *new_logger)
 /**
  * Configures the MySQLHandler, and attempts to connect
  */
-int MySQLHandler::init (std::string _db_user, std::string _db_pass, std::string _db_name)
+int MySQLHandler::init (std::string _db_user, std::string _db_pass, std::string _db_name, std::string _db_host, unsigned int _db_port)
 {
 	db_user = _db_user;
 	db_pass = _db_pass;
 	db_name = _db_name;
+	db_host = _db_host;
+	db_port = _db_port;
 
 	logger->log (" MYSQL: Object initalised, attempting to connect.\n");
 
@@ -79,8 +81,14 @@ int MySQLHandler::mysqlConnect (void)
 		return -1;
 	}
 
+	// Don't let a dead server hang us, the query retry handles the reconnect
+	unsigned int timeout = MYSQL_TIMEOUT;
+	mysql_options (connection, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	mysql_options (connection, MYSQL_OPT_READ_TIMEOUT, &timeout);
+	mysql_options (connection, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+
 	// Attempts to connect to the database
-	connection = mysql_real_connect (connection, "localhost", db_user.c_str(), db_pass.c_str(), db_name.c_str(), 0, NULL, 0);
+	connection = mysql_real_connect (connection, db_host.c_str(), db_user.c_str(), db_pass.c_str(), db_name.c_str(), db_port, NULL, 0);
 	if (connection)
 	{
 		logger->log (" MYSQL: MySQL connection successful.\n");
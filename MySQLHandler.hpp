@@ -5,6 +5,10 @@
 #include <mysql/mysql.h>
 #include "Logger.hpp"
 
+// Defines how long, in seconds, a connect, read or write to the database may take before it's treated
+// as a lost connection, so a dead server can't hang the caller
+#define MYSQL_TIMEOUT	5
+
 // Global function prototypes
 int mysqlConnect (void);
 void mysqlDisconnect (void);
@@ -26,6 +30,8 @@ private:
 	std::string db_user = "root";
 	std::string db_pass = "root";
 	std::string db_name = "db";
+	std::string db_host = "localhost";
+	unsigned int db_port = 0;
 
 	// Private methods
 
@@ -36,7 +42,7 @@ public:
 
 	// Public methods
 	void setLogger (Logger *new_logger);
-	int init (std::string _db_user, std::string _db_pass, std::string _db_name);
+	int init (std::string _db_user, std::string _db_pass, std::string _db_name, std::string _db_host = "localhost", unsigned int _db_port = 0);
 	int mysqlConnect (void);
 	void mysqlDisconnect (void);
 	MYSQL_RES* mysqlQuery (const char *format, ...);
@@ -0,0 +1,307 @@
+#include <arpa/nameser.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+
+#include "Resolver.hpp"
+#include "SkidBot.hpp"
+#include "Logger.hpp"
+
+extern Logger *logger;
+
+
+/**
+ * Creates the resolver, wake is called from the worker whenever a lookup finishes
+ */
+Resolver::Resolver (void (*new_wake) (void))
+{
+	resolver_mutex = PTHREAD_MUTEX_INITIALIZER;
+	resolver_cond = PTHREAD_COND_INITIALIZER;
+	running = false;
+	started = false;
+	wake = new_wake;
+}
+
+
+/**
+ * Stops the worker and destroys the resolver
+ */
+Resolver::~Resolver ()
+{
+	stop ();
+}
+
+
+/**
+ * Starts the worker thread, returns 1 on success or -1 if the thread couldn't be created
+ */
+int Resolver::start (void)
+{
+	lock (resolver_mutex);
+	running = true;
+	release (resolver_mutex);
+
+	if (pthread_create (&thread, NULL, resolverThread, this) != 0)
+	{
+		logger->logf (" Resolver: I was unable to start my worker, reason: %s.\n", strerror(errno));
+		running = false;
+		return -1;
+	}
+	started = true;
+
+	return 1;
+}
+
+
+/**
+ * Stops the worker thread, a lookup that's already running is left to finish first
+ */
+void Resolver::stop (void)
+{
+	lock (resolver_mutex);
+	running = false;
+	pthread_cond_signal (&resolver_cond);
+	release (resolver_mutex);
+
+	if (started)
+	{
+		pthread_join (thread, NULL);
+		started = false;
+	}
+}
+
+
+/**
+ * Looks up the host without blocking. Returns RESOLVER_READY and fills in the addresses if they're
+ * cached, RESOLVER_PENDING if the worker is looking it up and wake will be called when it's done, or
+ * RESOLVER_FAILED and the getaddrinfo error if the last lookup failed, the next call tries again.
+ * Addresses that have expired are still handed out while they're refreshed, so a DNS outage doesn't
+ * stop us reconnecting to a server that's still there.
+ */
+int Resolver::lookup (const char *host, int port, std::vector<struct sockaddr_storage> *addresses, int *error)
+{
+	std::string key = std::string (host) + ":" + std::to_string (port);
+	int lookup_return;
+
+	lock (resolver_mutex);
+	resolver_entry &entry = cache[key];
+	if (entry.host.empty ())
+	{
+		entry.host = host;
+		entry.port = port;
+	}
+
+	if (entry.error != 0)
+	{
+		// Report the failure once, and forget it so the next call looks the host up again
+		*error = entry.error;
+		cache.erase (key);
+		lookup_return = RESOLVER_FAILED;
+	}
+	else if (!entry.addresses.empty ())
+	{
+		*addresses = entry.addresses;
+		if ((std::chrono::steady_clock::now () >= entry.expires) && (!entry.pending))
+		{
+			entry.pending = true;
+			requests.push_back (key);
+			pthread_cond_signal (&resolver_cond);
+		}
+		lookup_return = RESOLVER_READY;
+	}
+	else
+	{
+		if (!entry.pending)
+		{
+			entry.pending = true;
+			requests.push_back (key);
+			pthread_cond_signal (&resolver_cond);
+		}
+		lookup_return = RESOLVER_PENDING;
+	}
+	release (resolver_mutex);
+
+	return lookup_return;
+}
+
+
+/**
+ * The worker thread, waits for lookups to be requested and resolves them one at a time
+ */
+void *Resolver::resolverThread (void *resolver)
+{
+	Resolver *self = (Resolver *)resolver;
+
+	lock (self->resolver_mutex);
+	while (self->running)
+	{
+		if (self->requests.empty ())
+		{
+			pthread_cond_wait (&self->resolver_cond, &self->resolver_mutex);
+			continue;
+		}
+
+		std::string key = self->requests.front ();
+		self->requests.pop_front ();
+		release (self->resolver_mutex);
+
+		self->resolve (key);
+
+		lock (self->resolver_mutex);
+	}
+	release (self->resolver_mutex);
+
+	return NULL;
+}
+
+
+/**
+ * Looks up the cache entry's host with getaddrinfo and stores the result, IPv6 and IPv4 addresses
+ * are interleaved so a connection attempt on one family can race the other
+ */
+void Resolver::resolve (const std::string &key)
+{
+	std::vector<struct sockaddr_storage> addresses;
+	std::vector<struct sockaddr_storage> other;
+	struct addrinfo hints;
+	struct addrinfo *results;
+	struct addrinfo *result;
+	std::string host;
+	std::string port;
+	uint32_t ttl;
+	int gai_return;
+
+	lock (resolver_mutex);
+	host = cache[key].host;
+	port = std::to_string (cache[key].port);
+	release (resolver_mutex);
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	gai_return = getaddrinfo (host.c_str (), port.c_str (), &hints, &results);
+	if (gai_return == 0)
+	{
+		// getaddrinfo has already sorted them by preference, keep that order within each family
+		int first_family = results->ai_family;
+		for (result = results; result != NULL; result = result->ai_next)
+		{
+			struct sockaddr_storage address;
+			memset (&address, 0, sizeof (address));
+			memcpy (&address, result->ai_addr, std::min ((size_t)result->ai_addrlen, sizeof (address)));
+			if (result->ai_family == first_family)
+			{
+				addresses.push_back (address);
+			}
+			else
+			{
+				other.push_back (address);
+			}
+		}
+		freeaddrinfo (results);
+
+		for (size_t t = 0; t < other.size (); t++)
+		{
+			addresses.insert (addresses.begin () + std::min (addresses.size (), (t * 2) + 1), other[t]);
+		}
+	}
+	else
+	{
+		logger->logf (" Resolver: I was unable to find %s, reason: %s.\n", host.c_str (), gai_strerror (gai_return));
+	}
+
+	// Hand the addresses over straight away, with the default TTL until DNS tells us better
+	lock (resolver_mutex);
+	resolver_entry &entry = cache[key];
+	entry.pending = false;
+	if (gai_return == 0)
+	{
+		entry.addresses = addresses;
+		entry.expires = std::chrono::steady_clock::now () + std::chrono::seconds(RESOLVER_DEFAULT_TTL);
+		entry.error = 0;
+	}
+	else if (entry.addresses.empty ())
+	{
+		// Only report the failure if there's nothing older we can keep using
+		entry.error = gai_return;
+	}
+	release (resolver_mutex);
+
+	if (wake != NULL)
+	{
+		wake ();
+	}
+
+	if (gai_return == 0)
+	{
+		ttl = findTTL (host.c_str ());
+		logger->debugf (DEBUG_STANDARD, " Resolver: I found %zu addresses for %s, I'll keep them for %u seconds.\n", addresses.size (), host.c_str (), ttl);
+
+		lock (resolver_mutex);
+		cache[key].expires = std::chrono::steady_clock::now () + std::chrono::seconds(ttl);
+		release (resolver_mutex);
+	}
+}
+
+
+/**
+ * getaddrinfo doesn't tell us how long the addresses are good for, so ask DNS for the host's records
+ * and use the shortest TTL, if the host isn't in DNS (IE it's in /etc/hosts) the default is used
+ */
+uint32_t Resolver::findTTL (const char *host)
+{
+	unsigned char answer[NS_PACKETSZ * 4];
+	struct __res_state state;
+	uint32_t ttl = UINT32_MAX;
+	int answer_length;
+	int types[2] = {ns_t_a, ns_t_aaaa};
+	ns_msg message;
+	ns_rr record;
+	int t, r;
+
+	memset (&state, 0, sizeof (state));
+	if (res_ninit (&state) != 0)
+	{
+		return RESOLVER_DEFAULT_TTL;
+	}
+	state.retrans = 2;
+	state.retry = 1;
+
+	for (t = 0; t < 2; t++)
+	{
+		answer_length = res_nquery (&state, host, ns_c_in, types[t], answer, sizeof (answer));
+		if ((answer_length <= 0) || (ns_initparse (answer, answer_length, &message) < 0))
+		{
+			continue;
+		}
+
+		for (r = 0; r < ns_msg_count (message, ns_s_an); r++)
+		{
+			if (ns_parserr (&message, ns_s_an, r, &record) == 0)
+			{
+				ttl = std::min (ttl, (uint32_t)ns_rr_ttl (record));
+			}
+		}
+	}
+	res_nclose (&state);
+
+	if (ttl == UINT32_MAX)
+	{
+		return RESOLVER_DEFAULT_TTL;
+	}
+	return std::max ((uint32_t)RESOLVER_MIN_TTL, std::min (ttl, (uint32_t)RESOLVER_MAX_TTL));
+}
@@ -0,0 +1,73 @@
+#ifndef	_RESOLVER_H
+#define _RESOLVER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+
+// Defines how long addresses are cached for when the DNS record's TTL can't be found, and the
+// bounds any TTL is clamped to, in seconds
+#define RESOLVER_DEFAULT_TTL	300
+#define RESOLVER_MIN_TTL		30
+#define RESOLVER_MAX_TTL		3600
+
+// Lookup return defines
+#define RESOLVER_FAILED		-1
+#define RESOLVER_PENDING	0
+#define RESOLVER_READY		1
+
+// Holds a cached lookup, addresses are kept in the order they should be tried
+typedef struct resolver_entry
+{
+	std::string host;
+	int port = 0;
+	std::vector<struct sockaddr_storage> addresses;
+	std::chrono::steady_clock::time_point expires;
+	bool pending = false;		// Set while the worker is looking the host up
+	int error = 0;				// getaddrinfo's error from the last lookup, 0 if it worked
+} resolver_entry;
+
+// Define the Resolver class
+class Resolver;
+
+// Build the Resolver class template, looks hosts up with getaddrinfo on its own worker thread so the
+// caller never blocks, and caches the addresses for as long as the DNS record says they're good for.
+// The wake function is called from the worker whenever a lookup finishes.
+class Resolver
+{
+private:
+	// Private variables
+	pthread_t thread;
+	pthread_mutex_t resolver_mutex;
+	pthread_cond_t resolver_cond;
+	bool running;
+	bool started;
+	std::deque<std::string> requests;
+	std::unordered_map<std::string, resolver_entry> cache;
+	void (*wake) (void);
+
+	// Private methods
+	static void *resolverThread (void *resolver);
+	void resolve (const std::string &key);
+	uint32_t findTTL (const char *host);
+
+public:
+	// Constructors and destructor
+	Resolver (void (*new_wake) (void));
+	~Resolver ();
+	Resolver (const Resolver &) = delete;
+	Resolver &operator= (const Resolver &) = delete;
+
+	// Public methods
+	int start (void);
+	void stop (void);
+	int lookup (const char *host, int port, std::vector<struct sockaddr_storage> *addresses, int *error);
+};
+
+#endif
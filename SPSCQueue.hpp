@@ -0,0 +1,108 @@
+#ifndef	_SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+// Keeps the producer and consumer indexes on their own cache lines so they don't bounce between cores
+#define CACHE_LINE_SIZE	64
+
+// Define the SPSCQueue class
+template <typename T> class SPSCQueue;
+
+// Build the SPSCQueue class template, a bounded lock-free ring for handing messages from exactly one
+// producer thread to exactly one consumer thread. Items can only be moved in and out of the slots.
+template <typename T> class SPSCQueue
+{
+private:
+	// Private variables, the consumer owns head and the producer owns tail
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+	size_t cached_tail;			// Consumers last view of tail, saves touching the producers cache line
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+	size_t cached_head;			// Producers last view of head, saves touching the consumers cache line
+	alignas(CACHE_LINE_SIZE) size_t mask;
+	std::unique_ptr<T[]> slots;
+
+public:
+	// Constructors and destructor, the capacity is rounded up to a power of two
+	SPSCQueue (size_t new_capacity)
+	{
+		size_t capacity = 1;
+		while (capacity < new_capacity)
+		{
+			capacity <<= 1;
+		}
+
+		head.store (0, std::memory_order_relaxed);
+		tail.store (0, std::memory_order_relaxed);
+		cached_head = 0;
+		cached_tail = 0;
+		mask = capacity - 1;
+		slots.reset (new T[capacity]);
+	}
+	SPSCQueue (const SPSCQueue &) = delete;
+	SPSCQueue &operator= (const SPSCQueue &) = delete;
+
+	/**
+	 * Moves an item in to the queue, returns false if the queue is full, only call from the producer
+	 */
+	bool push (T &&item)
+	{
+		size_t current_tail = tail.load (std::memory_order_relaxed);
+		if (current_tail - cached_head > mask)
+		{
+			cached_head = head.load (std::memory_order_acquire);
+			if (current_tail - cached_head > mask)
+			{
+				return false;
+			}
+		}
+
+		slots[current_tail & mask] = std::move (item);
+		tail.store (current_tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Moves the oldest item out of the queue, returns false if the queue is empty, only call from the consumer
+	 */
+	bool pop (T *item)
+	{
+		size_t current_head = head.load (std::memory_order_relaxed);
+		if (current_head == cached_tail)
+		{
+			cached_tail = tail.load (std::memory_order_acquire);
+			if (current_head == cached_tail)
+			{
+				return false;
+			}
+		}
+
+		*item = std::move (slots[current_head & mask]);
+		head.store (current_head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Returns how many items are waiting in the queue, safe to call from any thread
+	 */
+	size_t size (void)
+	{
+		size_t current_head = head.load (std::memory_order_acquire);
+		size_t current_tail = tail.load (std::memory_order_acquire);
+		return (current_tail >= current_head) ? (current_tail - current_head) : 0;
+	}
+
+	/**
+	 * Returns how many items the queue can hold
+	 */
+	size_t capacity (void)
+	{
+		return mask + 1;
+	}
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <string_view>
+#include <vector>
+
+#include "SeenUsers.hpp"
+
+// Marks keys made from a name, so they can't clash with a twitch user id
+#define SEEN_USERS_NAMED	0x8000000000000000ULL
+
+
+/**
+ * Creates an empty set, users are forgotten after new_expiry seconds without chatting, or never if it's 0
+ */
+SeenUsers::SeenUsers (uint32_t new_expiry)
+{
+	slots.resize (SEEN_USERS_SLOTS);
+	count = 0;
+	mask = SEEN_USERS_SLOTS - 1;
+	expiry = new_expiry;
+	start = std::chrono::high_resolution_clock::now ();
+}
+
+
+/**
+ * Returns the key for a user, their user-id tag when twitch sent one, otherwise a hash of their name
+ */
+uint64_t SeenUsers::userKey (std::string_view user_id, std::string_view nick)
+{
+	uint64_t key = 0;
+
+	if ((!user_id.empty ()) && (user_id.size () <= 18) && (user_id.find_first_not_of ("0123456789") == std::string_view::npos))
+	{
+		for (char digit : user_id)
+		{
+			key = (key * 10) + (digit - '0');
+		}
+	}
+	else
+	{
+		// FNV-1a
+		key = 0xcbf29ce484222325ULL;
+		for (char letter : nick)
+		{
+			key = (key ^ (uint8_t)letter) * 0x100000001b3ULL;
+		}
+		key |= SEEN_USERS_NAMED;
+	}
+
+	return (key == 0) ? 1 : key;
+}
+
+
+/**
+ * Changes how long until users are forgotten, users already seen are kept to the new expiry
+ */
+void SeenUsers::setExpiry (uint32_t new_expiry)
+{
+	expiry = new_expiry;
+}
+
+
+/**
+ * Returns true if the user has chatted, and hasn't been forgotten since
+ */
+bool SeenUsers::contains (uint64_t user, std::chrono::high_resolution_clock::time_point now)
+{
+	size_t index = find (user);
+
+	if (index == SIZE_MAX)
+	{
+		return false;
+	}
+	if (expired (&slots[index], seconds (now)))
+	{
+		erase (index);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Adds a user or notes that they've chatted again, returns true if they're new or had been forgotten
+ */
+bool SeenUsers::insert (uint64_t user, std::chrono::high_resolution_clock::time_point now)
+{
+	uint32_t now_seconds = seconds (now);
+	size_t index = find (user);
+
+	if (index != SIZE_MAX)
+	{
+		bool forgotten = expired (&slots[index], now_seconds);
+		slots[index].seen = now_seconds;
+		return forgotten;
+	}
+
+	// Grows before it gets too full to find things quickly, forgetting expired users as it goes
+	if (((count + 1) * 10) > (slots.size () * SEEN_USERS_LOAD))
+	{
+		rehash (slots.size () * 2, now_seconds);
+	}
+
+	index = home (user);
+	while (slots[index].user != 0)
+	{
+		index = (index + 1) & mask;
+	}
+	slots[index].user = user;
+	slots[index].seen = now_seconds;
+	count++;
+
+	return true;
+}
+
+
+/**
+ * Forgets everyone and gives back the memory
+ */
+void SeenUsers::clear (void)
+{
+	std::vector<seen_slot> (SEEN_USERS_SLOTS).swap (slots);
+	count = 0;
+	mask = SEEN_USERS_SLOTS - 1;
+}
+
+
+/**
+ * Returns how many users are held, some may have expired and not been found since
+ */
+size_t SeenUsers::size (void)
+{
+	return count;
+}
+
+
+/**
+ * Returns how many slots there are
+ */
+size_t SeenUsers::capacity (void)
+{
+	return slots.size ();
+}
+
+
+/**
+ * Returns how many bytes the set is using
+ */
+size_t SeenUsers::memoryUsed (void)
+{
+	return sizeof (SeenUsers) + (slots.capacity () * sizeof (seen_slot));
+}
+
+
+/**
+ * Returns the seconds since the set was created
+ */
+uint32_t SeenUsers::seconds (std::chrono::high_resolution_clock::time_point now)
+{
+	return (now > start) ? (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(now - start).count () : 0;
+}
+
+
+/**
+ * Returns true if the user in the slot hasn't chatted for longer than the expiry
+ */
+bool SeenUsers::expired (const seen_slot *slot, uint32_t now)
+{
+	return ((expiry > 0) && (now > slot->seen) && ((now - slot->seen) > expiry));
+}
+
+
+/**
+ * Returns the slot a user would be in if nothing else was there, user ids are mostly in order so
+ * they're mixed first to spread them out
+ */
+size_t SeenUsers::home (uint64_t user)
+{
+	user ^= user >> 33;
+	user *= 0xff51afd7ed558ccdULL;
+	user ^= user >> 33;
+	return (size_t)user & mask;
+}
+
+
+/**
+ * Returns the slot a user is in, or SIZE_MAX if they aren't
+ */
+size_t SeenUsers::find (uint64_t user)
+{
+	size_t index = home (user);
+
+	while (slots[index].user != 0)
+	{
+		if (slots[index].user == user)
+		{
+			return index;
+		}
+		index = (index + 1) & mask;
+	}
+
+	return SIZE_MAX;
+}
+
+
+/**
+ * Empties a slot, moving back any users after it that would no longer be found past the gap
+ */
+void SeenUsers::erase (size_t index)
+{
+	size_t hole = index;
+	size_t next = (index + 1) & mask;
+
+	while (slots[next].user != 0)
+	{
+		// The user can fill the hole if it's no closer to where they'd be than where they are now
+		size_t wanted = home (slots[next].user);
+		if (((next - wanted) & mask) >= ((next - hole) & mask))
+		{
+			slots[hole] = slots[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	slots[hole] = seen_slot ();
+	count--;
+}
+
+
+/**
+ * Moves every user that hasn't expired in to a new set of slots, if enough have expired the set stays
+ * the same size, or even shrinks
+ */
+void SeenUsers::rehash (size_t new_capacity, uint32_t now)
+{
+	std::vector<seen_slot> old_slots;
+	size_t live = 0;
+
+	for (const seen_slot &slot : slots)
+	{
+		live += ((slot.user != 0) && (!expired (&slot, now)));
+	}
+	// Halves the size while those left would fill less than half of what's allowed
+	while ((new_capacity > SEEN_USERS_SLOTS) && (((live + 1) * 20) <= ((new_capacity / 2) * SEEN_USERS_LOAD)))
+	{
+		new_capacity /= 2;
+	}
+
+	old_slots.swap (slots);
+	slots.resize (new_capacity);
+	mask = new_capacity - 1;
+	count = 0;
+
+	for (const seen_slot &slot : old_slots)
+	{
+		if ((slot.user == 0) || (expired (&slot, now)))
+		{
+			continue;
+		}
+
+		size_t index = home (slot.user);
+		while (slots[index].user != 0)
+		{
+			index = (index + 1) & mask;
+		}
+		slots[index] = slot;
+		count++;
+	}
+}
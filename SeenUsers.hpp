@@ -0,0 +1,60 @@
+#ifndef	_SEEN_USERS_H
+#define _SEEN_USERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <string_view>
+#include <vector>
+
+// Defines how many slots a set starts with, and how full it may get, in tenths, before it grows
+#define SEEN_USERS_SLOTS	64
+#define SEEN_USERS_LOAD		7
+
+// Define the SeenUsers class
+class SeenUsers;
+
+// Build the SeenUsers class template, an open addressing hash set of the users seen chatting in a room.
+// Users are kept as a 64 bit key, their twitch user id when we have it or a hash of their name when we
+// don't, so finding or adding one costs the same however many there are. With an expiry, users that
+// haven't chatted for that long are forgotten, as they're found or when the set grows.
+class SeenUsers
+{
+private:
+	// Private variables
+	typedef struct seen_slot
+	{
+		uint64_t user = 0;					// 0 when the slot is empty
+		uint32_t seen = 0;					// Seconds from the set's start that the user last chatted
+	} seen_slot;
+	std::vector<seen_slot> slots;
+	size_t count;
+	size_t mask;
+	uint32_t expiry;						// Seconds until a user is forgotten, 0 to never forget them
+	std::chrono::high_resolution_clock::time_point start;
+
+	// Private methods
+	uint32_t seconds (std::chrono::high_resolution_clock::time_point now);
+	bool expired (const seen_slot *slot, uint32_t now);
+	size_t home (uint64_t user);
+	size_t find (uint64_t user);
+	void erase (size_t index);
+	void rehash (size_t new_capacity, uint32_t now);
+
+public:
+	// Constructors and destructor
+	SeenUsers (uint32_t new_expiry = 0);
+
+	// Public methods
+	static uint64_t userKey (std::string_view user_id, std::string_view nick);
+	void setExpiry (uint32_t new_expiry);
+	bool contains (uint64_t user, std::chrono::high_resolution_clock::time_point now);
+	bool insert (uint64_t user, std::chrono::high_resolution_clock::time_point now);
+	void clear (void);
+	size_t size (void);
+	size_t capacity (void);
+	size_t memoryUsed (void);
+};
+
+#endif
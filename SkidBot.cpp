@@ -1,4 +1,4 @@
-// g++ -std=c++11 -Wall *.cpp -lrt -lpthread -lboost_regex -lmysqlclient -lcurl -o SkidBot
+// g++ -std=c++20 -Wall *.cpp -lrt -lpthread -lboost_regex -lmysqlclient -lcurl -lssl -lcrypto -lresolv -o SkidBot
 // Could use libjson0-dev to parse the json
 
 #include <fcntl.h>
@@ -21,60 +21,96 @@
 #include <iostream>
 #include <fstream>
 #include <locale>
+#include <thread>
+#include <algorithm>
 
 #include "SkidBot.hpp"
 #include "Logger.hpp"
 #include "MySQLHandler.hpp"
+#include "SPSCQueue.hpp"
+#include "IRCMessage.hpp"
 #include "IRCThread.hpp"
 #include "TwitchAPIThread.hpp"
+#include "CommandRegistry.hpp"
+#include "Dispatcher.hpp"
+#include "AsyncTask.hpp"
+#include "TimerService.hpp"
 
 #define VERSION "0.31"
 
 // Local function prototypes
 void readConfig (void);
+void handleLine (uint8_t worker, irc_line *received);
+void startWorker (uint8_t worker, uint8_t workers);
+void postNoSpoilers (room_state *state);
 std::string trim (std::string _str);
 std::string parseDouble (double _value);
 double rollQuerySplitSubAdd (std::string _query, std::string *_roll_text);
 double rollQuerySplitMulDiv (std::string _query, std::string *_roll_text);
 double rollQueryParse (std::string _query, std::string *_roll_text);
 void signalHandler (int signum);
+void registerCommands (void);
+void commandRespond (const command_context *context);
+void commandLeave (const command_context *context);
+void commandPanic (const command_context *context);
+void commandLatency (const command_context *context);
+void commandSpoilersStart (const command_context *context);
+void commandSpoilersStop (const command_context *context);
+void commandSetGameMaster (const command_context *context);
+void commandWhoGameMaster (const command_context *context);
+void commandPraise (const command_context *context);
+void commandSeenUsers (const command_context *context);
+void commandRoll (const command_context *context);
+void commandGameMasterRoll (const command_context *context);
+AsyncTask commandQuote (command_call call);
+void rollDice (const command_context *context, bool gm_roll);
 
 // Global Varible
 uint8_t debug_level = DEBUG_NONE;
 Logger *logger;
 MySQLHandler *mysql;
+CommandRegistry *commands;
 volatile sig_atomic_t closing_process = 0;
 volatile sig_atomic_t close_reason = 0;
 pthread_t irc_thread;
-pthread_t girc_thread;
 pthread_t tapi_thread;
-extern uint8_t irc_task;
-extern bool irc_running;
-extern pthread_mutex_t irc_mutex;
+extern irc_connection irc_connections[IRC_MAX_CONNECTIONS];
 extern bool tapi_running;
 extern pthread_mutex_t tapi_mutex;
 extern std::string bot_user;
 extern std::string bot_oauth;
 extern std::string default_room;
+extern std::vector<std::string> irc_rooms;
+extern uint8_t irc_shards;
+extern bool irc_tls;
+extern bool irc_takeover;
+extern bool irc_standby;
+extern bool irc_uring;
+extern std::string irc_host;
+extern int irc_port;
+extern uint16_t irc_probe_interval;
+extern uint8_t irc_probe_misses;
+extern uint16_t irc_pack_milli;
+extern std::string irc_pack_separator;
 
 // Data stores
-std::vector<std::string> users_chatted;		// Holds a list of users that have chatted in the stream
+std::vector<room_state> room_states;		// Holds each room's state by room id, the last is for lines that aren't in a room
+int chat_workers = 0;						// How many workers handle chat, 0 picks from the cores and rooms
+int async_threads = ASYNC_THREADS;			// How many threads run the database and api calls commands wait on
+std::string quotes_table = "";				// The MySQL table !quote picks from, empty when there isn't one
+uint32_t seen_expiry = 0;					// Seconds before a quiet user is treated as new again, 0 to never
+uint16_t room_cooldown = 0;					// Seconds after a command with a cooldown before any other may reply in a room
+std::vector<announcement> announcements;	// Messages posted to rooms on a timer
 
-std::chrono::high_resolution_clock::time_point current_time;
-std::chrono::high_resolution_clock::time_point anti_spam;
-std::chrono::high_resolution_clock::time_point no_spoilers;
-bool no_spoilers_running = false;
-
-extern std::deque<std::string> irc_recv_buffer;
-extern std::deque<std::string> girc_recv_buffer;
+extern SPSCQueue<irc_line> irc_recv_buffer;
+extern SPSCQueue<irc_line> girc_recv_buffer;
 
 // API external variables
 extern std::string current_title;
 extern std::string current_game;
 
 // Random variables
-std::random_device dice;
-std::string game_master = "skidinc";
+thread_local std::random_device dice;
 
 int main(int argc, char **argv)
 {
@@ -122,529 +158,82 @@ int main(int argc, char **argv)
 				logger->log (": Why did you set the debug flag without the debug value?.\n");
 			}
 		}
+		else if (strcmp(argv[arg_count], "-r") == 0)
+		{
+			// Restarting, so the running process hands its connections to us instead of us making new ones
+			irc_takeover = true;
+			logger->log (": I'm going to take over the connections of the running process.\n");
+		}
 	}
 
 	// Starts the MySQL Handler
 	mysql = new MySQLHandler (logger);
 
+	// Sets up the commands I know, the config and MySQL can add more
+	commands = new CommandRegistry (logger);
+	registerCommands ();
+
 	// Create configuration file
 	readConfig ();
 
-	// Creates the irc thread
+	// Creates the irc thread, which handles the groups connection and every chat connection
 	logger->log (": I'm starting my IRC thread so I can connect to Twitch.\n");
+	if (setupIRCConnections () < 0)
+	{
+		logger->log (": I was unable to set up my IRC connections, so I'm powering down.\n");
+		delete commands;
+		delete mysql;
+		delete logger;
+		return 1;
+	}
 	pthread_create (&irc_thread, NULL, IRCThread, NULL);
-	sleep (2);
-
-	// Creates the groups irc thread
-	logger->log (": I'm starting my groups IRC thread so I can connect to Twitch.\n");
-	pthread_create (&girc_thread, NULL, GIRCThread, NULL);
-	sleep (2);
 
 	// Creates the twitch api thread
 	//logger->log (": I'm starting my Twitch API thread so I can monitor the channel.\n");
 	//pthread_create (&tapi_thread, NULL, TwitchAPIThread, NULL);
 	//sleep (1);
 
-	current_time = hrc_now;
-	anti_spam = current_time;
-	no_spoilers_running = false;
-
-	while (closing_process != 1)
+	// Every room keeps its own state, on the worker it's hashed to, the last is for lines that aren't in a room
+	room_states.resize (irc_rooms.size () + 1);
+	for (size_t t = 0; t < room_states.size (); t++)
 	{
-		if (irc_task == IRC_RUNNING)
-		{
-			while (irc_recv_buffer.size() > 0)
-			{
-				std::string message;
-				std::string chat;
-				std::string user;
-				std::string room;
-				size_t cmd_location;
-				size_t user_location;
-				size_t data_location;
-
-				current_time = hrc_now;
-				message = irc_recv_buffer.front();
-				irc_recv_buffer.pop_front();
-
-				// Otherwise looks for chat messages
-				cmd_location = message.find ("PRIVMSG");
-				if (cmd_location != std::string::npos)
-				{
-					// Try to get the user
-					user_location = message.find ("!");
-					if (user_location != std::string::npos)
-					{
-						user = message.substr(1, user_location - 1);
-					}
-					else
-					{
-						user = "Unknown";
-					}
-
-
-					// Try to get the message only
-					data_location = message.find (":", cmd_location);
-					if (data_location != std::string::npos)
-					{
-						// Get the room the message was in
-						room = message.substr(cmd_location + 8, data_location - cmd_location - 9);
-
-						if (message.substr(data_location + 1, 7).compare("\001ACTION") == 0)
-						{
-							chat = message.substr(data_location + 9);
-							logger->logf (": I found a user action in room: %s, user: %s, action: %s\n", room.c_str(), user.c_str(), chat.c_str());
-
-							// Checks if this user has posted before
-							bool user_chatted = std::binary_search(users_chatted.begin(), users_chatted.end(), user);
-
-							if ((!user_chatted) && (boost::regex_search (chat.c_str(), boost::regex("[^\\s.]\\.[^\\s.]{2,}"))))
-							{
-								logger->logf (": Someone posted a link without having spoken in chat first, spam protection active.\n");
-								std::string temp = "/timeout ";
-								temp.append (user.c_str());
-								temp.append (" 60");
-								send_room (room, temp);
-								send_room (room, "My master doesn't like spambots, he says spambots are bad.");
-							}
-							else
-							{
-								// If the user hasn't chatted before, add them to the list
-								if (!user_chatted)
-								{
-									logger->logf (": %s posted their first message without a link, adding them to the list.\n", user.c_str());
-									users_chatted.push_back (user);
-									std::sort (users_chatted.begin(), users_chatted.end());
-								}
-							}
-						}
-						else
-						{
-							chat = message.substr(data_location + 1);
-							logger->debugf (DEBUG_MINIMAL, ": I found a chat message in room: %s, user: %s, message: %s\n", room.c_str(), user.c_str(), chat.c_str());
-
-							// Checks if this user has posted before
-							bool user_chatted = std::binary_search(users_chatted.begin(), users_chatted.end(), user);
-
-							if ((!user_chatted) && (boost::regex_search (chat.c_str(), boost::regex("[^\\s.]\\.[^\\s.]{2,}"))))
-							{
-								logger->logf (": Someone posted a link without having spoken in chat first, spam protection active.\n");
-								std::string temp = "/timeout ";
-								temp.append (user.c_str());
-								temp.append (" 60");
-								send_room (room, temp);
-								send_room (room, "My master doesn't like spambots, he says spambots are bad.");
-							}
-							else
-							{
-								// Check to see if SkidBot was directly addressed
-								if (boost::iequals(chat.substr(0, 9), "SkidBot, "))
-								{
-									// Split the message apart
-									std::string chat_remainder = chat.substr (9);
-									std::vector<std::string> words;
-									std::istringstream iss (chat_remainder);
-
-									for (std::string token; std::getline(iss, token, ' ');)
-									{
-										words.push_back (std::move(token));
-									}
-
-									// If there are other words, try and work out the requested command
-									if (words.size() > 0)
-									{
-										// Check any for any fixed commands
-										if ((user.compare("skidinc") == 0) && (boost::iequals(words[0], "respond")))
-										{
-											logger->log (": Responding to my master. :)\n");
-											send_room (room, "Yes Master? :)");
-										}
-										else if ((user.compare("skidinc") == 0) && (boost::iequals(chat_remainder, "please leave")))
-										{
-											logger->log (": Leaving by my masters request. :(\n");
-											send_room (room, "OK, I'm going now, bye bye. :(");
-											send_command ("PART", room);
-										}
-										else if ((user.compare("skidinc") == 0) && (boost::iequals(words[0], "panic")))
-										{
-											logger->log (": Something has gone wrong, sending SIGTERM to my own process. :S\n");
-											send_room (room, "Something has gone wrong, sending SIGTERM to my own process. panicBasket");
-											raise (SIGTERM);
-										}
-										else if (boost::iequals(chat_remainder, "PC Specs"))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving my masters PC Specs to %s. :)\n", user.c_str());
-												send_room (room, "You can find my masters PC specs on his You Tube channels about page, found here: http://www.youtube.com/c/SkidIncGaming/about :)");
-												anti_spam = current_time;
-											}
-										}
-										else if ((boost::iequals(words[0], "YouTube")) || (boost::iequals(chat_remainder, "You Tube")))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving my masters You Tube channel to %s. :)\n", user.c_str());
-												send_room (room, "You can find my masters You Tube channel here: http://www.youtube.com/c/SkidIncGaming :)");
-												anti_spam = current_time;
-											}
-										}
-										else if (boost::iequals(chat, "Twitter"))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving my masters twitter username to %s. :)\n", user.c_str());
-												send_room (room, "You can find my masters Twitter here: http://twitter.com/nskid11 :)");
-												anti_spam = current_time;
-											}
-										}
-										else if ((boost::iequals(words[0], "surround")) || (boost::iequals(words[0], "eyefinity")) || (boost::iequals(words[0], "multi-monitor")) || (boost::iequals(words[0], "resolution")))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving information on multi-monitor stream to %s. :)\n", user.c_str());
-												send_room (room, "My masters is streaming at a triple-monitor resolution, twitch's layout isn't so great for this, so my master made this one that should display the stream better: http://www.skid-inc.net/eyestream.php :)");
-												anti_spam = current_time;
-											}
-										}
-										else if ((boost::iequals(words[0], "music")) || (boost::iequals(words[0], "song")))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving information on the music being played to %s. :)\n", user.c_str());
-												send_room (room, "The music my master is playing will ether be from OC Remix, http://ocremix.org/, Rainwave, http://ocr.rainwave.cc/, or Miracle of Sound, http://miracleofsound.bandcamp.com/ :)");
-												anti_spam = current_time;
-											}
-										}
-										else if ((boost::iequals(words[0], "rules")) || (boost::iequals(chat_remainder, "channel rules")))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving the channels rules to %s. :)\n", user.c_str());
-												send_room (room, "The rules for my masters channels are as follows, [1] Always be respectful to other people. [2] Be respectful to other peoples opinions, just because someone else's opinion doesn't match your own, does not invalidate ether. [3] Please avoid spoilers. [4] I like to work things out myself, so if I miss something or don't say \"Hey, Chat, what does....\" then please don't tell me. [5] Don't spam, this includes emote spam.");
-												anti_spam = current_time;
-											}
-										}
-										else if ((boost::iequals(words[0], "bsg")) || (boost::iequals(chat_remainder, "back seat gaming")) || (boost::iequals(chat_remainder, "back seat gamer")))
-										{
-											if ((current_time - anti_spam) > std::chrono::seconds(10))
-											{
-												logger->logf (": Giving back seat gaming information to %s. :)\n", user.c_str());
-												send_room (room, "Please don't back seat game my master, he likes to play games how he likes to, regardless if that is optimal or not, he also likes to learn or work things out himself. So telling him what to do, or how to play, where things are, etc, will likely get you ignored or timed out or at worse banned. The exception to this rule is if he asks something directly of chat like, \"Chat, do you know how unlock this item?\". :)");
-												anti_spam = current_time;
-											}
-										}
-
-
-										// Fixed commands for rocksmith
-										if (boost::iequals(current_game, "Rocksmith 2014"))
-										{
-											// Lets the users request my masters track list
-											if ((boost::iequals(words[0], "tracks")) || (boost::iequals(chat_remainder, "track list")) || (boost::iequals(words[0], "Rocksmith")))
-											{
-												if ((current_time - anti_spam) > std::chrono::seconds(10))
-												{
-													logger->logf (": Giving link to my masters Rocksmith track list to %s. :)\n", user.c_str());
-													send_room (room, "A full list of my masters Rocksmith songs can be found here, bear in mind favorated songs are first. http://www.skid-inc.net/rocksmith_tracks.php :)");
-													anti_spam = current_time;
-												}
-											}
-										}
-
-										// Spoiler note
-										if ((user.compare("skidinc") == 0) && (boost::iequals(chat_remainder, "no spoilers start")))
-										{
-											logger->logf (": Starting to post no spoiler messages. :)\n");
-											send_room (room, "Acknowledged, starting to post no spoiler messages every 5 minutes. :)");
-											no_spoilers_running = true;
-										}
-										if ((user.compare("skidinc") == 0) && (boost::iequals(chat_remainder, "no spoilers stop")))
-										{
-											logger->logf (": I will no longer post no spoiler messages. :)\n");
-											send_room (room, "Acknowledged, I will no longer post no spoiler messages. :)");
-											no_spoilers_running = false;
-										}
-
-										// Change the game master
-										if ((user.compare("skidinc") == 0) && ((boost::iequals(words[0], "change")) || (boost::iequals(words[0], "set"))) && ((boost::iequals(words[1], "gm")) || (boost::iequals(words[1], "dm"))))
-										{
-											uint8_t target_word = 2;
-											if (boost::iequals(words[2], "to"))
-											{
-												target_word = 3;
-											}
-											logger->logf (": I will change the assigned game master to %s.\n", words[target_word].c_str());
-											game_master = words[target_word];
-											std::string message = "Acknowledged, I will change the assigned game master to ";
-											message += words[target_word];
-											message += ". :)";
-											send_room (room, message);
-										}
-										else if ((user.compare("skidinc") == 0) && (boost::iequals(words[0], "who")) && ((boost::iequals(words.back(), "gm")) || (boost::iequals(words.back(), "dm"))))
-										{
-											logger->logf (": Reporting that the current game master is %s.\n", game_master.c_str());
-											std::string message = "The currently assigned game master is ";
-											message += game_master;
-											message += ". :)";
-											send_room (room, message);
-										}
-									}
-								}
-								else if ((user.compare("skidinc") == 0) && (boost::iequals(chat, "Good SkidBot")))
-								{
-									logger->log (": My master praised me ^_^.\n");
-									send_room (room, "^_^");
-								}
-
-								// Check to see if this is a dice roll
-								else if ((boost::iequals(chat.substr(0, 6), "!roll ")) || (boost::iequals(chat.substr(0, 3), "!r ")) || (boost::iequals(chat.substr(0, 8), "!gmroll ")) || (boost::iequals(chat.substr(0, 5), "!gmr ")))
-								{
-									// Pull the roll query and set if this is a gm roll or not
-									std::string roll_query;
-									bool is_gm_roll = false;
-									if (boost::iequals(chat.substr(0, 6), "!roll "))
-									{
-										roll_query = chat.substr(6);
-										logger->debugf (DEBUG_MINIMAL, ": Someone is rolling %s\n", roll_query.c_str());
-									}
-									else if (boost::iequals(chat.substr(0, 3), "!r "))
-									{
-										roll_query = chat.substr(3);
-										logger->debugf (DEBUG_MINIMAL, ": Someone is rolling %s\n", roll_query.c_str());
-									}
-									else if (boost::iequals(chat.substr(0, 8), "!gmroll "))
-									{
-										roll_query = chat.substr(8);
-										is_gm_roll = true;
-										logger->debugf (DEBUG_MINIMAL, ": Someone is gm rolling %s\n", roll_query.c_str());
-									}
-									else if (boost::iequals(chat.substr(0, 5), "!gmr "))
-									{
-										roll_query = chat.substr(5);
-										is_gm_roll = true;
-										logger->debugf (DEBUG_MINIMAL, ": Someone is gm rolling %s\n", roll_query.c_str());
-									}
-
-									// Prepare the variables used to process the roll
-									std::string roll_text;
-									double roll_result;
-									std::string roll_reason = "some dice";
-
-									// See if there is a reason for the roll
-									std::size_t last_add = roll_query.find_last_of ('+');
-									std::size_t last_sub = roll_query.find_last_of ('-');
-									std::size_t last_mul = roll_query.find_last_of ('*');
-									std::size_t last_div = roll_query.find_last_of ('/');
-									std::size_t first_space = roll_query.find (' ');
-									if ((last_add == std::string::npos) && (last_sub == std::string::npos) && (last_mul == std::string::npos) && (last_div == std::string::npos))
-									{
-										if (first_space != std::string::npos)
-										{
-											roll_reason = roll_query.substr (first_space + 1);
-											roll_query = roll_query.substr (0, roll_query.length() - roll_reason.length() - 1);
-										}
-									}
-									else
-									{
-										std::size_t highest_position = 0;
-										if ((last_add != std::string::npos) && (last_add > highest_position))
-										{
-											highest_position = last_add;
-										}
-										if ((last_sub != std::string::npos) && (last_sub > highest_position))
-										{
-											highest_position = last_sub;
-										}
-										if ((last_mul != std::string::npos) && (last_mul > highest_position))
-										{
-											highest_position = last_mul;
-										}
-										if ((last_div != std::string::npos) && (last_div > highest_position))
-										{
-											highest_position = last_div;
-										}
-
-										// Find the first space after the last opperator
-										first_space = roll_query.find (' ', highest_position + 2);
-										if (first_space != std::string::npos)
-										{
-											roll_reason = roll_query.substr (first_space + 1);
-											roll_query = roll_query.substr (0, roll_query.length() - roll_reason.length() - 1);
-										}
-									}
-
-									// Parse the query
-									roll_result = rollQuerySplitSubAdd (roll_query, &roll_text);
-
-
-									// Send the results of the roll
-									if (!is_gm_roll)
-									{
-										std::string temp;
-										temp += user;
-										temp += " just rolled ";
-										temp += roll_reason;
-										temp += ": ";
-										temp += roll_text;
-										temp += " = ";
-										temp += parseDouble(roll_result);
-										send_room (room, temp);
-									}
-									else
-									{
-										std::string temp = "/w ";
-										temp += game_master;
-										temp += " Game Master, ";
-										temp += user;
-										temp += " just rolled ";
-										temp += roll_reason;
-										temp += ": ";
-										temp += roll_text;
-										temp += " = ";
-										temp += parseDouble(roll_result);
-										gsend_room ("#jtv", temp);
-									}
-								}
-
-								// Commands used when streaming rocksmith
-								// Track list
-								// Requests enable / on
-								// Requests disable / off
-								// Requests add
-								// Requests pop
-								// Requests view
-								// Requests clear
-
-								// If the user hasn't chatted before, add them to the list
-								if (!user_chatted)
-								{
-									logger->logf (": %s posted their first message without a link, adding them to the list.\n", user.c_str());
-									users_chatted.push_back (user);
-									std::sort (users_chatted.begin(), users_chatted.end());
-								}
-							}
-						}
-					}
-				}
-				else
-				{
-					// Checks for a ping message
-					if ((message.length() > 4) && (message.substr(0, 4).compare("PING") == 0))
-					{
-						logger->debug (DEBUG_STANDARD, ": Playing ping pong with the servers.\n");
-						send_command ("PONG", message.substr(5));
-					}
-
-					// Check for user mode change message	// :jtv MODE #skidinc +o paulscelus
-					else if ((message.length() > 9) && (message.substr(5, 4).compare("MODE") == 0))
-					{
-						logger->debug (DEBUG_MINIMAL, ": I've found a MODE change for user.\n");
-					}
-
-					// Check for user list message			// :skidbot.tmi.twitch.tv 353 skidbot = #skidinc :arceusthepokemon wolf7th martinferrer ixtapa_ verenthes greenplane htbrdd ebula_viruss turkz813 jachunter guntherdw conjur0 dcirusc30 poewinter gone_nutty ptx3 loganfxcrafter strayparaSkidBot: I received: t = #zeekdageek :skidbot
-					else if ((message.length() > 37) && (message.substr(0, 37).compare(":skidbot.tmi.twitch.tv 353 skidbot = ") == 0))
-					{
-						logger->logf (": I've found the channels NAMES list.\n");
-
-						data_location = message.find (":", cmd_location);
-						if (data_location != std::string::npos)
-						{
-							// Get the room the message was in
-							room = message.substr(cmd_location + 8, data_location - cmd_location - 9);
-							chat = message.substr(data_location + 1);
-						}
-					}
-
-					// Check for join and part messages
-					else
-					{
-						// Check for user join message			// :skidinc!skidinc@skidinc.tmi.twitch.tv JOIN #skidinc
-						cmd_location = message.find ("JOIN");
-						if (cmd_location != std::string::npos)
-						{
-							// Try to get the user
-							user_location = message.find ("!");
-							if (user_location != std::string::npos)
-							{
-								user = message.substr(1, user_location - 1);
-							}
-							else
-							{
-								user = "Unknown";
-							}
-
-							logger->logf (": I've noticed a user join the chat, %s.\n", user.c_str());
-						}
-						else
-						{
-							// Check for user part message			// :skidinc!skidinc@skidinc.tmi.twitch.tv PART #skidinc
-							cmd_location = message.find ("PART");
-							if (cmd_location != std::string::npos)
-							{
-								// Try to get the user
-								user_location = message.find ("!");
-								if (user_location != std::string::npos)
-								{
-									user = message.substr(1, user_location - 1);
-								}
-								else
-								{
-									user = "Unknown";
-								}
-
-								logger->logf (": I've noticed a user part the chat, %s.\n", user.c_str());
-							}
-						}
-					}
-				}
-			}
+		room_states[t].name = (t < irc_rooms.size ()) ? irc_rooms[t] : "";
+		room_states[t].seen_users.setExpiry (seen_expiry);
+	}
 
+	// Starts the threads that run the database and api calls, so commands waiting on them don't hold up chat
+	setupAsyncTasks (async_threads);
 
-			// Handles any messages in the groups queue
-			while (girc_recv_buffer.size() > 0)
-			{
-				std::string message;
-				std::string chat;
-				std::string user;
-				std::string room;
-				size_t cmd_location;
-				//size_t user_location;
-				//size_t data_location;
-
-				current_time = hrc_now;
-				message = girc_recv_buffer.front();
-				girc_recv_buffer.pop_front();
-
-				// Otherwise looks for chat messages
-				cmd_location = message.find ("PRIVMSG");
-				if (cmd_location != std::string::npos)
-				{
-				}
-				else
-				{
-					// Checks for a ping message
-					if ((message.length() > 4) && (message.substr(0, 4).compare("PING") == 0))
-					{
-						logger->debug (DEBUG_STANDARD, ": Playing ping pong with the groups servers.\n");
-						gsend_command ("PONG", message.substr(5));
-					}
-				}
-			}
+	// Starts the workers that handle the chat, a busy room only holds up the rooms on its own worker
+	if (chat_workers == 0)
+	{
+		chat_workers = std::max (1, std::min ((int)std::thread::hardware_concurrency (), (int)irc_rooms.size ()));
+		chat_workers = std::min (chat_workers, DISPATCH_MAX_WORKERS);
+	}
+	if (setupDispatcher (chat_workers, handleLine, startWorker) < 0)
+	{
+		logger->log (": I was unable to start the workers to handle chat, so I'm powering down.\n");
+		closing_process = 1;
+	}
 
+	while ((closing_process != 1) && (!handingOverIRC ()))
+	{
+		// Hands the lines to the workers for their rooms, main only routes them now
+		irc_line received;
+		while (irc_recv_buffer.pop (&received))
+		{
+			dispatchLine (std::move (received));
+		}
 
-			// TODO: WORK OUT A BETTER WAY OF DOING THIS WITHOUT HARD CODING THE ROOM
-			if (no_spoilers_running)
-			{
-				if ((current_time - no_spoilers) > std::chrono::minutes(5))
-				{
-					logger->log (": Posting no spoilers message.\n");
-					send_room ("#skidinc", "My master would like to do his first run blind, so please no spoilers or hints etc, thank you :)");
-					no_spoilers = current_time;
-				}
-			}
+		// Handles any messages in the groups queue, the IRC thread already plays ping pong with the
+		// groups server, so there's nothing else to do with them yet but keep the queue empty
+		while (girc_recv_buffer.pop (&received))
+		{
 		}
 
-		usleep (1000);
+		// Sleep until the reactor has lines for us, or a worker whose queue was too full to take them all has made room
+		dispatchFlush ();
+		waitIRCLines (-1);
 	}
 
 	// Find out why we are closing
@@ -674,30 +263,236 @@ int main(int argc, char **argv)
 		break;
 	}
 
-	// Close all the other threads
-	irc_running = false;
+	if (handingOverIRC ())
+	{
+		logger->log (": A new process is taking over from me, so I'm handing my connections over.\n");
+	}
+
+	// Let the workers finish the lines they were given, they may still be replying, then close the other threads
+	stopDispatcher ();
+	stopAsyncTasks ();
+	stopIRCThread ();
 	logger->log (": I'm waiting for the irc thread to end.\n");
 	pthread_join (irc_thread, NULL);
-	logger->log (": I'm waiting for the groups irc thread to end.\n");
-	pthread_join (girc_thread, NULL);
 
-	//lock (tapi_mutex);
-	//tapi_running = false;
-	//release (tapi_mutex);
+	// Gives the new process the connections the irc thread left open for it
+	handOverIRCConnections ();
+
+	//stopTwitchAPIThread ();
 	//logger->log (": I'm waiting for the Twitch api thread to end.\n");
 	//pthread_join (tapi_thread, NULL);
 
 	// Clear any vectors or dynamic arrays
-	users_chatted.clear ();
+	for (room_state &state : room_states)
+	{
+		if (state.seen_users.size () > 0)
+		{
+			logger->logf (": I saw %zu users chat in %s, they took %.1f KB, and %zu cooldowns were still running in %.1f KB.\n", state.seen_users.size (), state.name.c_str(), state.seen_users.memoryUsed () / 1024.0, state.cooldowns.size (), state.cooldowns.memoryUsed () / 1024.0);
+		}
+	}
+	room_states.clear ();
 
 	logger->log (": I have closed.\n");
 
+	delete commands;
 	delete mysql;
 	delete logger;
 
 	return 0;
 }
 
+// Handles a line for a room on one of the dispatch workers, lines for the same room are always handled
+// by the same worker, in the order they arrived
+void handleLine (uint8_t worker, irc_line *received)
+{
+	std::chrono::high_resolution_clock::time_point current_time = hrc_now;
+	room_state *state = &room_states[((received->room >= 0) && ((size_t)received->room < room_states.size () - 1)) ? received->room : room_states.size () - 1];
+	irc_message_view parsed;
+	command_context context;
+	std::string chat;
+	std::string user;
+	std::string room;
+
+	if (!parseIRCMessage (received->line, &parsed))
+	{
+		return;
+	}
+
+	// Looks for chat messages
+	if (parsed.command == "PRIVMSG")
+	{
+		// Try to get the user
+		if (!parsed.nick.empty ())
+		{
+			user = parsed.nick;
+		}
+		else
+		{
+			user = "Unknown";
+		}
+
+
+		// Try to get the message only
+		if (parsed.param_count >= 2)
+		{
+			// Get the room the message was in
+			room = parsed.params[0];
+			std::string_view text = ircTrailing (&parsed);
+
+			if (text.substr(0, 8) == "\001ACTION ")
+			{
+				text.remove_prefix (8);
+				if ((!text.empty ()) && (text.back () == '\001'))
+				{
+					text.remove_suffix (1);
+				}
+				chat = text;
+				logger->logf (": I found a user action in room: %s, user: %s, action: %s\n", room.c_str(), user.c_str(), chat.c_str());
+
+				// Checks if this user has posted before
+				uint64_t user_key = SeenUsers::userKey (ircTag (&parsed, "user-id"), user);
+				bool user_chatted = state->seen_users.contains (user_key, current_time);
+
+				if ((!user_chatted) && (boost::regex_search (chat.c_str(), boost::regex("[^\\s.]\\.[^\\s.]{2,}"))))
+				{
+					logger->logf (": Someone posted a link without having spoken in chat first, spam protection active.\n");
+					std::string temp = "/timeout ";
+					temp.append (user.c_str());
+					temp.append (" 60");
+					send_room (room, temp, IRC_PRIORITY_HIGH);
+					send_room (room, "My master doesn't like spambots, he says spambots are bad.", IRC_PRIORITY_LOW);
+				}
+				else
+				{
+					// If the user hasn't chatted before add them to the list, otherwise note they're still chatting
+					if (state->seen_users.insert (user_key, current_time))
+					{
+						logger->logf (": %s posted their first message without a link, adding them to the list.\n", user.c_str());
+					}
+				}
+			}
+			else
+			{
+				chat = text;
+				logger->debugf (DEBUG_MINIMAL, ": I found a chat message in room: %s, user: %s, message: %s\n", room.c_str(), user.c_str(), chat.c_str());
+
+				// Checks if this user has posted before
+				uint64_t user_key = SeenUsers::userKey (ircTag (&parsed, "user-id"), user);
+				bool user_chatted = state->seen_users.contains (user_key, current_time);
+
+				if ((!user_chatted) && (boost::regex_search (chat.c_str(), boost::regex("[^\\s.]\\.[^\\s.]{2,}"))))
+				{
+					logger->logf (": Someone posted a link without having spoken in chat first, spam protection active.\n");
+					std::string temp = "/timeout ";
+					temp.append (user.c_str());
+					temp.append (" 60");
+					send_room (room, temp, IRC_PRIORITY_HIGH);
+					send_room (room, "My master doesn't like spambots, he says spambots are bad.", IRC_PRIORITY_LOW);
+				}
+				else
+				{
+					// Look for a command in the message, see CommandRegistry for how they're matched
+					context.user = user;
+					context.room = room;
+					context.chat = chat;
+					context.moderator = ((ircTag (&parsed, "mod") == "1") || (ircTag (&parsed, "badges").find ("broadcaster/") != std::string_view::npos));
+					context.now = current_time;
+					context.user_key = user_key;
+					context.cooldowns = &state->cooldowns;
+					context.room_cooldown = room_cooldown;
+					context.state = state;
+					commands->dispatch (&context, current_game);
+
+					// Commands used when streaming rocksmith
+					// Track list
+					// Requests enable / on
+					// Requests disable / off
+					// Requests add
+					// Requests pop
+					// Requests view
+					// Requests clear
+
+					// If the user hasn't chatted before add them to the list, otherwise note they're still chatting
+					if (state->seen_users.insert (user_key, current_time))
+					{
+						logger->logf (": %s posted their first message without a link, adding them to the list.\n", user.c_str());
+					}
+				}
+			}
+		}
+	}
+
+	// Check for user mode change message	// :jtv MODE #skidinc +o paulscelus
+	else if (parsed.command == "MODE")
+	{
+		logger->debug (DEBUG_MINIMAL, ": I've found a MODE change for user.\n");
+	}
+
+	// Check for user list message			// :skidbot.tmi.twitch.tv 353 skidbot = #skidinc :arceusthepokemon wolf7th martinferrer ixtapa_ verenthes
+	else if ((parsed.command == "353") && (parsed.param_count >= 4))
+	{
+		logger->logf (": I've found the channels NAMES list.\n");
+
+		// Get the room the message was in
+		room = parsed.params[2];
+		chat = ircTrailing (&parsed);
+	}
+
+	// Check for user join message			// :skidinc!skidinc@skidinc.tmi.twitch.tv JOIN #skidinc
+	else if (parsed.command == "JOIN")
+	{
+		user = parsed.nick.empty () ? "Unknown" : parsed.nick;
+		logger->logf (": I've noticed a user join the chat, %s.\n", user.c_str());
+	}
+
+	// Check for user part message			// :skidinc!skidinc@skidinc.tmi.twitch.tv PART #skidinc
+	else if (parsed.command == "PART")
+	{
+		user = parsed.nick.empty () ? "Unknown" : parsed.nick;
+		logger->logf (": I've noticed a user part the chat, %s.\n", user.c_str());
+	}
+}
+
+// Schedules the timers for the rooms hashed to a worker, runs on the worker before it's given any lines
+void startWorker (uint8_t worker, uint8_t workers)
+{
+	TimerService *timers = dispatchTimers (worker);
+
+	for (size_t t = worker; t < irc_rooms.size (); t += workers)
+	{
+		room_state *state = &room_states[t];
+		state->timers = timers;
+
+		// Each announcement's first post lands somewhere in its first interval, after that it wanders by up to
+		// a tenth of it, or a minute, so rooms with the same announcements don't all post at once
+		for (const announcement &posting : announcements)
+		{
+			if ((posting.room != "*") && (posting.room != state->name))
+			{
+				continue;
+			}
+
+			std::chrono::milliseconds interval = std::chrono::minutes(posting.minutes);
+			std::chrono::milliseconds jitter = std::min (interval / 10, std::chrono::milliseconds(std::chrono::minutes(1)));
+			std::string room = state->name;
+			std::string text = posting.text;
+			std::chrono::milliseconds first = std::chrono::milliseconds(std::uniform_int_distribution<int64_t> (1, interval.count ()) (dice));
+			timers->every (interval, jitter, [room, text] ()
+			{
+				logger->logf (": Posting an announcement in %s.\n", room.c_str());
+				send_room (room, text, IRC_PRIORITY_LOW);
+			}, first);
+		}
+	}
+}
+
+// Posts the no spoilers message in the room
+void postNoSpoilers (room_state *state)
+{
+	logger->logf (": Posting no spoilers message in %s.\n", state->name.c_str());
+	send_room (state->name, "My master would like to do his first run blind, so please no spoilers or hints etc, thank you :)", IRC_PRIORITY_LOW);
+}
+
 // Reads the configuration and sets the default user details
 void readConfig (void)
 {
@@ -707,9 +502,30 @@ void readConfig (void)
 	std::string db_user;
 	std::string db_pass;
 	std::string db_name;
+	std::string db_host = "localhost";
+	int db_port = 0;
 	std::string new_user = "bot_username";
 	std::string new_oauth = "oauth:bot_oauth";
 	std::string new_room = "#target_room";
+	std::vector<std::string> new_rooms;
+	int new_shards = 1;
+	bool new_tls = false;
+	bool new_standby = false;
+	bool new_uring = false;
+	std::string new_host = "";
+	int new_port = 0;
+	int new_probe_interval = IRC_PROBE_SECONDS;
+	int new_probe_misses = IRC_PROBE_MISSES;
+	int new_pack_milli = 0;
+	std::string new_pack_separator = "|";
+	int new_chat_workers = 0;
+	int new_async_threads = ASYNC_THREADS;
+	int new_seen_expiry = 0;
+	int new_room_cooldown = 0;
+	std::vector<announcement> new_announcements;
+	std::string new_quotes_table = "";
+	std::vector<std::string> new_commands;
+	std::string new_commands_table = "";
 
 	// Open the configuration file
 	std::ifstream conf_file ("./SkidBot.cfg", std::ios::in);
@@ -761,6 +577,130 @@ void readConfig (void)
 						new_room = buffer;
 						logger->debugf (DEBUG_DETAILED, ": Setting default_room to %s\n", new_room.c_str());
 					}
+					else if (parameter.compare("Rooms") == 0)
+					{
+						// A list of extra rooms to join, split by commas or spaces
+						std::string rooms = boost::to_lower_copy (value);
+						std::vector<std::string> room_list;
+						boost::split (room_list, rooms, boost::is_any_of(", "), boost::token_compress_on);
+						for (std::string &room : room_list)
+						{
+							if (!room.empty())
+							{
+								if (room[0] != '#')
+								{
+									room.insert (0, "#");
+								}
+								new_rooms.push_back (room);
+							}
+						}
+						logger->debugf (DEBUG_DETAILED, ": Adding %s to irc_rooms\n", rooms.c_str());
+					}
+					else if (parameter.compare("IRC Connections") == 0)
+					{
+						new_shards = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_shards to %d\n", new_shards);
+					}
+					else if (parameter.compare("IRC Host") == 0)
+					{
+						new_host = value;
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_host to %s\n", new_host.c_str());
+					}
+					else if (parameter.compare("IRC Port") == 0)
+					{
+						new_port = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_port to %d\n", new_port);
+					}
+					else if (parameter.compare("IRC TLS") == 0)
+					{
+						std::string enabled = boost::to_lower_copy (value);
+						new_tls = ((enabled.compare("true") == 0) || (enabled.compare("yes") == 0) || (enabled.compare("1") == 0));
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_tls to %d\n", new_tls);
+					}
+					else if (parameter.compare("IRC Standby") == 0)
+					{
+						std::string enabled = boost::to_lower_copy (value);
+						new_standby = ((enabled.compare("true") == 0) || (enabled.compare("yes") == 0) || (enabled.compare("1") == 0));
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_standby to %d\n", new_standby);
+					}
+					else if (parameter.compare("IRC IO Backend") == 0)
+					{
+						new_uring = (boost::to_lower_copy (value).compare("uring") == 0);
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_uring to %d\n", new_uring);
+					}
+					else if (parameter.compare("IRC Ping Interval") == 0)
+					{
+						new_probe_interval = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_probe_interval to %d\n", new_probe_interval);
+					}
+					else if (parameter.compare("IRC Missed PONGs") == 0)
+					{
+						new_probe_misses = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_probe_misses to %d\n", new_probe_misses);
+					}
+					else if (parameter.compare("IRC Reply Packing") == 0)
+					{
+						new_pack_milli = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_pack_milli to %d\n", new_pack_milli);
+					}
+					else if (parameter.compare("IRC Reply Separator") == 0)
+					{
+						new_pack_separator = value;
+						logger->debugf (DEBUG_DETAILED, ": Setting irc_pack_separator to %s\n", new_pack_separator.c_str());
+					}
+					else if (parameter.compare("Dispatch Workers") == 0)
+					{
+						new_chat_workers = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting chat_workers to %d\n", new_chat_workers);
+					}
+					else if (parameter.compare("Async Threads") == 0)
+					{
+						new_async_threads = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting async_threads to %d\n", new_async_threads);
+					}
+					else if (parameter.compare("Seen Users Expiry") == 0)
+					{
+						new_seen_expiry = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting seen_expiry to %d minutes\n", new_seen_expiry);
+					}
+					else if (parameter.compare("Room Cooldown") == 0)
+					{
+						new_room_cooldown = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting room_cooldown to %d\n", new_room_cooldown);
+					}
+					else if (parameter.compare("Announcement") == 0)
+					{
+						// A message posted on a timer, "#room | minutes | message", * posts it in every room
+						std::vector<std::string> fields;
+						boost::split (fields, value, boost::is_any_of("|"));
+						announcement posting;
+						if (fields.size () >= 3)
+						{
+							posting.room = boost::to_lower_copy (trim (fields[0]));
+							posting.minutes = atoi (fields[1].c_str());
+							posting.text = trim (value.substr (value.find ('|', value.find ('|') + 1) + 1));
+						}
+						if ((posting.room.empty ()) || (posting.minutes < 1) || (posting.minutes > 1440) || (posting.text.empty ()))
+						{
+							logger->logf (": I was unable to understand the announcement \"%s\", it should be \"#room | minutes | message\".\n", value.c_str());
+						}
+						else
+						{
+							if ((posting.room != "*") && (posting.room[0] != '#'))
+							{
+								posting.room.insert (0, "#");
+							}
+							new_announcements.push_back (posting);
+							logger->debugf (DEBUG_DETAILED, ": Adding an announcement every %d minutes to %s\n", posting.minutes, posting.room.c_str());
+						}
+					}
+					else if (parameter.compare("Command") == 0)
+					{
+						// A command that replies, "triggers | permission | cooldown | game | reply", the cooldown
+						// can be "room/user" seconds
+						new_commands.push_back (value);
+						logger->debugf (DEBUG_DETAILED, ": Adding %s to commands\n", value.c_str());
+					}
 					else if (parameter.compare("MySQL Username") == 0)
 					{
 						db_user = value;
@@ -776,6 +716,26 @@ void readConfig (void)
 						db_name = value;
 						logger->debugf (DEBUG_DETAILED, ": Setting db_name to %s\n", db_name.c_str());
 					}
+					else if (parameter.compare("MySQL Host") == 0)
+					{
+						db_host = value;
+						logger->debugf (DEBUG_DETAILED, ": Setting db_host to %s\n", db_host.c_str());
+					}
+					else if (parameter.compare("MySQL Port") == 0)
+					{
+						db_port = atoi (value.c_str());
+						logger->debugf (DEBUG_DETAILED, ": Setting db_port to %d\n", db_port);
+					}
+					else if (parameter.compare("MySQL Commands Table") == 0)
+					{
+						new_commands_table = value;
+						logger->debugf (DEBUG_DETAILED, ": Setting new_commands_table to %s\n", new_commands_table.c_str());
+					}
+					else if (parameter.compare("MySQL Quotes Table") == 0)
+					{
+						new_quotes_table = value;
+						logger->debugf (DEBUG_DETAILED, ": Setting quotes_table to %s\n", new_quotes_table.c_str());
+					}
 				}
 			}
 		}
@@ -787,7 +747,27 @@ void readConfig (void)
 	logger->log (": Configuration file read, attempting to the initalised my MySQL Handler.\n");
 
 	// Initaliser the MySQLHandler
-	mysql->init (db_user, db_pass, db_name);
+	mysql->init (db_user, db_pass, db_name, db_host, ((db_port > 0) && (db_port <= 65535)) ? db_port : 0);
+
+	// Add the commands from the config, then the ones from MySQL so they can replace them
+	for (std::string &definition : new_commands)
+	{
+		commands->load (definition);
+	}
+	if (!new_commands_table.empty ())
+	{
+		commands->loadTable (mysql, new_commands_table);
+	}
+	quotes_table = new_quotes_table;
+	if (!quotes_table.empty ())
+	{
+		command_entry command;
+		command.cooldown = 10;
+		command.user_cooldown = 30;
+		command.task = commandQuote;
+		commands->add (command, "!quote");
+	}
+	logger->logf (": I know %zu commands.\n", commands->size ());
 
 	logger->log (": Configuring my IRC settings.\n");
 
@@ -795,6 +775,26 @@ void readConfig (void)
 	bot_user = new_user;
 	bot_oauth = new_oauth;
 	default_room = new_room;
+	irc_rooms = new_rooms;
+	irc_shards = ((new_shards >= 1) && (new_shards <= IRC_MAX_SHARDS)) ? new_shards : 1;
+	irc_tls = new_tls;
+	irc_standby = new_standby;
+	irc_uring = new_uring;
+	irc_host = new_host;
+	irc_port = ((new_port > 0) && (new_port <= 65535)) ? new_port : 0;
+	irc_probe_interval = ((new_probe_interval >= 1) && (new_probe_interval <= 300)) ? new_probe_interval : IRC_PROBE_SECONDS;
+	irc_probe_misses = ((new_probe_misses >= 1) && (new_probe_misses <= 10)) ? new_probe_misses : IRC_PROBE_MISSES;
+	irc_pack_milli = ((new_pack_milli >= 0) && (new_pack_milli <= IRC_PACK_MAX_MILLI)) ? new_pack_milli : 0;
+	irc_pack_separator = new_pack_separator.substr (0, 16);
+
+	// Set how many workers handle chat, and how many threads they have for the calls they wait on
+	chat_workers = ((new_chat_workers >= 0) && (new_chat_workers <= DISPATCH_MAX_WORKERS)) ? new_chat_workers : 0;
+	async_threads = ((new_async_threads >= 1) && (new_async_threads <= ASYNC_MAX_THREADS)) ? new_async_threads : ASYNC_THREADS;
+
+	// Set how long a user can be quiet before the spam protection treats them as new, up to a month
+	seen_expiry = ((new_seen_expiry > 0) && (new_seen_expiry <= 43200)) ? new_seen_expiry * 60 : 0;
+	room_cooldown = ((new_room_cooldown > 0) && (new_room_cooldown <= 3600)) ? new_room_cooldown : 0;
+	announcements = new_announcements;
 }
 
 // Strips whitespace from the begining and end of the string
@@ -1314,6 +1314,312 @@ double rollQueryParse (std::string _query, std::string *_roll_text)
 	return result;
 }
 
+// Adds the commands SkidBot knows out of the box, more can be added from the config or MySQL
+void registerCommands (void)
+{
+	// Commands that need code to run
+	static const struct
+	{
+		const char *triggers;
+		uint8_t permission;
+		command_handler handler;
+	} handlers[] = {
+		{"respond", COMMAND_MASTER, commandRespond},
+		{"please leave", COMMAND_MASTER, commandLeave},
+		{"panic", COMMAND_MASTER, commandPanic},
+		{"latency", COMMAND_MASTER, commandLatency},
+		{"no spoilers start", COMMAND_MASTER, commandSpoilersStart},
+		{"no spoilers stop", COMMAND_MASTER, commandSpoilersStop},
+		{"change, set", COMMAND_MASTER, commandSetGameMaster},
+		{"who", COMMAND_MASTER, commandWhoGameMaster},
+		{"\"Good SkidBot\"", COMMAND_MASTER, commandPraise},
+		{"seen users", COMMAND_MASTER, commandSeenUsers},
+		{"!roll, !r", COMMAND_EVERYONE, commandRoll},
+		{"!gmroll, !gmr", COMMAND_EVERYONE, commandGameMasterRoll}
+	};
+
+	// Commands that reply with the same text every time, to anyone, once every 10 seconds in a room and
+	// once every 30 seconds for each user
+	static const struct
+	{
+		const char *triggers;
+		const char *game;
+		const char *description;
+		const char *reply;
+	} replies[] = {
+		{"PC Specs", "", "my masters PC Specs", "You can find my masters PC specs on his You Tube channels about page, found here: http://www.youtube.com/c/SkidIncGaming/about :)"},
+		{"YouTube, You Tube", "", "my masters You Tube channel", "You can find my masters You Tube channel here: http://www.youtube.com/c/SkidIncGaming :)"},
+		{"Twitter", "", "my masters twitter username", "You can find my masters Twitter here: http://twitter.com/nskid11 :)"},
+		{"surround, eyefinity, multi-monitor, resolution", "", "information on multi-monitor stream", "My masters is streaming at a triple-monitor resolution, twitch's layout isn't so great for this, so my master made this one that should display the stream better: http://www.skid-inc.net/eyestream.php :)"},
+		{"music, song", "", "information on the music being played", "The music my master is playing will ether be from OC Remix, http://ocremix.org/, Rainwave, http://ocr.rainwave.cc/, or Miracle of Sound, http://miracleofsound.bandcamp.com/ :)"},
+		{"rules, channel rules", "", "the channels rules", "The rules for my masters channels are as follows, [1] Always be respectful to other people. [2] Be respectful to other peoples opinions, just because someone else's opinion doesn't match your own, does not invalidate ether. [3] Please avoid spoilers. [4] I like to work things out myself, so if I miss something or don't say \"Hey, Chat, what does....\" then please don't tell me. [5] Don't spam, this includes emote spam."},
+		{"bsg, back seat gaming, back seat gamer", "", "back seat gaming information", "Please don't back seat game my master, he likes to play games how he likes to, regardless if that is optimal or not, he also likes to learn or work things out himself. So telling him what to do, or how to play, where things are, etc, will likely get you ignored or timed out or at worse banned. The exception to this rule is if he asks something directly of chat like, \"Chat, do you know how unlock this item?\". :)"},
+		{"tracks, track list, Rocksmith", "Rocksmith 2014", "link to my masters Rocksmith track list", "A full list of my masters Rocksmith songs can be found here, bear in mind favorated songs are first. http://www.skid-inc.net/rocksmith_tracks.php :)"}
+	};
+
+	for (const auto &handler : handlers)
+	{
+		command_entry command;
+		command.permission = handler.permission;
+		command.handler = handler.handler;
+		commands->add (command, handler.triggers);
+	}
+	for (const auto &reply : replies)
+	{
+		command_entry command;
+		command.cooldown = 10;
+		command.user_cooldown = 30;
+		command.game = reply.game;
+		command.description = reply.description;
+		command.reply = reply.reply;
+		commands->add (command, reply.triggers);
+	}
+}
+
+// Posts a random quote from the quotes table, the query runs on an async thread so the room's other
+// lines are handled while it waits
+AsyncTask commandQuote (command_call call)
+{
+	MYSQL_RES *result = co_await asyncQuery (mysql, "SELECT quote FROM " + quotes_table + " ORDER BY RAND() LIMIT 1");
+	MYSQL_ROW row = (result != NULL) ? mysql_fetch_row (result) : NULL;
+
+	if ((row != NULL) && (row[0] != NULL))
+	{
+		logger->logf (": Giving a quote to %s. :)\n", call.user.c_str());
+		send_room (call.room, row[0], IRC_PRIORITY_LOW);
+	}
+	else
+	{
+		logger->logf (": I couldn't find a quote to give to %s. :(\n", call.user.c_str());
+	}
+
+	if (result != NULL)
+	{
+		mysql_free_result (result);
+	}
+}
+
+// Answers my master
+void commandRespond (const command_context *context)
+{
+	logger->log (": Responding to my master. :)\n");
+	send_room (context->room, "Yes Master? :)");
+}
+
+// Leaves the room my master asked me to
+void commandLeave (const command_context *context)
+{
+	logger->log (": Leaving by my masters request. :(\n");
+	send_room (context->room, "OK, I'm going now, bye bye. :(");
+	part_room (context->room);
+}
+
+// Closes the process when something has gone wrong
+void commandPanic (const command_context *context)
+{
+	logger->log (": Something has gone wrong, sending SIGTERM to my own process. :S\n");
+	send_room (context->room, "Something has gone wrong, sending SIGTERM to my own process. panicBasket");
+	raise (SIGTERM);
+}
+
+// Reports the round trip time to twitch for the room
+void commandLatency (const command_context *context)
+{
+	double latency = room_latency (context->room);
+	logger->logf (": Reporting my latency to twitch of %.2f ms.\n", latency);
+	send_room (context->room, (latency > 0) ? ("My round trip time to twitch is " + parseDouble (latency) + " ms. :)") : std::string ("I haven't measured my round trip time to twitch yet. :)"));
+}
+
+// Starts posting the no spoilers message
+void commandSpoilersStart (const command_context *context)
+{
+	room_state *state = context->state;
+
+	// Only the rooms we joined have timers, anything else isn't a room we can post in
+	if (state->timers == NULL)
+	{
+		logger->logf (": I can't post no spoiler messages in %s, it isn't one of my rooms.\n", context->room.c_str());
+		send_room (context->room, "Sorry, I can't post no spoiler messages here. :(");
+		return;
+	}
+
+	logger->logf (": Starting to post no spoiler messages. :)\n");
+	send_room (context->room, "Acknowledged, starting to post no spoiler messages every 5 minutes. :)");
+	if (state->no_spoilers == 0)
+	{
+		state->no_spoilers = state->timers->every (std::chrono::minutes(5), std::chrono::milliseconds(0), [state] () { postNoSpoilers (state); }, std::chrono::milliseconds(0));
+	}
+}
+
+// Stops posting the no spoilers message
+void commandSpoilersStop (const command_context *context)
+{
+	logger->logf (": I will no longer post no spoiler messages. :)\n");
+	send_room (context->room, "Acknowledged, I will no longer post no spoiler messages. :)");
+	room_state *state = context->state;
+	if (state->no_spoilers != 0)
+	{
+		state->timers->cancel (state->no_spoilers);
+		state->no_spoilers = 0;
+	}
+}
+
+// Changes the game master, "change gm to name" or "set dm name"
+void commandSetGameMaster (const command_context *context)
+{
+	const std::vector<std::string_view> &words = context->words;
+	if ((words.size () < 3) || ((!boost::iequals(words[1], "gm")) && (!boost::iequals(words[1], "dm"))))
+	{
+		return;
+	}
+
+	uint8_t target_word = 2;
+	if (boost::iequals(words[2], "to"))
+	{
+		target_word = 3;
+	}
+	if (target_word >= words.size ())
+	{
+		return;
+	}
+
+	context->state->game_master = words[target_word];
+	logger->logf (": I will change the assigned game master to %s.\n", context->state->game_master.c_str());
+	std::string message = "Acknowledged, I will change the assigned game master to ";
+	message += context->state->game_master;
+	message += ". :)";
+	send_room (context->room, message);
+}
+
+// Reports the game master, "who is the gm"
+void commandWhoGameMaster (const command_context *context)
+{
+	if ((!boost::iequals(context->words.back(), "gm")) && (!boost::iequals(context->words.back(), "dm")))
+	{
+		return;
+	}
+
+	logger->logf (": Reporting that the current game master is %s.\n", context->state->game_master.c_str());
+	std::string message = "The currently assigned game master is ";
+	message += context->state->game_master;
+	message += ". :)";
+	send_room (context->room, message);
+}
+
+// Thanks my master
+void commandPraise (const command_context *context)
+{
+	logger->log (": My master praised me ^_^.\n");
+	send_room (context->room, "^_^");
+}
+
+// Reports how many users have chatted in the room, and the memory the spam protection is using for them
+void commandSeenUsers (const command_context *context)
+{
+	SeenUsers *seen_users = &context->state->seen_users;
+	logger->logf (": Reporting %zu users seen in %s, using %zu bytes.\n", seen_users->size (), context->room.c_str(), seen_users->memoryUsed ());
+	send_room (context->room, "I've seen " + std::to_string (seen_users->size ()) + " users chat here, remembering them takes " + parseDouble (seen_users->memoryUsed () / 1024.0) + " KB. :)");
+}
+
+// Rolls dice for the room, "!roll 1d20+5 reason"
+void commandRoll (const command_context *context)
+{
+	logger->debugf (DEBUG_MINIMAL, ": Someone is rolling %.*s\n", (int)context->argument.size (), context->argument.data ());
+	rollDice (context, false);
+}
+
+// Rolls dice and whispers the result to the game master, "!gmroll 1d20+5 reason"
+void commandGameMasterRoll (const command_context *context)
+{
+	logger->debugf (DEBUG_MINIMAL, ": Someone is gm rolling %.*s\n", (int)context->argument.size (), context->argument.data ());
+	rollDice (context, true);
+}
+
+// Works out a roll query and sends the results, to the room or whispered to the game master
+void rollDice (const command_context *context, bool gm_roll)
+{
+	// Prepare the variables used to process the roll
+	std::string roll_query (context->argument);
+	std::string roll_text;
+	double roll_result;
+	std::string roll_reason = "some dice";
+
+	// See if there is a reason for the roll
+	std::size_t last_add = roll_query.find_last_of ('+');
+	std::size_t last_sub = roll_query.find_last_of ('-');
+	std::size_t last_mul = roll_query.find_last_of ('*');
+	std::size_t last_div = roll_query.find_last_of ('/');
+	std::size_t first_space = roll_query.find (' ');
+	if ((last_add == std::string::npos) && (last_sub == std::string::npos) && (last_mul == std::string::npos) && (last_div == std::string::npos))
+	{
+		if (first_space != std::string::npos)
+		{
+			roll_reason = roll_query.substr (first_space + 1);
+			roll_query = roll_query.substr (0, roll_query.length() - roll_reason.length() - 1);
+		}
+	}
+	else
+	{
+		std::size_t highest_position = 0;
+		if ((last_add != std::string::npos) && (last_add > highest_position))
+		{
+			highest_position = last_add;
+		}
+		if ((last_sub != std::string::npos) && (last_sub > highest_position))
+		{
+			highest_position = last_sub;
+		}
+		if ((last_mul != std::string::npos) && (last_mul > highest_position))
+		{
+			highest_position = last_mul;
+		}
+		if ((last_div != std::string::npos) && (last_div > highest_position))
+		{
+			highest_position = last_div;
+		}
+
+		// Find the first space after the last opperator
+		first_space = roll_query.find (' ', highest_position + 2);
+		if (first_space != std::string::npos)
+		{
+			roll_reason = roll_query.substr (first_space + 1);
+			roll_query = roll_query.substr (0, roll_query.length() - roll_reason.length() - 1);
+		}
+	}
+
+	// Parse the query
+	roll_result = rollQuerySplitSubAdd (roll_query, &roll_text);
+
+
+	// Send the results of the roll
+	if (!gm_roll)
+	{
+		std::string temp;
+		temp += context->user;
+		temp += " just rolled ";
+		temp += roll_reason;
+		temp += ": ";
+		temp += roll_text;
+		temp += " = ";
+		temp += parseDouble(roll_result);
+		send_room (context->room, temp);
+	}
+	else
+	{
+		std::string temp = "/w ";
+		temp += context->state->game_master;
+		temp += " Game Master, ";
+		temp += context->user;
+		temp += " just rolled ";
+		temp += roll_reason;
+		temp += ": ";
+		temp += roll_text;
+		temp += " = ";
+		temp += parseDouble(roll_result);
+		gsend_room ("#jtv", temp);
+	}
+}
+
 // Hangles the SIGTERM signal, to safely close the program down
 void signalHandler (int signum)
 {
@@ -1332,6 +1638,9 @@ void signalHandler (int signum)
 				close_reason = signum;
 				closing_process = 1;
 			}
+
+			// Main may be asleep waiting for lines
+			wakeMain ();
 		}
 		break;
 	}
@@ -3,6 +3,12 @@
 
 #include <pthread.h>
 #include <chrono>
+#include <string>
+#include <vector>
+
+#include "SeenUsers.hpp"
+#include "CooldownWheel.hpp"
+#include "TimerService.hpp"
 
 #define lock(x) (pthread_mutex_lock(&x))
 #define trylock(x) (pthread_mutex_trylock(&x))
@@ -119,4 +125,23 @@ typedef struct roll_data
 	bool exploded = false;
 } roll_data;
 
+// Holds a message that's posted to a room on a timer
+typedef struct announcement
+{
+	std::string room;							// The room to post in, or * for every room
+	int minutes = 0;
+	std::string text;
+} announcement;
+
+// Holds what the bot keeps for each room, only the room's dispatch worker touches it
+typedef struct room_state
+{
+	std::string name;
+	SeenUsers seen_users;						// Holds the users that have chatted in the room
+	CooldownWheel cooldowns;					// Holds the room's running command cooldowns
+	TimerService *timers = NULL;				// The timers of the room's dispatch worker
+	uint64_t no_spoilers = 0;					// The no spoilers timer, 0 when it isn't running
+	std::string game_master = "skidinc";
+} room_state;
+
 #endif
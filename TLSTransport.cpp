@@ -0,0 +1,298 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "TLSTransport.hpp"
+#include "SkidBot.hpp"
+#include "Logger.hpp"
+
+// Function prototypes
+static int tlsNewSession (SSL *ssl, SSL_SESSION *session);
+
+// Global varibles
+SSL_CTX *tls_context = NULL;
+
+// Holds the last session each host gave us, so reconnects can resume it instead of doing a full
+// handshake, only used from the reactor
+std::unordered_map<std::string, SSL_SESSION *> tls_sessions;
+
+extern Logger *logger;
+
+
+/**
+ * Creates the TLS context shared by every connection, servers are verified against the system's
+ * certificate store, returns 1 on success or -1 if the context couldn't be made
+ */
+int setupTLS (void)
+{
+	if (tls_context != NULL)
+	{
+		return 1;
+	}
+
+	tls_context = SSL_CTX_new (TLS_client_method ());
+	if (tls_context == NULL)
+	{
+		logger->logf (" TLS: I was unable to create my TLS context, reason: %s.\n", tlsError ());
+		return -1;
+	}
+
+	SSL_CTX_set_min_proto_version (tls_context, TLS1_2_VERSION);
+	SSL_CTX_set_options (tls_context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+	SSL_CTX_set_verify (tls_context, SSL_VERIFY_PEER, NULL);
+	if (SSL_CTX_set_default_verify_paths (tls_context) != 1)
+	{
+		logger->logf (" TLS: I was unable to load the trusted certificates, reason: %s.\n", tlsError ());
+	}
+
+	// Writes are retried with the outbound buffer as it is then, which may have moved or grown
+	SSL_CTX_set_mode (tls_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	// We keep the sessions ourselves, OpenSSL's internal cache is only used by servers
+	SSL_CTX_set_session_cache_mode (tls_context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb (tls_context, tlsNewSession);
+
+	return 1;
+}
+
+
+/**
+ * Frees the cached sessions and the TLS context
+ */
+void cleanupTLS (void)
+{
+	for (std::unordered_map<std::string, SSL_SESSION *>::iterator session = tls_sessions.begin (); session != tls_sessions.end (); session++)
+	{
+		SSL_SESSION_free (session->second);
+	}
+	tls_sessions.clear ();
+
+	SSL_CTX_free (tls_context);
+	tls_context = NULL;
+}
+
+
+/**
+ * Starts a TLS client on a connected non-blocking socket, offering the hosts cached session if
+ * we have one, the handshake is then driven by tlsHandshake. Returns NULL on failure.
+ */
+SSL *tlsOpen (int sock, const char *host)
+{
+	struct in6_addr address;
+	SSL *ssl;
+
+	if ((tls_context == NULL) || ((ssl = SSL_new (tls_context)) == NULL))
+	{
+		return NULL;
+	}
+
+	SSL_set_fd (ssl, sock);
+	SSL_set_connect_state (ssl);
+	SSL_set_app_data (ssl, (void *)host);
+	SSL_set1_host (ssl, host);
+
+	// SNI is only for names, not address literals
+	if ((inet_pton (AF_INET, host, &address) != 1) && (inet_pton (AF_INET6, host, &address) != 1))
+	{
+		SSL_set_tlsext_host_name (ssl, host);
+	}
+
+	std::unordered_map<std::string, SSL_SESSION *>::iterator session = tls_sessions.find (host);
+	if (session != tls_sessions.end ())
+	{
+		SSL_set_session (ssl, session->second);
+	}
+
+	return ssl;
+}
+
+
+/**
+ * Moves the handshake along, returns TLS_DONE once it's finished, TLS_WANT_READ or TLS_WANT_WRITE
+ * if it's waiting on the socket, or TLS_FAILED
+ */
+int tlsHandshake (SSL *ssl)
+{
+	int handshake_return = SSL_do_handshake (ssl);
+	if (handshake_return == 1)
+	{
+		return TLS_DONE;
+	}
+
+	switch (SSL_get_error (ssl, handshake_return))
+	{
+		case (SSL_ERROR_WANT_READ):
+		{
+			return TLS_WANT_READ;
+		}
+
+		case (SSL_ERROR_WANT_WRITE):
+		{
+			return TLS_WANT_WRITE;
+		}
+	}
+
+	return TLS_FAILED;
+}
+
+
+/**
+ * Reads decrypted data, returns like read, so 0 when the server has closed the connection and -1 with
+ * errno set to EAGAIN when there's nothing to read yet, or EIO if the connection failed
+ */
+ssize_t tlsRead (SSL *ssl, char *buffer, size_t length)
+{
+	errno = 0;
+	int read_return = SSL_read (ssl, buffer, length);
+	if (read_return > 0)
+	{
+		return read_return;
+	}
+
+	switch (SSL_get_error (ssl, read_return))
+	{
+		case (SSL_ERROR_WANT_READ):
+		case (SSL_ERROR_WANT_WRITE):
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+
+		case (SSL_ERROR_ZERO_RETURN):
+		{
+			return 0;
+		}
+
+		case (SSL_ERROR_SYSCALL):
+		{
+			// No errno means the server hung up without a close_notify
+			if (errno == 0)
+			{
+				return 0;
+			}
+			return -1;
+		}
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+
+/**
+ * Encrypts and writes the buffer, returns like write, if it returns -1 with errno set to EAGAIN the
+ * same data must be offered again once the socket is writable
+ */
+ssize_t tlsWrite (SSL *ssl, const char *buffer, size_t length)
+{
+	errno = 0;
+	int write_return = SSL_write (ssl, buffer, length);
+	if (write_return > 0)
+	{
+		return write_return;
+	}
+
+	switch (SSL_get_error (ssl, write_return))
+	{
+		case (SSL_ERROR_WANT_READ):
+		case (SSL_ERROR_WANT_WRITE):
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+
+		case (SSL_ERROR_SYSCALL):
+		{
+			if (errno != 0)
+			{
+				return -1;
+			}
+		}
+		break;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+
+/**
+ * Says goodbye to the server if the connection is healthy and frees the TLS state, the socket is
+ * left for the caller to close. If the connection failed the hosts cached session is dropped, so a
+ * session the server no longer likes can't stop us reconnecting.
+ */
+void tlsClose (SSL *ssl, bool failed)
+{
+	if (ssl == NULL)
+	{
+		return;
+	}
+
+	if (failed)
+	{
+		const char *host = (const char *)SSL_get_app_data (ssl);
+		std::unordered_map<std::string, SSL_SESSION *>::iterator session = tls_sessions.find (host);
+		if (session != tls_sessions.end ())
+		{
+			SSL_SESSION_free (session->second);
+			tls_sessions.erase (session);
+		}
+	}
+	else
+	{
+		SSL_shutdown (ssl);
+	}
+
+	SSL_free (ssl);
+	ERR_clear_error ();
+}
+
+
+/**
+ * Returns OpenSSL's description of the last error, only valid until the next call
+ */
+const char *tlsError (void)
+{
+	static char error_buffer[256];
+	unsigned long error = ERR_get_error ();
+
+	if (error == 0)
+	{
+		return strerror(errno);
+	}
+	ERR_error_string_n (error, error_buffer, sizeof (error_buffer));
+	ERR_clear_error ();
+
+	return error_buffer;
+}
+
+
+/**
+ * Called by OpenSSL when the server gives us a session, keeps the newest one for the host
+ */
+static int tlsNewSession (SSL *ssl, SSL_SESSION *session)
+{
+	const char *host = (const char *)SSL_get_app_data (ssl);
+	if (host == NULL)
+	{
+		return 0;
+	}
+
+	SSL_SESSION *&cached = tls_sessions[host];
+	if (cached != NULL)
+	{
+		SSL_SESSION_free (cached);
+	}
+	cached = session;
+
+	// Returning 1 tells OpenSSL we've kept the reference
+	return 1;
+}
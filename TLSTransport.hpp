@@ -0,0 +1,27 @@
+#ifndef	_TLS_TRANSPORT_H
+#define _TLS_TRANSPORT_H
+
+#include <sys/types.h>
+
+#include <openssl/ssl.h>
+
+// The most plaintext that fits in one TLS record, writes are gathered up to this so each one is a single record
+#define TLS_RECORD_SIZE		16384
+
+// Handshake return defines
+#define TLS_FAILED			-1
+#define TLS_WANT_READ		0
+#define TLS_WANT_WRITE		1
+#define TLS_DONE			2
+
+// Global function prototypes
+int setupTLS (void);
+void cleanupTLS (void);
+SSL *tlsOpen (int sock, const char *host);
+int tlsHandshake (SSL *ssl);
+ssize_t tlsRead (SSL *ssl, char *buffer, size_t length);
+ssize_t tlsWrite (SSL *ssl, const char *buffer, size_t length);
+void tlsClose (SSL *ssl, bool failed);
+const char *tlsError (void);
+
+#endif
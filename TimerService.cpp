@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+#include <unordered_map>
+
+#include "TimerService.hpp"
+
+// Defines how many cancelled entries the heap may hold before it's rebuilt without them
+#define TIMER_STALE_KEEP	64
+
+
+/**
+ * Creates a service with no timers, timers due within coalesce_milli of each other are run together
+ */
+TimerService::TimerService (uint32_t coalesce_milli)
+{
+	stale = 0;
+	next_id = 1;
+	coalesce = std::chrono::milliseconds(coalesce_milli);
+	random.seed (std::random_device () ());
+}
+
+
+/**
+ * Runs the callback once after the delay, returns the timer's id
+ */
+uint64_t TimerService::schedule (std::chrono::milliseconds delay, timer_callback callback)
+{
+	uint64_t id = next_id++;
+	timer_task *task = &tasks[id];
+
+	task->base = std::chrono::high_resolution_clock::now () + delay;
+	task->interval = std::chrono::milliseconds(0);
+	task->jitter = std::chrono::milliseconds(0);
+	task->callback = std::move (callback);
+	push (id, task->base);
+
+	return id;
+}
+
+
+/**
+ * Runs the callback after the first delay and then every interval, each run is pushed back by up to
+ * the jitter, returns the timer's id
+ */
+uint64_t TimerService::every (std::chrono::milliseconds interval, std::chrono::milliseconds jitter, timer_callback callback, std::chrono::milliseconds first)
+{
+	uint64_t id = next_id++;
+	timer_task *task = &tasks[id];
+
+	task->base = std::chrono::high_resolution_clock::now () + first;
+	task->interval = std::max (interval, std::chrono::milliseconds(1));
+	task->jitter = std::max (jitter, std::chrono::milliseconds(0));
+	task->callback = std::move (callback);
+	push (id, task->base + jitterFor (task->jitter));
+
+	return id;
+}
+
+
+/**
+ * Stops a timer, returns false if it had already run or been cancelled. Its entry is left in the heap
+ * and skipped, until there are enough of them to be worth clearing out.
+ */
+bool TimerService::cancel (uint64_t id)
+{
+	if (tasks.erase (id) == 0)
+	{
+		return false;
+	}
+
+	stale++;
+	if ((stale > TIMER_STALE_KEEP) && (stale > (heap.size () / 2)))
+	{
+		compact ();
+	}
+
+	return true;
+}
+
+
+/**
+ * Runs every timer that's due, or will be within the coalesce window, then returns how many milliseconds
+ * until the next is due, or -1 if there are none. A recurring timer that fell behind skips the runs it
+ * missed rather than running them all at once.
+ */
+int TimerService::run (std::chrono::high_resolution_clock::time_point now)
+{
+	std::chrono::high_resolution_clock::time_point until = now + coalesce;
+
+	while ((!heap.empty ()) && (heap.front ().due <= until))
+	{
+		uint64_t id = heap.front ().id;
+		std::pop_heap (heap.begin (), heap.end (), later);
+		heap.pop_back ();
+
+		std::unordered_map<uint64_t, timer_task>::iterator found = tasks.find (id);
+		if (found == tasks.end ())
+		{
+			stale--;
+			continue;
+		}
+
+		// The callback may cancel or add timers, so it's run from a copy once the timer is done with
+		timer_callback callback;
+		timer_task *task = &found->second;
+		if (task->interval.count () > 0)
+		{
+			task->base += task->interval;
+			if (task->base <= now)
+			{
+				task->base = now + task->interval;
+			}
+			push (id, task->base + jitterFor (task->jitter));
+			callback = task->callback;
+		}
+		else
+		{
+			callback = std::move (task->callback);
+			tasks.erase (found);
+		}
+
+		callback ();
+	}
+
+	return nextTimeout (now);
+}
+
+
+/**
+ * Returns how many milliseconds until the next timer is due, or -1 if there are none
+ */
+int TimerService::nextTimeout (std::chrono::high_resolution_clock::time_point now)
+{
+	while ((!heap.empty ()) && (tasks.find (heap.front ().id) == tasks.end ()))
+	{
+		std::pop_heap (heap.begin (), heap.end (), later);
+		heap.pop_back ();
+		stale--;
+	}
+
+	if (heap.empty ())
+	{
+		return -1;
+	}
+	if (heap.front ().due <= now)
+	{
+		return 0;
+	}
+
+	// Round up, otherwise we wake a fraction early and spin until the timer is due
+	return (int)std::min (std::chrono::duration_cast<std::chrono::milliseconds>(heap.front ().due - now).count () + 1, (int64_t)INT32_MAX);
+}
+
+
+/**
+ * Returns how many timers are waiting to run
+ */
+size_t TimerService::size (void)
+{
+	return tasks.size ();
+}
+
+
+/**
+ * Adds a timer's next run to the heap
+ */
+void TimerService::push (uint64_t id, std::chrono::high_resolution_clock::time_point due)
+{
+	heap.push_back ({due, id});
+	std::push_heap (heap.begin (), heap.end (), later);
+}
+
+
+/**
+ * Returns a random delay of up to the jitter
+ */
+std::chrono::milliseconds TimerService::jitterFor (std::chrono::milliseconds jitter)
+{
+	if (jitter.count () <= 0)
+	{
+		return std::chrono::milliseconds(0);
+	}
+	return std::chrono::milliseconds(std::uniform_int_distribution<int64_t> (0, jitter.count ()) (random));
+}
+
+
+/**
+ * Orders the heap so the timer due first is at the front
+ */
+bool TimerService::later (const timer_entry &a, const timer_entry &b)
+{
+	return (a.due > b.due);
+}
+
+
+/**
+ * Rebuilds the heap without the entries of cancelled timers
+ */
+void TimerService::compact (void)
+{
+	heap.erase (std::remove_if (heap.begin (), heap.end (), [this] (const timer_entry &entry) { return (tasks.find (entry.id) == tasks.end ()); }), heap.end ());
+	std::make_heap (heap.begin (), heap.end (), later);
+	stale = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef	_TIMER_SERVICE_H
+#define _TIMER_SERVICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+#include <unordered_map>
+
+// Defines how close together, in milliseconds, timers have to be due to be run on the same wake
+#define TIMER_COALESCE_MILLI	20
+
+typedef std::function<void ()> timer_callback;
+
+// Define the TimerService class
+class TimerService;
+
+// Build the TimerService class template, holds a thread's scheduled and recurring work on a min-heap so
+// it can sleep until the next is due however many there are. Recurring timers can be given jitter so
+// thousands started together spread out, and timers due within a few milliseconds of each other are run
+// together. It isn't locked, only the thread that owns it may use it.
+class TimerService
+{
+private:
+	// Private variables
+	typedef struct timer_entry
+	{
+		std::chrono::high_resolution_clock::time_point due;
+		uint64_t id;
+	} timer_entry;
+	typedef struct timer_task
+	{
+		std::chrono::high_resolution_clock::time_point base;	// When it was due before any jitter, so jitter doesn't build up
+		std::chrono::milliseconds interval;						// 0 when it only runs once
+		std::chrono::milliseconds jitter;
+		timer_callback callback;
+	} timer_task;
+	std::vector<timer_entry> heap;
+	std::unordered_map<uint64_t, timer_task> tasks;
+	size_t stale;						// Entries in the heap for timers that have been cancelled
+	uint64_t next_id;
+	std::chrono::milliseconds coalesce;
+	std::minstd_rand random;
+
+	// Private methods
+	static bool later (const timer_entry &a, const timer_entry &b);
+	void push (uint64_t id, std::chrono::high_resolution_clock::time_point due);
+	std::chrono::milliseconds jitterFor (std::chrono::milliseconds jitter);
+	void compact (void);
+
+public:
+	// Constructors and destructor
+	TimerService (uint32_t coalesce_milli = TIMER_COALESCE_MILLI);
+
+	// Public methods
+	uint64_t schedule (std::chrono::milliseconds delay, timer_callback callback);
+	uint64_t every (std::chrono::milliseconds interval, std::chrono::milliseconds jitter, timer_callback callback, std::chrono::milliseconds first);
+	bool cancel (uint64_t id);
+	int run (std::chrono::high_resolution_clock::time_point now);
+	int nextTimeout (std::chrono::high_resolution_clock::time_point now);
+	size_t size (void);
+};
+
+#endif
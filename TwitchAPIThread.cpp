@@ -1,5 +1,6 @@
 // TODO: Read the current follower and the follower before on load, so that if someone unfollowers it doesn't thank them again.
 // NOTE: The above won't be nesseracy with a user database.
+#include <time.h>
 #include <unistd.h>
 
 #include <string>
@@ -8,6 +9,7 @@
 #include <boost/algorithm/string.hpp>
 
 #include "TwitchAPIThread.hpp"
+#include "TimerService.hpp"
 #include "SkidBot.hpp"
 #include "Logger.hpp"
 #include "IRCThread.hpp"
@@ -16,6 +18,7 @@
 // Global varibles
 bool tapi_running = true;
 pthread_mutex_t tapi_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t tapi_cond = PTHREAD_COND_INITIALIZER;
 
 // API variables
 std::string curl_buffer;
@@ -23,7 +26,6 @@ std::string last_follower = "";
 std::string previous_follower = "";
 
 // Variables that SkidBot needs to keep track of
-std::chrono::high_resolution_clock::time_point last_channel_request;
 std::string current_title = "Undefined";
 std::string current_game = "Undefined";
 
@@ -41,173 +43,219 @@ static size_t WriteCallback (void *contents, size_t size, size_t nmemb, void *us
 
 
 /**
- * TwitchAPIThread, handles connecting to the Twitch api, sends requests and parses the results.
+ * Checks for a new follower, and lets my master know about them
  */
-void *TwitchAPIThread (void *)
+static void tapiCheckFollowers (CURL *curl)
 {
-	CURL *curl;
 	CURLcode res;
 	
-	curl_global_init(CURL_GLOBAL_ALL);
-	curl = curl_easy_init ();
-	
-	lock (tapi_mutex);
-	while (tapi_running)
+	// Request the most recent follower
+	curl_buffer.clear();
+	curl_easy_setopt (curl, CURLOPT_URL, "https://api.twitch.tv/kraken/channels/n_skid11/follows?limit=2");
+	curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+	curl_easy_setopt (curl, CURLOPT_WRITEDATA, &curl_buffer);
+	res = curl_easy_perform (curl);
+	curl_easy_reset (curl);
+	if (res != CURLE_OK)
 	{
-		release (tapi_mutex);
+		logger->logf (" TwitchAPIThread: I was unable to send follower api request, reason: %s\n", curl_easy_strerror(res));
+	}
+	else
+	{
+		// Find the username and displayname for the last follower
+		std::string latest_follower = "";
+		std::string displayname = "";
+		size_t start_username = curl_buffer.find ("\"name\":\"") + 8;
+		size_t end_username = curl_buffer.find ("\",", start_username);
+		size_t start_displayname = curl_buffer.find ("\"display_name\":\"") + 16;
+		size_t end_displayname = curl_buffer.find ("\",", start_displayname);
 		
-		// If curl is not valid re-init it
-		if (!curl)
+		if ((start_username != std::string::npos) && (end_username != std::string::npos))
 		{
-			curl = curl_easy_init ();
+			latest_follower = curl_buffer.substr (start_username, end_username - start_username);
 		}
-		
-		// Request the most recent follower
-		curl_buffer.clear();
-		curl_easy_setopt (curl, CURLOPT_URL, "https://api.twitch.tv/kraken/channels/n_skid11/follows?limit=2");
-		curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-		curl_easy_setopt (curl, CURLOPT_WRITEDATA, &curl_buffer);
-		res = curl_easy_perform (curl);
-		curl_easy_reset (curl);
-		if (res != CURLE_OK)
+		if ((start_displayname != std::string::npos) && (end_displayname != std::string::npos))
 		{
-			logger->logf (" TwitchAPIThread: I was unable to send follower api request, reason: %s\n", curl_easy_strerror(res));
+			displayname = curl_buffer.substr (start_displayname, end_displayname - start_displayname);
 		}
-		else
+		
+		// If we found a valid username and displayname
+		if ((latest_follower.length() != 0) && (displayname.length() != 0))
 		{
-			// Find the username and displayname for the last follower
-			std::string latest_follower = "";
-			std::string displayname = "";
-			size_t start_username = curl_buffer.find ("\"name\":\"") + 8;
-			size_t end_username = curl_buffer.find ("\",", start_username);
-			size_t start_displayname = curl_buffer.find ("\"display_name\":\"") + 16;
-			size_t end_displayname = curl_buffer.find ("\",", start_displayname);
-			
-			if ((start_username != std::string::npos) && (end_username != std::string::npos))
+			// If the last follower hasn't been read yet, don't send a PM
+			if (last_follower.length() == 0)
 			{
-				latest_follower = curl_buffer.substr (start_username, end_username - start_username);
-			}
-			if ((start_displayname != std::string::npos) && (end_displayname != std::string::npos))
-			{
-				displayname = curl_buffer.substr (start_displayname, end_displayname - start_displayname);
+				last_follower = latest_follower;
+				std::string temp = "/w n_skid11 Master, the last follower was ";
+				temp.append (displayname);
+				temp.append (".");
+				gsend_room ("#jtv", temp);
+				
+				logger->logf (" TwitchAPIThread: I've found the last follower, %s.\n", displayname.c_str());
+				
+				// Get the follower before last
+				start_username = curl_buffer.find ("\"name\":\"", end_displayname) + 8;
+				end_username = curl_buffer.find ("\",", start_username);
+				start_displayname = curl_buffer.find ("\"display_name\":\"", end_username) + 16;
+				end_displayname = curl_buffer.find ("\",", start_displayname);
+				if ((start_username != std::string::npos) && (end_username != std::string::npos))
+				{
+					previous_follower = curl_buffer.substr (start_username, end_username - start_username);
+				}
+				if ((start_displayname != std::string::npos) && (end_displayname != std::string::npos))
+				{
+					displayname = curl_buffer.substr (start_displayname, end_displayname - start_displayname);
+				}
+				
+				logger->logf (" TwitchAPIThread: I've found the follower before last, %s.\n", displayname.c_str());
 			}
-			
-			// If we found a valid username and displayname
-			if ((latest_follower.length() != 0) && (displayname.length() != 0))
+			else if (previous_follower.compare(latest_follower) == 0)
 			{
-				// If the last follower hasn't been read yet, don't send a PM
-				if (last_follower.length() == 0)
+				// Get the follower before last
+				start_username = curl_buffer.find ("\"name\":\"", end_displayname) + 8;
+				end_username = curl_buffer.find ("\",", start_username);
+				start_displayname = curl_buffer.find ("\"display_name\":\"", end_username) + 16;
+				end_displayname = curl_buffer.find ("\",", start_displayname);
+				if ((start_username != std::string::npos) && (end_username != std::string::npos))
 				{
-					last_follower = latest_follower;
-					std::string temp = "/w n_skid11 Master, the last follower was ";
-					temp.append (displayname);
-					temp.append (".");
-					gsend_room ("#jtv", temp);
-					
-					logger->logf (" TwitchAPIThread: I've found the last follower, %s.\n", displayname.c_str());
-					
-					// Get the follower before last
-					start_username = curl_buffer.find ("\"name\":\"", end_displayname) + 8;
-					end_username = curl_buffer.find ("\",", start_username);
-					start_displayname = curl_buffer.find ("\"display_name\":\"", end_username) + 16;
-					end_displayname = curl_buffer.find ("\",", start_displayname);
-					if ((start_username != std::string::npos) && (end_username != std::string::npos))
-					{
-						previous_follower = curl_buffer.substr (start_username, end_username - start_username);
-					}
-					if ((start_displayname != std::string::npos) && (end_displayname != std::string::npos))
-					{
-						displayname = curl_buffer.substr (start_displayname, end_displayname - start_displayname);
-					}
-					
-					logger->logf (" TwitchAPIThread: I've found the follower before last, %s.\n", displayname.c_str());
+					previous_follower = curl_buffer.substr (start_username, end_username - start_username);
 				}
-				else if (previous_follower.compare(latest_follower) == 0)
+				if ((start_displayname != std::string::npos) && (end_displayname != std::string::npos))
 				{
-					// Get the follower before last
-					start_username = curl_buffer.find ("\"name\":\"", end_displayname) + 8;
-					end_username = curl_buffer.find ("\",", start_username);
-					start_displayname = curl_buffer.find ("\"display_name\":\"", end_username) + 16;
-					end_displayname = curl_buffer.find ("\",", start_displayname);
-					if ((start_username != std::string::npos) && (end_username != std::string::npos))
-					{
-						previous_follower = curl_buffer.substr (start_username, end_username - start_username);
-					}
-					if ((start_displayname != std::string::npos) && (end_displayname != std::string::npos))
-					{
-						displayname = curl_buffer.substr (start_displayname, end_displayname - start_displayname);
-					}
-					
-					logger->logf (" TwitchAPIThread: Master, the last person to follow unfollowed :(, %s.\n", displayname.c_str());
+					displayname = curl_buffer.substr (start_displayname, end_displayname - start_displayname);
 				}
-				else if (last_follower.compare(latest_follower) != 0)
+				
+				logger->logf (" TwitchAPIThread: Master, the last person to follow unfollowed :(, %s.\n", displayname.c_str());
+			}
+			else if (last_follower.compare(latest_follower) != 0)
+			{
+				
+				// Confirm the user is valid and that something hasn't messed up with the API call
+				if ((!boost::regex_search (latest_follower.c_str(), boost::regex("[^a-zA-Z0-9_]"))) && ((!boost::regex_search (last_follower.c_str(), boost::regex("[^a-zA-Z0-9_]")))))
 				{
-					
-					// Confirm the user is valid and that something hasn't messed up with the API call
-					if ((!boost::regex_search (latest_follower.c_str(), boost::regex("[^a-zA-Z0-9_]"))) && ((!boost::regex_search (last_follower.c_str(), boost::regex("[^a-zA-Z0-9_]")))))
+					// Confirm the display name is valid and that something hasn't messed up with the API call
+					if (!boost::regex_search (displayname.c_str(), boost::regex("[^a-zA-Z0-9_]")))
 					{
-						// Confirm the display name is valid and that something hasn't messed up with the API call
-						if (!boost::regex_search (displayname.c_str(), boost::regex("[^a-zA-Z0-9_]")))
-						{
-							previous_follower = last_follower;
-							last_follower = latest_follower;
-							std::string temp = "/w ";
-							temp.append (latest_follower);
-							temp.append (" ");
-							temp.append (displayname);
-							temp.append (" my master would like me to thank you for following, while he doesn't announce such things on stream he does still appreciate it, so thank you. :)");
-							gsend_room ("#jtv", temp);
-							temp.clear ();
-							temp.append ("/w n_skid11 Master, ");
-							temp.append (displayname);
-							temp.append (" just followed, thought you should know. :)");
-							gsend_room ("#jtv", temp);
-
-							logger->logf (" TwitchAPIThread: I've found a new follower, %s.\n", displayname.c_str());
-						}
+						previous_follower = last_follower;
+						last_follower = latest_follower;
+						std::string temp = "/w ";
+						temp.append (latest_follower);
+						temp.append (" ");
+						temp.append (displayname);
+						temp.append (" my master would like me to thank you for following, while he doesn't announce such things on stream he does still appreciate it, so thank you. :)");
+						gsend_room ("#jtv", temp);
+						temp.clear ();
+						temp.append ("/w n_skid11 Master, ");
+						temp.append (displayname);
+						temp.append (" just followed, thought you should know. :)");
+						gsend_room ("#jtv", temp);
+
+						logger->logf (" TwitchAPIThread: I've found a new follower, %s.\n", displayname.c_str());
 					}
 				}
 			}
 		}
+	}
+}
+
+
+/**
+ * Checks the stream title and game
+ */
+static void tapiCheckChannel (CURL *curl)
+{
+	CURLcode res;
+	
+	curl_buffer.clear();
+	curl_easy_setopt (curl, CURLOPT_URL, "https://api.twitch.tv/kraken/channels/n_skid11");
+	curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+	curl_easy_setopt (curl, CURLOPT_WRITEDATA, &curl_buffer);
+	res = curl_easy_perform (curl);
+	curl_easy_reset (curl);
+	if (res != CURLE_OK)
+	{
+		logger->logf (" TwitchAPIThread: I was unable to send channel api request, reason: %s\n", curl_easy_strerror(res));
+	}
+	else
+	{
+		size_t start_status = curl_buffer.find ("\"status\":\"") + 10;
+		size_t end_status = curl_buffer.find ("\",", start_status);
+		size_t start_game = curl_buffer.find ("\"game\":\"") + 8;
+		size_t end_game = curl_buffer.find ("\",", start_game);
 		
-		// Every 1 minute check the stream title and game
-		if ((hrc_now - last_channel_request) > std::chrono::seconds(60))
+		if ((start_status != std::string::npos) && (end_status != std::string::npos))
 		{
-			last_channel_request = hrc_now;
-			
-			curl_buffer.clear();
-			curl_easy_setopt (curl, CURLOPT_URL, "https://api.twitch.tv/kraken/channels/n_skid11");
-			curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-			curl_easy_setopt (curl, CURLOPT_WRITEDATA, &curl_buffer);
-			res = curl_easy_perform (curl);
-			curl_easy_reset (curl);
-			if (res != CURLE_OK)
-			{
-				logger->logf (" TwitchAPIThread: I was unable to send channel api request, reason: %s\n", curl_easy_strerror(res));
-			}
-			else
-			{
-				size_t start_status = curl_buffer.find ("\"status\":\"") + 10;
-				size_t end_status = curl_buffer.find ("\",", start_status);
-				size_t start_game = curl_buffer.find ("\"game\":\"") + 8;
-				size_t end_game = curl_buffer.find ("\",", start_game);
-				
-				if ((start_status != std::string::npos) && (end_status != std::string::npos))
-				{
-					current_title = curl_buffer.substr (start_status, end_status - start_status);
-				}
-				if ((start_game != std::string::npos) && (end_game != std::string::npos))
-				{
-					current_game = curl_buffer.substr (start_game, end_game - start_game);
-				}
-				
-				logger->debugf (DEBUG_STANDARD, " TwitchAPIThread: I've found the stream title and game, %s, %s.\n", current_title.c_str(), current_game.c_str());
-			}
+			current_title = curl_buffer.substr (start_status, end_status - start_status);
+		}
+		if ((start_game != std::string::npos) && (end_game != std::string::npos))
+		{
+			current_game = curl_buffer.substr (start_game, end_game - start_game);
 		}
 		
-		usleep (1000000);
+		logger->debugf (DEBUG_STANDARD, " TwitchAPIThread: I've found the stream title and game, %s, %s.\n", current_title.c_str(), current_game.c_str());
+	}
+}
+
+
+/**
+ * Stops the Twitch API thread, waking it if it's waiting for the next check
+ */
+void stopTwitchAPIThread (void)
+{
+	lock (tapi_mutex);
+	tapi_running = false;
+	pthread_cond_signal (&tapi_cond);
+	release (tapi_mutex);
+}
+
+
+/**
+ * TwitchAPIThread, handles connecting to the Twitch api, sends requests and parses the results.
+ */
+void *TwitchAPIThread (void *)
+{
+	CURL *curl;
+	TimerService timers;
+	
+	curl_global_init(CURL_GLOBAL_ALL);
+	curl = curl_easy_init ();
+	
+	// Followers are checked every second, and the title and game every minute, wandering a few seconds
+	timers.every (std::chrono::seconds(1), std::chrono::milliseconds(0), [&curl] () { tapiCheckFollowers (curl); }, std::chrono::milliseconds(0));
+	timers.every (std::chrono::seconds(60), std::chrono::seconds(5), [&curl] () { tapiCheckChannel (curl); }, std::chrono::milliseconds(0));
+	
+	lock (tapi_mutex);
+	while (tapi_running)
+	{
+		release (tapi_mutex);
 		
+		// If curl is not valid re-init it
+		if (!curl)
+		{
+			curl = curl_easy_init ();
+		}
+		
+		int timeout = timers.run (hrc_now);
+		
+		// Sleep until the next check is due, stopTwitchAPIThread wakes us early
 		lock (tapi_mutex);
+		if ((tapi_running) && (timeout < 0))
+		{
+			pthread_cond_wait (&tapi_cond, &tapi_mutex);
+		}
+		else if ((tapi_running) && (timeout > 0))
+		{
+			struct timespec until;
+			clock_gettime (CLOCK_REALTIME, &until);
+			until.tv_sec += timeout / 1000;
+			until.tv_nsec += (timeout % 1000) * 1000000L;
+			if (until.tv_nsec >= 1000000000L)
+			{
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait (&tapi_cond, &tapi_mutex, &until);
+		}
 	}
 	release (tapi_mutex);
 	
@@ -3,5 +3,6 @@
 
 // Global function prototypes
 void *TwitchAPIThread (void *);
+void stopTwitchAPIThread (void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+// g++ -std=c++20 -O2 -Wall -I.. AsyncBench.cpp ../Dispatcher.cpp ../TimerService.cpp ../AsyncTask.cpp ../MySQLHandler.cpp ../Logger.cpp ../IOURing.cpp -lpthread -lmysqlclient -lcurl -o AsyncBench
+// Measures how long chat lines wait to be handled by the dispatch workers while some of them make a slow
+// database call, usage: ./AsyncBench [-b] [-r rate] [-t seconds] [-w workers] [-a threads] [-s percent] [-d milli]
+// By default the slow calls are awaited on the async threads, with -b they block the worker like they used to.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "Dispatcher.hpp"
+#include "AsyncTask.hpp"
+
+Logger *logger;
+uint8_t debug_level = DEBUG_NONE;
+
+// The workers wake main through the reactor once a full queue drains, there's no reactor here and main polls instead
+void wakeMain (void)
+{
+}
+
+static bool blocking = false;
+static int slow_percent = 10;
+static int slow_milli = 50;
+static std::vector<double> waits[DISPATCH_MAX_WORKERS];	// How long each line waited, in ms, kept by its worker
+static std::atomic<uint32_t> slow_calls {0};
+
+static uint64_t nowMicro (void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+// Stands in for a query that takes as long as the database does to answer
+static int slowQuery (void)
+{
+	usleep (slow_milli * 1000);
+	slow_calls++;
+	return 0;
+}
+
+static AsyncTask slowCommand (void)
+{
+	co_await asyncRun<int> (slowQuery);
+}
+
+// Each line is "sequence sent_micro", every so many of them make the slow call
+static void handleLine (uint8_t worker, irc_line *line)
+{
+	char *end;
+	uint64_t sequence = strtoull (line->line.c_str (), &end, 10);
+	uint64_t sent = strtoull (end, NULL, 10);
+
+	waits[worker].push_back ((nowMicro () - sent) / 1000.0);
+	if ((sequence % 100) < (uint64_t)slow_percent)
+	{
+		if (blocking)
+		{
+			slowQuery ();
+		}
+		else
+		{
+			slowCommand ();
+		}
+	}
+}
+
+int main (int argc, char **argv)
+{
+	int rate = 200;
+	int seconds = 5;
+	int workers = 1;
+	int threads = ASYNC_THREADS;
+	int rooms = 8;
+	int option;
+
+	while ((option = getopt (argc, argv, "br:t:w:a:s:d:")) != -1)
+	{
+		switch (option)
+		{
+			case 'b': blocking = true; break;
+			case 'r': rate = atoi (optarg); break;
+			case 't': seconds = atoi (optarg); break;
+			case 'w': workers = atoi (optarg); break;
+			case 'a': threads = atoi (optarg); break;
+			case 's': slow_percent = atoi (optarg); break;
+			case 'd': slow_milli = atoi (optarg); break;
+			default:
+				fprintf (stderr, "usage: %s [-b] [-r rate] [-t seconds] [-w workers] [-a threads] [-s percent] [-d milli]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	logger = new Logger ("AsyncBench.log");
+	logger->setLinePrefix ("AsyncBench");
+	if (!blocking)
+	{
+		setupAsyncTasks (threads);
+	}
+	if (setupDispatcher (workers, handleLine, NULL) < 0)
+	{
+		fprintf (stderr, "AsyncBench: Unable to start the dispatcher.\n");
+		return 1;
+	}
+
+	// Sends the lines at a steady rate, spread over the rooms, then lets everything finish
+	uint64_t total = (uint64_t)rate * seconds;
+	uint64_t start = nowMicro ();
+	for (uint64_t t = 0; t < total; t++)
+	{
+		uint64_t due = start + (t * 1000000) / rate;
+		while (nowMicro () < due)
+		{
+			if (dispatchFlush ())
+			{
+				usleep (100);
+			}
+			else
+			{
+				uint64_t left = due - nowMicro ();
+				usleep ((left < 1000000) ? left : 0);
+			}
+		}
+
+		irc_line line;
+		line.line = std::to_string (t) + " " + std::to_string (nowMicro ());
+		line.room = t % rooms;
+		dispatchLine (std::move (line));
+		dispatchFlush ();
+	}
+	stopDispatcher ();
+	stopAsyncTasks ();
+	double elapsed = (nowMicro () - start) / 1000000.0;
+
+	std::vector<double> all;
+	for (int t = 0; t < workers; t++)
+	{
+		all.insert (all.end (), waits[t].begin (), waits[t].end ());
+	}
+	std::sort (all.begin (), all.end ());
+	if (all.empty ())
+	{
+		fprintf (stderr, "AsyncBench: No lines were handled.\n");
+		return 1;
+	}
+
+	printf ("AsyncBench: %s slow calls, %d msg/s for %d seconds, %d%% of lines wait %d ms, %d workers\n", blocking ? "blocking" : "async", rate, seconds, slow_percent, slow_milli, workers);
+	printf ("  handled %zu lines and %u slow calls in %.2f seconds\n", all.size (), slow_calls.load (), elapsed);
+	printf ("  dispatch wait ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", all[all.size () / 2], all[(all.size () * 9) / 10], all[(all.size () * 99) / 100], all.back ());
+
+	delete logger;
+	return 0;
+}
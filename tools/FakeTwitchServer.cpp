@@ -0,0 +1,532 @@
+// g++ -std=c++17 -O2 -Wall FakeTwitchServer.cpp -o FakeTwitchServer
+// A local stand-in for twitch's IRC server that floods the bot with synthetic chat and times its replies,
+// usage: ./FakeTwitchServer [-p port] [-r messages per second] [-u users] [-l link ratio] [-R roll ratio] [-t seconds] [-k seconds] [-s seconds] [-m]
+// With -k the connection the bot last replied on is dropped every so many seconds, and how long it takes
+// for a reply to come back is reported, to time the bots failover.
+// With -s the rooms are in slow mode and replies sent too soon are refused, with -m the bot is a moderator
+// and exempt from it, either way replies past twitch's rate limit for the bot are counted.
+// Point the bot at it with "IRC Host = 127.0.0.1" and "IRC Port = <port>" in SkidBot.cfg.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define FAKE_MAX_EVENTS		64
+#define FAKE_MAX_BUFFER		(64 * 1024 * 1024)
+
+// Holds a connected client, usually one of the bots chat connections or its groups connection
+typedef struct fake_client
+{
+	int sock = -1;
+	std::string nick = "skidbot";
+	std::string in;					// Partial line carried over between reads
+	std::string out;				// Lines the socket hasn't taken yet
+	std::vector<std::string> rooms;	// Rooms joined on this connection
+	bool tags = false;				// Set once the bot has asked for twitch.tv/tags
+} fake_client;
+
+// Holds the load settings and what has been measured so far
+typedef struct fake_stats
+{
+	double rate = 100;
+	uint32_t users = 500;
+	double link_ratio = 0.01;
+	double roll_ratio = 0.1;
+	uint64_t sent = 0;
+	uint64_t rolls = 0;
+	uint64_t links = 0;
+	uint64_t replies = 0;
+	uint64_t timeouts = 0;
+	uint64_t pings = 0;
+	uint64_t dropped = 0;
+	uint64_t skipped = 0;
+	double kill_interval = 0;
+	uint64_t kills = 0;
+	bool failing_over = false;										// Set from a kill until the bot replies again
+	std::chrono::steady_clock::time_point killed;
+	std::vector<double> outages;									// Milliseconds from each kill to the next reply
+	std::vector<std::chrono::steady_clock::time_point> roll_sent;	// When each roll id was sent
+	std::vector<double> latencies;									// Milliseconds from roll to reply
+	uint16_t slow = 0;												// Slow mode in every room, in seconds
+	bool moderator = false;											// Set when the bot is told it's a moderator
+	uint64_t refused = 0;											// Replies refused for slow mode
+	uint64_t over_limit = 0;										// Replies past the bot's rate limit
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> last_reply;	// When the bot last spoke in each room
+	std::deque<std::chrono::steady_clock::time_point> recent_replies;					// Replies in the last 30 seconds
+} fake_stats;
+
+static std::vector<fake_client *> clients;
+static fake_client *last_replier = NULL;
+static fake_stats stats;
+static std::mt19937 random_engine (12345);
+static volatile bool running = true;
+static int epoll_fd = -1;
+
+
+/**
+ * Stops the server on SIGINT or SIGTERM so the results get printed
+ */
+static void handleSignal (int)
+{
+	running = false;
+}
+
+
+/**
+ * Queues a line to a client and writes as much as the socket will take
+ */
+static void sendLine (fake_client *client, const std::string &line)
+{
+	if (client->out.size () > FAKE_MAX_BUFFER)
+	{
+		// The bot isn't reading, don't eat all the memory
+		stats.dropped++;
+		return;
+	}
+
+	client->out += line;
+	client->out += "\r\n";
+
+	while (!client->out.empty ())
+	{
+		ssize_t write_return = write (client->sock, client->out.data (), client->out.size ());
+		if (write_return <= 0)
+		{
+			break;
+		}
+		client->out.erase (0, write_return);
+	}
+
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN | (client->out.empty () ? 0 : EPOLLOUT);
+	event.data.ptr = client;
+	epoll_ctl (epoll_fd, EPOLL_CTL_MOD, client->sock, &event);
+}
+
+
+/**
+ * Handles one line from the bot, answering the way twitch would
+ */
+static void handleLine (fake_client *client, const std::string &line)
+{
+	std::string command = line.substr (0, line.find (' '));
+	std::string rest = (line.find (' ') == std::string::npos) ? "" : line.substr (line.find (' ') + 1);
+
+	if (command == "NICK")
+	{
+		client->nick = rest;
+		sendLine (client, ":tmi.twitch.tv 001 " + client->nick + " :Welcome, GLHF!");
+		sendLine (client, ":tmi.twitch.tv 002 " + client->nick + " :Your host is tmi.twitch.tv");
+		sendLine (client, ":tmi.twitch.tv 003 " + client->nick + " :This server is rather new");
+		sendLine (client, ":tmi.twitch.tv 004 " + client->nick + " :-");
+		sendLine (client, ":tmi.twitch.tv 376 " + client->nick + " :>");
+	}
+	else if (command == "CAP")
+	{
+		// CAP REQ :twitch.tv/membership
+		std::size_t colon = rest.find (':');
+		std::string capability = (colon == std::string::npos) ? rest : rest.substr (colon + 1);
+		client->tags |= (capability == "twitch.tv/tags");
+		sendLine (client, ":tmi.twitch.tv CAP * ACK :" + capability);
+	}
+	else if (command == "JOIN")
+	{
+		std::string room = rest;
+		client->rooms.push_back (room);
+		sendLine (client, ":" + client->nick + "!" + client->nick + "@" + client->nick + ".tmi.twitch.tv JOIN " + room);
+		sendLine (client, ":" + client->nick + ".tmi.twitch.tv 353 " + client->nick + " = " + room + " :" + client->nick + " skidinc user0 user1 user2");
+		sendLine (client, ":" + client->nick + ".tmi.twitch.tv 366 " + client->nick + " " + room + " :End of /NAMES list");
+		if (client->tags)
+		{
+			sendLine (client, std::string ("@badge-info=;badges=") + (stats.moderator ? "moderator/1" : "") + ";color=;display-name=" + client->nick +
+				";emote-sets=0;mod=" + (stats.moderator ? "1" : "0") + ";subscriber=0;user-type=" + (stats.moderator ? "mod" : "") + " :tmi.twitch.tv USERSTATE " + room);
+			sendLine (client, "@emote-only=0;followers-only=-1;r9k=0;room-id=1;slow=" + std::to_string (stats.slow) + ";subs-only=0 :tmi.twitch.tv ROOMSTATE " + room);
+		}
+		printf ("FakeTwitchServer: The bot joined %s.\n", room.c_str ());
+	}
+	else if (command == "PART")
+	{
+		std::string room = rest.substr (0, rest.find (' '));
+		client->rooms.erase (std::remove (client->rooms.begin (), client->rooms.end (), room), client->rooms.end ());
+	}
+	else if (command == "PING")
+	{
+		stats.pings++;
+		sendLine (client, ":tmi.twitch.tv PONG tmi.twitch.tv " + rest);
+	}
+	else if (command == "PRIVMSG")
+	{
+		// PRIVMSG #room :text, rolls are answered with "user just rolled id<n>: ..."
+		std::size_t colon = rest.find (" :");
+		std::string text = (colon == std::string::npos) ? "" : rest.substr (colon + 2);
+		std::string room = rest.substr (0, rest.find (' '));
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+
+		// Twitch counts every PRIVMSG against the limit, even the ones it refuses
+		while ((!stats.recent_replies.empty ()) && ((now - stats.recent_replies.front ()) >= std::chrono::seconds(30)))
+		{
+			stats.recent_replies.pop_front ();
+		}
+		stats.recent_replies.push_back (now);
+		if (stats.recent_replies.size () > (stats.moderator ? 100u : 20u))
+		{
+			stats.over_limit++;
+		}
+		if ((stats.slow > 0) && (!stats.moderator) && (stats.last_reply.count (room) > 0) && ((now - stats.last_reply[room]) < std::chrono::seconds(stats.slow)))
+		{
+			stats.refused++;
+			sendLine (client, "@msg-id=msg_slowmode :tmi.twitch.tv NOTICE " + room + " :This room is in slow mode and you are sending messages too quickly.");
+			return;
+		}
+		stats.last_reply[room] = now;
+		stats.replies++;
+		last_replier = client;
+		if (stats.failing_over)
+		{
+			stats.outages.push_back (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now () - stats.killed).count ());
+			stats.failing_over = false;
+		}
+
+		if (text.compare (0, 9, "/timeout ") == 0)
+		{
+			stats.timeouts++;
+			return;
+		}
+
+		// A packed reply answers more than one roll
+		for (std::size_t id_start = text.find (" id"); id_start != std::string::npos; id_start = text.find (" id", id_start + 3))
+		{
+			uint64_t id = strtoull (text.c_str () + id_start + 3, NULL, 10);
+			if ((id < stats.roll_sent.size ()) && (stats.roll_sent[id] != std::chrono::steady_clock::time_point ()))
+			{
+				stats.latencies.push_back (std::chrono::duration<double, std::milli>(now - stats.roll_sent[id]).count ());
+				stats.roll_sent[id] = std::chrono::steady_clock::time_point ();
+			}
+		}
+	}
+}
+
+
+/**
+ * Sends one synthetic chat message to a room the bot has joined, like twitch every connection that
+ * joined the room gets it, returns false if the bot hasn't joined any
+ */
+static bool sendChat (bool force_roll)
+{
+	std::vector<std::string> rooms;
+	for (fake_client *client : clients)
+	{
+		for (std::string &room : client->rooms)
+		{
+			// The groups connection's #jtv isn't a chat room
+			if ((room != "#jtv") && (std::find (rooms.begin (), rooms.end (), room) == rooms.end ()))
+			{
+				rooms.push_back (room);
+			}
+		}
+	}
+	if (rooms.empty ())
+	{
+		return false;
+	}
+
+	const std::string &target = rooms[stats.sent % rooms.size ()];
+	std::uniform_real_distribution<double> chance (0, 1);
+	uint32_t user = random_engine () % std::max (stats.users, (uint32_t)1);
+	char text[256];
+
+	double pick = chance (random_engine);
+	if ((force_roll) || (pick < stats.roll_ratio))
+	{
+		uint64_t id = stats.roll_sent.size ();
+		snprintf (text, sizeof (text), "!roll 2d6+1 id%llu", (unsigned long long)id);
+		stats.roll_sent.push_back (std::chrono::steady_clock::now ());
+		stats.rolls++;
+	}
+	else if (pick < stats.roll_ratio + stats.link_ratio)
+	{
+		snprintf (text, sizeof (text), "come and see my stream at example.com/user%u", user);
+		stats.links++;
+	}
+	else
+	{
+		snprintf (text, sizeof (text), "hello chat, this is message %llu Kappa", (unsigned long long)stats.sent);
+	}
+
+	char line[512];
+	snprintf (line, sizeof (line), ":user%u!user%u@user%u.tmi.twitch.tv PRIVMSG %s :%s", user, user, user, target.c_str (), text);
+	std::vector<fake_client *> joined = clients;
+	for (fake_client *client : joined)
+	{
+		if (std::find (client->rooms.begin (), client->rooms.end (), target) != client->rooms.end ())
+		{
+			sendLine (client, line);
+		}
+	}
+	stats.sent++;
+	return true;
+}
+
+
+/**
+ * Prints the percentile of the sorted latencies
+ */
+static double percentile (const std::vector<double> &sorted, double fraction)
+{
+	if (sorted.empty ())
+	{
+		return 0;
+	}
+	return sorted[std::min (sorted.size () - 1, (size_t)(fraction * sorted.size ()))];
+}
+
+
+int main (int argc, char **argv)
+{
+	struct epoll_event events[FAKE_MAX_EVENTS];
+	struct sockaddr_in address;
+	int port = 6667;
+	double duration = 0;
+	int option;
+
+	while ((option = getopt (argc, argv, "p:r:u:l:R:t:k:s:m")) != -1)
+	{
+		switch (option)
+		{
+			case ('p'): port = atoi (optarg); break;
+			case ('r'): stats.rate = atof (optarg); break;
+			case ('u'): stats.users = atoi (optarg); break;
+			case ('l'): stats.link_ratio = atof (optarg); break;
+			case ('R'): stats.roll_ratio = atof (optarg); break;
+			case ('t'): duration = atof (optarg); break;
+			case ('k'): stats.kill_interval = atof (optarg); break;
+			case ('s'): stats.slow = atoi (optarg); break;
+			case ('m'): stats.moderator = true; break;
+			default:
+			{
+				fprintf (stderr, "usage: %s [-p port] [-r messages per second] [-u users] [-l link ratio] [-R roll ratio] [-t seconds] [-k seconds] [-s seconds] [-m]\n", argv[0]);
+				return 1;
+			}
+		}
+	}
+
+	signal (SIGINT, handleSignal);
+	signal (SIGTERM, handleSignal);
+	signal (SIGPIPE, SIG_IGN);
+
+	int listener = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int reuse = 1;
+	setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+	memset (&address, 0, sizeof (address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	address.sin_port = htons (port);
+	if ((bind (listener, (struct sockaddr *)&address, sizeof (address)) < 0) || (listen (listener, 64) < 0))
+	{
+		fprintf (stderr, "FakeTwitchServer: I was unable to listen on port %d, reason: %s.\n", port, strerror(errno));
+		return 1;
+	}
+
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl (epoll_fd, EPOLL_CTL_ADD, listener, &event);
+
+	printf ("FakeTwitchServer: Listening on port %d, sending %.0f messages per second from %u users, %.1f%% links and %.1f%% rolls.\n", port, stats.rate, stats.users, stats.link_ratio * 100, stats.roll_ratio * 100);
+	fflush (stdout);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	std::chrono::steady_clock::time_point load_start;
+	std::chrono::steady_clock::time_point last_report = start;
+	std::chrono::steady_clock::time_point next_kill = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stats.kill_interval));
+	std::chrono::steady_clock::time_point last_roll = start;
+	uint64_t last_sent = 0;
+	uint64_t last_replies = 0;
+	bool loading = false;
+
+	while (running)
+	{
+		int event_count = epoll_wait (epoll_fd, events, FAKE_MAX_EVENTS, 1);
+		for (int t = 0; t < event_count; t++)
+		{
+			if (events[t].data.ptr == NULL)
+			{
+				int sock;
+				while ((sock = accept4 (listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+				{
+					int nodelay = 1;
+					setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+
+					fake_client *client = new fake_client;
+					client->sock = sock;
+					clients.push_back (client);
+
+					memset (&event, 0, sizeof (event));
+					event.events = EPOLLIN;
+					event.data.ptr = client;
+					epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sock, &event);
+				}
+				continue;
+			}
+
+			fake_client *client = (fake_client *)events[t].data.ptr;
+			if ((events[t].events & EPOLLOUT) && (!client->out.empty ()))
+			{
+				ssize_t write_return = write (client->sock, client->out.data (), client->out.size ());
+				if (write_return > 0)
+				{
+					client->out.erase (0, write_return);
+				}
+				if (client->out.empty ())
+				{
+					memset (&event, 0, sizeof (event));
+					event.events = EPOLLIN;
+					event.data.ptr = client;
+					epoll_ctl (epoll_fd, EPOLL_CTL_MOD, client->sock, &event);
+				}
+			}
+
+			if (events[t].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				char buffer[65536];
+				ssize_t read_return = read (client->sock, buffer, sizeof (buffer));
+				if (read_return <= 0)
+				{
+					if ((read_return < 0) && (errno == EAGAIN))
+					{
+						continue;
+					}
+
+					// The bot went away, forget the client
+					if (last_replier == client)
+					{
+						last_replier = NULL;
+					}
+					close (client->sock);
+					clients.erase (std::remove (clients.begin (), clients.end (), client), clients.end ());
+					delete client;
+					continue;
+				}
+
+				client->in.append (buffer, read_return);
+				std::size_t end;
+				while ((end = client->in.find ('\n')) != std::string::npos)
+				{
+					std::string line = client->in.substr (0, end);
+					client->in.erase (0, end + 1);
+					if ((!line.empty ()) && (line.back () == '\r'))
+					{
+						line.pop_back ();
+					}
+					if (!line.empty ())
+					{
+						handleLine (client, line);
+					}
+				}
+			}
+		}
+
+		// Start the load once the bot has joined somewhere, and keep sending at the requested rate
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+		if (!loading)
+		{
+			for (fake_client *client : clients)
+			{
+				loading |= (std::count_if (client->rooms.begin (), client->rooms.end (), [](const std::string &room) { return room != "#jtv"; }) > 0);
+			}
+			load_start = now;
+			continue;
+		}
+
+		double elapsed = std::chrono::duration<double>(now - load_start).count ();
+		if ((duration > 0) && (elapsed >= duration))
+		{
+			break;
+		}
+		while (stats.sent + stats.skipped < (uint64_t)(elapsed * stats.rate))
+		{
+			// Chat due while the bot is reconnecting is skipped rather than sent in a burst afterwards
+			if (!sendChat (false))
+			{
+				stats.skipped = (uint64_t)(elapsed * stats.rate) - stats.sent;
+			}
+		}
+
+		// Drop the connection the bot is talking on, then keep rolling until it answers on another one
+		if ((stats.kill_interval > 0) && (!stats.failing_over) && (last_replier != NULL) && (now >= next_kill))
+		{
+			close (last_replier->sock);
+			clients.erase (std::remove (clients.begin (), clients.end (), last_replier), clients.end ());
+			delete last_replier;
+			last_replier = NULL;
+			stats.kills++;
+			stats.failing_over = true;
+			stats.killed = now;
+			next_kill = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stats.kill_interval));
+			printf ("FakeTwitchServer: Dropped the bot's chat connection.\n");
+		}
+		if ((stats.failing_over) && ((now - last_roll) >= std::chrono::milliseconds(100)))
+		{
+			sendChat (true);
+			last_roll = now;
+		}
+
+		if ((now - last_report) >= std::chrono::seconds(1))
+		{
+			printf ("FakeTwitchServer: %.0fs sent %llu/s, %llu replies/s, %zu rolls answered\n", elapsed, (unsigned long long)(stats.sent - last_sent), (unsigned long long)(stats.replies - last_replies), stats.latencies.size ());
+			fflush (stdout);
+			last_sent = stats.sent;
+			last_replies = stats.replies;
+			last_report = now;
+		}
+	}
+
+	// Rolls that were never answered are counted as lost
+	std::vector<double> sorted = stats.latencies;
+	std::sort (sorted.begin (), sorted.end ());
+	double elapsed = loading ? std::chrono::duration<double>(std::chrono::steady_clock::now () - load_start).count () : 0;
+
+	printf ("\nFakeTwitchServer results over %.1f seconds\n", elapsed);
+	printf ("  sent %llu messages (%.0f/s), %llu rolls, %llu links, %llu dropped, %llu skipped\n", (unsigned long long)stats.sent, (elapsed > 0) ? stats.sent / elapsed : 0, (unsigned long long)stats.rolls, (unsigned long long)stats.links, (unsigned long long)stats.dropped, (unsigned long long)stats.skipped);
+	printf ("  received %llu replies (%.1f/s), %llu timeouts, %llu pings\n", (unsigned long long)stats.replies, (elapsed > 0) ? stats.replies / elapsed : 0, (unsigned long long)stats.timeouts, (unsigned long long)stats.pings);
+	printf ("  refused %llu replies for slow mode, %llu replies went over the rate limit\n", (unsigned long long)stats.refused, (unsigned long long)stats.over_limit);
+	printf ("  rolls answered %zu of %llu, %llu lost\n", sorted.size (), (unsigned long long)stats.rolls, (unsigned long long)(stats.rolls - sorted.size ()));
+	printf ("  roll reply latency ms: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n", percentile (sorted, 0.50), percentile (sorted, 0.90), percentile (sorted, 0.99), sorted.empty () ? 0 : sorted.back ());
+	if (stats.kills > 0)
+	{
+		std::vector<double> outages = stats.outages;
+		std::sort (outages.begin (), outages.end ());
+		printf ("  dropped the bot's chat connection %llu times, replies came back after ms: p50 %.2f, max %.2f, %zu never\n", (unsigned long long)stats.kills,
+			percentile (outages, 0.50), outages.empty () ? 0 : outages.back (), (size_t)stats.kills - outages.size ());
+	}
+
+	for (fake_client *client : clients)
+	{
+		close (client->sock);
+		delete client;
+	}
+	close (listener);
+	close (epoll_fd);
+
+	return 0;
+}
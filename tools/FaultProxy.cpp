@@ -0,0 +1,665 @@
+// g++ -std=c++17 -O2 -Wall FaultProxy.cpp -o FaultProxy
+// A local TCP proxy that sits between the bot and a stand-in server and breaks the connections on a schedule,
+// usage: ./FaultProxy [-l listen port] [-u upstream port] [-g gap seconds] [-d fault seconds] fault...
+// Faults are run in the order given, each for -d seconds with -g seconds between them, and can be any of
+// latency:<ms>, drop, stall, halfclose or reset. For example, with FakeTwitchServer on 6667:
+//   ./FakeTwitchServer -p 6667 -r 20 -R 0.01 &
+//   ./FaultProxy -l 6668 -u 6667 latency:500 drop stall halfclose reset
+// and "IRC Host = 127.0.0.1" and "IRC Port = 6668" in SkidBot.cfg. Keep the roll rate under the bots
+// send rate, otherwise rolls it's still queueing at the end of a phase are counted as lost.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define PROXY_MAX_EVENTS	64
+#define PROXY_MAX_BUFFER	(64 * 1024 * 1024)
+
+// Fault type defines
+#define FAULT_NONE			0
+#define FAULT_LATENCY		1
+#define FAULT_DROP			2
+#define FAULT_STALL			3
+#define FAULT_HALFCLOSE		4
+#define FAULT_RESET			5
+
+typedef std::chrono::steady_clock::time_point proxy_time;
+
+// Holds data read from one side that's waiting to be written to the other, delayed chunks wait for their due time
+typedef struct proxy_chunk
+{
+	proxy_time due;
+	std::string data;
+} proxy_chunk;
+
+// Holds one direction of a proxied connection
+typedef struct proxy_flow
+{
+	int from = -1;
+	int to = -1;
+	std::deque<proxy_chunk> chunks;
+	std::string line;				// Partial line carried over for the roll id scan
+	bool closed = false;			// The reading side has hung up
+	bool shut = false;				// The hang up has been passed along
+} proxy_flow;
+
+// Holds a bot connection and its matching connection to the server
+typedef struct proxy_pair
+{
+	int down = -1;					// The bots side
+	int up = -1;					// The servers side
+	proxy_flow to_up;
+	proxy_flow to_down;
+	proxy_time opened;
+	int phase = -1;					// The fault phase that was applied to this pair, -1 if none
+	bool stalled = false;
+	uint32_t watched[2] = {EPOLLIN, EPOLLIN};	// What each side is registered for, so unchanged sides are skipped
+} proxy_pair;
+
+// Holds a scheduled fault and what was measured while it ran
+typedef struct proxy_fault
+{
+	int type = FAULT_NONE;
+	int latency = 0;
+	std::string name;
+	proxy_time start;
+	proxy_time end;
+	double noticed = -1;			// Seconds from the fault until the bot dropped the connection or opened a new one
+	double recovered = -1;			// Seconds from the fault until a roll was answered on a working connection
+	uint64_t rolls = 0;
+	uint64_t dropped = 0;			// Chunks thrown away by the fault
+} proxy_fault;
+
+static std::vector<proxy_pair *> pairs;
+static std::vector<proxy_fault> faults;
+static std::unordered_map<uint64_t, int> unanswered;	// Roll ids seen going to the bot, and the phase they were sent in
+static int epoll_fd = -1;
+static int upstream_port = 6667;
+static int phase = -1;				// The fault running or recovering now, -1 during the baseline
+static bool active = false;			// The current fault is still being applied
+static volatile bool running = true;
+
+
+/**
+ * Stops the proxy on SIGINT or SIGTERM so the results get printed
+ */
+static void handleSignal (int)
+{
+	running = false;
+}
+
+
+/**
+ * Returns the seconds between two times
+ */
+static double seconds (proxy_time from, proxy_time to)
+{
+	return std::chrono::duration<double>(to - from).count ();
+}
+
+
+/**
+ * Sets which events a pair's sockets are watched for, reads are left off while stalled and writes are
+ * only watched while there's something ready to go
+ */
+static void watchPair (proxy_pair *pair)
+{
+	proxy_time now = std::chrono::steady_clock::now ();
+	struct epoll_event event;
+
+	int sides[2] = {pair->down, pair->up};
+	proxy_flow *outgoing[2] = {&pair->to_down, &pair->to_up};
+	proxy_flow *incoming[2] = {&pair->to_up, &pair->to_down};
+	for (int t = 0; t < 2; t++)
+	{
+		if (sides[t] < 0)
+		{
+			continue;
+		}
+
+		memset (&event, 0, sizeof (event));
+		event.events = ((pair->stalled || incoming[t]->closed) ? 0 : EPOLLIN);
+		if ((!outgoing[t]->chunks.empty ()) && (outgoing[t]->chunks.front ().due <= now))
+		{
+			event.events |= EPOLLOUT;
+		}
+		event.data.ptr = pair;
+		if (event.events != pair->watched[t])
+		{
+			epoll_ctl (epoll_fd, EPOLL_CTL_MOD, sides[t], &event);
+			pair->watched[t] = event.events;
+		}
+	}
+}
+
+
+/**
+ * Closes both sides of a pair, with reset set the sockets are aborted with an RST instead of a FIN
+ */
+static void closePair (proxy_pair *pair, bool reset)
+{
+	int sides[2] = {pair->down, pair->up};
+	for (int t = 0; t < 2; t++)
+	{
+		if (sides[t] < 0)
+		{
+			continue;
+		}
+		if (reset)
+		{
+			struct linger linger = {1, 0};
+			setsockopt (sides[t], SOL_SOCKET, SO_LINGER, &linger, sizeof (linger));
+		}
+		epoll_ctl (epoll_fd, EPOLL_CTL_DEL, sides[t], NULL);
+		close (sides[t]);
+	}
+
+	pairs.erase (std::remove (pairs.begin (), pairs.end (), pair), pairs.end ());
+	delete pair;
+}
+
+
+/**
+ * Records the bot noticing the current fault, the first sign wins
+ */
+static void markNoticed (proxy_time now)
+{
+	if ((phase >= 0) && (faults[phase].noticed < 0))
+	{
+		faults[phase].noticed = seconds (faults[phase].start, now);
+	}
+}
+
+
+/**
+ * Looks through the complete lines in a chunk for roll ids, rolls going to the bot are remembered and
+ * the bots replies to them are matched off, a reply on a working connection after a fault means it
+ * has recovered
+ */
+static void scanChunk (proxy_pair *pair, proxy_flow *flow, const std::string &data, proxy_time now)
+{
+	bool to_bot = (flow == &pair->to_down);
+	std::size_t end;
+
+	flow->line += data;
+	while ((end = flow->line.find ('\n')) != std::string::npos)
+	{
+		std::size_t id = flow->line.find (" id");
+		if ((id < end) && (flow->line.find ("PRIVMSG") < id))
+		{
+			uint64_t roll = strtoull (flow->line.c_str () + id + 3, NULL, 10);
+			if (to_bot)
+			{
+				if (flow->line.find ("!roll") < id)
+				{
+					unanswered[roll] = phase;
+					if (phase >= 0)
+					{
+						faults[phase].rolls++;
+					}
+				}
+			}
+			else if (unanswered.erase (roll) > 0)
+			{
+				// The reply has to come over a connection the fault didn't break, or after the fault ended
+				if ((phase >= 0) && (faults[phase].recovered < 0) && ((!active) || (pair->phase != phase)))
+				{
+					faults[phase].recovered = seconds (faults[phase].start, now);
+				}
+			}
+		}
+		flow->line.erase (0, end + 1);
+	}
+
+	// Don't keep binary or endless lines
+	if (flow->line.size () > 4096)
+	{
+		flow->line.clear ();
+	}
+}
+
+
+/**
+ * Writes every due chunk the socket will take, returns -1 if the socket failed
+ */
+static int flushFlow (proxy_flow *flow, proxy_time now)
+{
+	while ((!flow->chunks.empty ()) && (flow->chunks.front ().due <= now) && (flow->to >= 0))
+	{
+		std::string &data = flow->chunks.front ().data;
+		ssize_t write_return = write (flow->to, data.data (), data.size ());
+		if (write_return < 0)
+		{
+			return ((errno == EAGAIN) ? 0 : -1);
+		}
+		data.erase (0, write_return);
+		if (data.empty ())
+		{
+			flow->chunks.pop_front ();
+		}
+	}
+
+	// Pass a hang up along once everything before it has been written
+	if ((flow->closed) && (!flow->shut) && (flow->chunks.empty ()) && (flow->to >= 0))
+	{
+		shutdown (flow->to, SHUT_WR);
+		flow->shut = true;
+	}
+	return 0;
+}
+
+
+/**
+ * Reads what's waiting on one side of a pair and queues it for the other, applying the current fault,
+ * returns -1 if the pair should be closed
+ */
+static int readFlow (proxy_pair *pair, proxy_flow *flow, proxy_time now)
+{
+	char buffer[65536];
+	bool faulted = ((active) && (pair->phase == phase));
+
+	while (true)
+	{
+		ssize_t read_return = read (flow->from, buffer, sizeof (buffer));
+		if (read_return < 0)
+		{
+			return (((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1);
+		}
+		if (read_return == 0)
+		{
+			flow->closed = true;
+			if ((flow == &pair->to_up) && (pair->phase >= 0))
+			{
+				// The bot gave up on a faulted connection
+				markNoticed (now);
+			}
+			return ((pair->to_up.closed && pair->to_down.closed) ? -1 : 0);
+		}
+
+		std::string data (buffer, read_return);
+		scanChunk (pair, flow, data, now);
+
+		if ((faulted) && (faults[phase].type == FAULT_DROP))
+		{
+			faults[phase].dropped++;
+			continue;
+		}
+
+		int delay = ((faulted) && (faults[phase].type == FAULT_LATENCY)) ? faults[phase].latency : 0;
+		size_t queued = 0;
+		for (proxy_chunk &chunk : flow->chunks)
+		{
+			queued += chunk.data.size ();
+		}
+		if (queued > PROXY_MAX_BUFFER)
+		{
+			return -1;
+		}
+		flow->chunks.push_back ({now + std::chrono::milliseconds(delay), data});
+	}
+}
+
+
+/**
+ * Accepts a new bot connection and connects it through to the server
+ */
+static void acceptPair (int listener, proxy_time now)
+{
+	struct sockaddr_in address;
+	struct epoll_event event;
+	int sock;
+
+	while ((sock = accept4 (listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		int up = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		memset (&address, 0, sizeof (address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		address.sin_port = htons (upstream_port);
+		if ((connect (up, (struct sockaddr *)&address, sizeof (address)) < 0) && (errno != EINPROGRESS))
+		{
+			fprintf (stderr, "FaultProxy: I was unable to connect to port %d, reason: %s.\n", upstream_port, strerror(errno));
+			close (up);
+			close (sock);
+			continue;
+		}
+
+		int nodelay = 1;
+		setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+		setsockopt (up, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+
+		proxy_pair *pair = new proxy_pair;
+		pair->down = sock;
+		pair->up = up;
+		pair->to_up.from = sock;
+		pair->to_up.to = up;
+		pair->to_down.from = up;
+		pair->to_down.to = sock;
+		pair->opened = now;
+		pairs.push_back (pair);
+
+		memset (&event, 0, sizeof (event));
+		event.events = EPOLLIN;
+		event.data.ptr = pair;
+		epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sock, &event);
+		epoll_ctl (epoll_fd, EPOLL_CTL_ADD, up, &event);
+
+		// A new connection while a faulted one is open, or after a reset closed them, means the bot has noticed
+		if ((phase >= 0) && (faults[phase].type == FAULT_RESET))
+		{
+			markNoticed (now);
+		}
+		else if (phase >= 0)
+		{
+			for (proxy_pair *other : pairs)
+			{
+				if (other->phase == phase)
+				{
+					markNoticed (now);
+					break;
+				}
+			}
+		}
+
+		printf ("FaultProxy: %s connection %zu open\n", (phase >= 0) ? faults[phase].name.c_str () : "baseline", pairs.size ());
+		fflush (stdout);
+	}
+}
+
+
+/**
+ * Starts a fault on every open connection
+ */
+static void startFault (proxy_time now)
+{
+	proxy_fault &fault = faults[phase];
+	fault.start = now;
+	active = true;
+
+	printf ("FaultProxy: Starting %s on %zu connections\n", fault.name.c_str (), pairs.size ());
+	fflush (stdout);
+
+	std::vector<proxy_pair *> current = pairs;
+	for (proxy_pair *pair : current)
+	{
+		pair->phase = phase;
+		switch (fault.type)
+		{
+			case (FAULT_STALL):
+			{
+				pair->stalled = true;
+				watchPair (pair);
+			}
+			break;
+
+			case (FAULT_HALFCLOSE):
+			{
+				// The bot reads an end of file but can still write to us
+				shutdown (pair->down, SHUT_WR);
+				pair->to_down.chunks.clear ();
+				pair->to_down.closed = true;
+				pair->to_down.shut = true;
+				watchPair (pair);
+			}
+			break;
+
+			case (FAULT_RESET):
+			{
+				closePair (pair, true);
+			}
+			break;
+		}
+	}
+}
+
+
+/**
+ * Stops the current fault, connections it broke for good stay broken
+ */
+static void endFault (proxy_time now)
+{
+	active = false;
+	faults[phase].end = now;
+
+	for (proxy_pair *pair : pairs)
+	{
+		if ((pair->phase == phase) && (pair->stalled))
+		{
+			pair->stalled = false;
+			watchPair (pair);
+		}
+	}
+}
+
+
+/**
+ * Reads a fault from the command line, returns false if it isn't one we know
+ */
+static bool parseFault (const char *argument, proxy_fault *fault)
+{
+	fault->name = argument;
+	if (strncmp (argument, "latency:", 8) == 0)
+	{
+		fault->type = FAULT_LATENCY;
+		fault->latency = atoi (argument + 8);
+		return (fault->latency > 0);
+	}
+
+	const char *names[] = {"drop", "stall", "halfclose", "reset"};
+	const int types[] = {FAULT_DROP, FAULT_STALL, FAULT_HALFCLOSE, FAULT_RESET};
+	for (int t = 0; t < 4; t++)
+	{
+		if (strcmp (argument, names[t]) == 0)
+		{
+			fault->type = types[t];
+			return true;
+		}
+	}
+	return false;
+}
+
+
+int main (int argc, char **argv)
+{
+	struct epoll_event events[PROXY_MAX_EVENTS];
+	struct sockaddr_in address;
+	int port = 6668;
+	double gap = 20;
+	double length = 10;
+	int option;
+
+	while ((option = getopt (argc, argv, "l:u:g:d:")) != -1)
+	{
+		switch (option)
+		{
+			case ('l'): port = atoi (optarg); break;
+			case ('u'): upstream_port = atoi (optarg); break;
+			case ('g'): gap = atof (optarg); break;
+			case ('d'): length = atof (optarg); break;
+			default: optind = argc + 1; break;
+		}
+	}
+	for (int t = optind; t < argc; t++)
+	{
+		proxy_fault fault;
+		if (!parseFault (argv[t], &fault))
+		{
+			optind = argc + 1;
+			break;
+		}
+		faults.push_back (fault);
+	}
+	if ((optind > argc) || (faults.empty ()))
+	{
+		fprintf (stderr, "usage: %s [-l listen port] [-u upstream port] [-g gap seconds] [-d fault seconds] latency:<ms>|drop|stall|halfclose|reset...\n", argv[0]);
+		return 1;
+	}
+
+	signal (SIGINT, handleSignal);
+	signal (SIGTERM, handleSignal);
+	signal (SIGPIPE, SIG_IGN);
+
+	int listener = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int reuse = 1;
+	setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+	memset (&address, 0, sizeof (address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	address.sin_port = htons (port);
+	if ((bind (listener, (struct sockaddr *)&address, sizeof (address)) < 0) || (listen (listener, 64) < 0))
+	{
+		fprintf (stderr, "FaultProxy: I was unable to listen on port %d, reason: %s.\n", port, strerror(errno));
+		return 1;
+	}
+
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	struct epoll_event event;
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl (epoll_fd, EPOLL_CTL_ADD, listener, &event);
+
+	printf ("FaultProxy: Listening on port %d for port %d, %zu faults of %.0fs with %.0fs between them.\n", port, upstream_port, faults.size (), length, gap);
+	fflush (stdout);
+
+	// The first gap is a baseline, so the schedule starts once the bot has connected
+	proxy_time next = std::chrono::steady_clock::time_point::max ();
+
+	while (running)
+	{
+		proxy_time now = std::chrono::steady_clock::now ();
+		int event_count = epoll_wait (epoll_fd, events, PROXY_MAX_EVENTS, 1);
+		now = std::chrono::steady_clock::now ();
+
+		for (int t = 0; t < event_count; t++)
+		{
+			if (events[t].data.ptr == NULL)
+			{
+				acceptPair (listener, now);
+				if (next == std::chrono::steady_clock::time_point::max ())
+				{
+					next = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(gap));
+				}
+				continue;
+			}
+
+			proxy_pair *pair = (proxy_pair *)events[t].data.ptr;
+			if (std::find (pairs.begin (), pairs.end (), pair) == pairs.end ())
+			{
+				// Closed earlier in this batch
+				continue;
+			}
+
+			int result = 0;
+			if ((events[t].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (!pair->stalled))
+			{
+				if (!pair->to_up.closed)
+				{
+					result |= readFlow (pair, &pair->to_up, now);
+				}
+				if ((result == 0) && (!pair->to_down.closed))
+				{
+					result |= readFlow (pair, &pair->to_down, now);
+				}
+			}
+			if (result == 0)
+			{
+				result |= flushFlow (&pair->to_up, now);
+				result |= flushFlow (&pair->to_down, now);
+			}
+
+			if (result < 0)
+			{
+				if (pair->phase >= 0)
+				{
+					markNoticed (now);
+				}
+				closePair (pair, false);
+				continue;
+			}
+			watchPair (pair);
+		}
+
+		// Delayed chunks don't wake epoll, so write out any that have come due
+		std::vector<proxy_pair *> current = pairs;
+		for (proxy_pair *pair : current)
+		{
+			if ((flushFlow (&pair->to_up, now) < 0) || (flushFlow (&pair->to_down, now) < 0))
+			{
+				closePair (pair, false);
+				continue;
+			}
+			watchPair (pair);
+		}
+
+		// Move the schedule along
+		if (now >= next)
+		{
+			if (active)
+			{
+				endFault (now);
+				next = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(gap));
+			}
+			else if (phase + 1 < (int)faults.size ())
+			{
+				phase++;
+				startFault (now);
+				next = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(length));
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+
+	// Rolls that never got a reply are lost, counted against the phase they were sent in
+	std::vector<uint64_t> lost (faults.size () + 1, 0);
+	for (std::pair<const uint64_t, int> &roll : unanswered)
+	{
+		lost[roll.second + 1]++;
+	}
+
+	printf ("\nFaultProxy results, noticed and recovered are seconds from the fault starting\n");
+	printf ("  %-14s %10s %10s %8s %8s %8s\n", "fault", "noticed", "recovered", "rolls", "lost", "dropped");
+	printf ("  %-14s %10s %10s %8s %8llu %8s\n", "baseline", "-", "-", "-", (unsigned long long)lost[0], "-");
+	for (size_t t = 0; t < faults.size (); t++)
+	{
+		char noticed[32] = "-";
+		char recovered[32] = "-";
+		if (faults[t].noticed >= 0)
+		{
+			snprintf (noticed, sizeof (noticed), "%.3f", faults[t].noticed);
+		}
+		if (faults[t].recovered >= 0)
+		{
+			snprintf (recovered, sizeof (recovered), "%.3f", faults[t].recovered);
+		}
+		printf ("  %-14s %10s %10s %8llu %8llu %8llu\n", faults[t].name.c_str (), noticed, recovered, (unsigned long long)faults[t].rolls, (unsigned long long)lost[t + 1], (unsigned long long)faults[t].dropped);
+	}
+
+	std::vector<proxy_pair *> current = pairs;
+	for (proxy_pair *pair : current)
+	{
+		closePair (pair, false);
+	}
+	close (listener);
+	close (epoll_fd);
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+// g++ -std=c++17 -O2 -Wall -I.. ParserBench.cpp ../IRCMessage.cpp -o ParserBench
+// Measures how many IRC lines per second parseIRCMessage can handle, usage: ./ParserBench [lines]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "IRCMessage.hpp"
+
+// A mix of what twitch sends us, weighted towards chat
+static const char *sample_lines[] =
+{
+	"@badge-info=;badges=moderator/1;color=#1E90FF;display-name=SkidInc;emotes=;first-msg=0;flags=;id=b34ccfc7-4977-403a-8a94-33c6bac34fb8;mod=1;room-id=12345678;subscriber=0;tmi-sent-ts=1507246572675;turbo=0;user-id=87654321;user-type=mod :skidinc!skidinc@skidinc.tmi.twitch.tv PRIVMSG #skidinc :!roll 4d6kh3 strength",
+	"@badge-info=subscriber/8;badges=subscriber/6;color=;display-name=Wolf7th;emotes=25:0-4;id=7eb848c9-1060-4e5e-9f4c-612877982e79;mod=0;room-id=12345678;subscriber=1;tmi-sent-ts=1507246572676;turbo=0;user-id=11223344;user-type= :wolf7th!wolf7th@wolf7th.tmi.twitch.tv PRIVMSG #skidinc :Kappa that was a great JOIN of the PART",
+	":martinferrer!martinferrer@martinferrer.tmi.twitch.tv PRIVMSG #skidinc :SkidBot, rules",
+	":ixtapa_!ixtapa_@ixtapa_.tmi.twitch.tv PRIVMSG #skidinc :\001ACTION waves at everyone\001",
+	"PING :tmi.twitch.tv",
+	":greenplane!greenplane@greenplane.tmi.twitch.tv JOIN #skidinc",
+	":htbrdd!htbrdd@htbrdd.tmi.twitch.tv PART #skidinc",
+	":skidbot.tmi.twitch.tv 353 skidbot = #skidinc :arceusthepokemon wolf7th martinferrer ixtapa_ verenthes greenplane htbrdd",
+	"@emote-only=0;followers-only=-1;r9k=0;room-id=12345678;slow=0;subs-only=0 :tmi.twitch.tv ROOMSTATE #skidinc",
+	":jtv MODE #skidinc +o paulscelus",
+};
+
+int main (int argc, char **argv)
+{
+	uint64_t line_count = 10000000;
+	if (argc > 1)
+	{
+		line_count = strtoull (argv[1], NULL, 10);
+	}
+
+	// Copy the samples in to strings, the same as the lines main pops off the receive queue
+	std::vector<std::string> lines;
+	for (const char *line : sample_lines)
+	{
+		lines.push_back (line);
+	}
+
+	irc_message_view parsed;
+	uint64_t checksum = 0;
+	uint64_t failed = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (uint64_t t = 0; t < line_count; t++)
+	{
+		if (parseIRCMessage (lines[t % lines.size ()], &parsed))
+		{
+			// Touch the results so the parse can't be optimised away
+			checksum += parsed.command.size () + parsed.param_count + parsed.tag_count + parsed.nick.size () + ircTrailing (&parsed).size ();
+		}
+		else
+		{
+			failed++;
+		}
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now ();
+
+	double seconds = std::chrono::duration<double>(end - start).count ();
+	uint64_t bytes = 0;
+	for (uint64_t t = 0; t < line_count; t++)
+	{
+		bytes += lines[t % lines.size ()].size ();
+	}
+
+	printf ("Parsed %llu lines in %.3f seconds, %llu failed, checksum %llu\n", (unsigned long long)line_count, seconds, (unsigned long long)failed, (unsigned long long)checksum);
+	printf ("%.0f lines per second, %.1f ns per line, %.1f MB/s\n", line_count / seconds, (seconds * 1e9) / line_count, (bytes / seconds) / 1e6);
+
+	return 0;
+}
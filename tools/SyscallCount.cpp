@@ -0,0 +1,206 @@
+// g++ -std=c++17 -O2 -Wall SyscallCount.cpp -o SyscallCount
+// Counts the system calls a program makes across all of its threads, and how much CPU it used, so the
+// reactor's backends can be compared under the same load from FakeTwitchServer,
+// usage: ./SyscallCount [-t seconds] [-n] [-m messages] command [arguments]
+// With -t the program is sent SIGINT after so many seconds, with -n it isn't traced so only the CPU use
+// is measured, and with -m the counts are also shown per message sent to it.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+static pid_t child = -1;
+
+
+/**
+ * Asks the program to stop once the time is up, it's sent SIGINT like pressing ctrl+c would
+ */
+static void handleAlarm (int)
+{
+	if (child > 0)
+	{
+		kill (child, SIGINT);
+	}
+}
+
+
+/**
+ * Names the system calls we expect to see, anything else is shown by number
+ */
+static std::string syscallName (long number)
+{
+	static const std::map<long, const char *> names = {
+		{SYS_read, "read"}, {SYS_write, "write"}, {SYS_readv, "readv"}, {SYS_writev, "writev"},
+		{SYS_openat, "openat"}, {SYS_close, "close"}, {SYS_lseek, "lseek"}, {SYS_newfstatat, "newfstatat"},
+		{SYS_fstat, "fstat"}, {SYS_epoll_wait, "epoll_wait"}, {SYS_epoll_pwait, "epoll_pwait"}, {SYS_epoll_ctl, "epoll_ctl"},
+		{SYS_io_uring_enter, "io_uring_enter"}, {SYS_futex, "futex"}, {SYS_recvfrom, "recvfrom"}, {SYS_sendto, "sendto"},
+		{SYS_recvmsg, "recvmsg"}, {SYS_sendmsg, "sendmsg"}, {SYS_clock_nanosleep, "clock_nanosleep"}, {SYS_nanosleep, "nanosleep"},
+		{SYS_clock_gettime, "clock_gettime"}, {SYS_poll, "poll"}, {SYS_ppoll, "ppoll"}, {SYS_mmap, "mmap"}, {SYS_munmap, "munmap"},
+		{SYS_brk, "brk"}, {SYS_socket, "socket"}, {SYS_connect, "connect"}, {SYS_getsockopt, "getsockopt"}, {SYS_setsockopt, "setsockopt"},
+		{SYS_rt_sigaction, "rt_sigaction"}, {SYS_rt_sigprocmask, "rt_sigprocmask"}, {SYS_madvise, "madvise"}, {SYS_mprotect, "mprotect"},
+		{SYS_execve, "execve"}, {SYS_pread64, "pread64"}, {SYS_eventfd2, "eventfd2"}, {SYS_epoll_create1, "epoll_create1"},
+		{SYS_io_uring_setup, "io_uring_setup"}, {SYS_io_uring_register, "io_uring_register"}, {SYS_clone3, "clone3"}, {SYS_clone, "clone"}
+	};
+
+	std::map<long, const char *>::const_iterator name = names.find (number);
+	return (name != names.end ()) ? name->second : ("syscall " + std::to_string (number));
+}
+
+
+int main (int argc, char **argv)
+{
+	std::map<long, uint64_t> counts;
+	double duration = 0;
+	double messages = 0;
+	bool tracing = true;
+	int status;
+	int option;
+
+	while ((option = getopt (argc, argv, "+t:nm:")) != -1)
+	{
+		switch (option)
+		{
+			case ('t'): duration = atof (optarg); break;
+			case ('n'): tracing = false; break;
+			case ('m'): messages = atof (optarg); break;
+			default:
+			{
+				fprintf (stderr, "usage: %s [-t seconds] [-n] [-m messages] command [arguments]\n", argv[0]);
+				return 1;
+			}
+		}
+	}
+	if (optind >= argc)
+	{
+		fprintf (stderr, "usage: %s [-t seconds] [-n] [-m messages] command [arguments]\n", argv[0]);
+		return 1;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	child = fork ();
+	if (child == 0)
+	{
+		if (tracing)
+		{
+			ptrace (PTRACE_TRACEME, 0, NULL, NULL);
+			raise (SIGSTOP);
+		}
+		execvp (argv[optind], &argv[optind]);
+		fprintf (stderr, "SyscallCount: I was unable to run %s, reason: %s.\n", argv[optind], strerror(errno));
+		_exit (127);
+	}
+	if (child < 0)
+	{
+		fprintf (stderr, "SyscallCount: I was unable to fork, reason: %s.\n", strerror(errno));
+		return 1;
+	}
+
+	signal (SIGALRM, handleAlarm);
+	signal (SIGINT, SIG_IGN);
+	if (duration > 0)
+	{
+		struct itimerval timer;
+		memset (&timer, 0, sizeof (timer));
+		timer.it_value.tv_sec = (time_t)duration;
+		timer.it_value.tv_usec = (suseconds_t)((duration - (time_t)duration) * 1000000);
+		setitimer (ITIMER_REAL, &timer, NULL);
+	}
+
+	if (tracing)
+	{
+		// Follow every thread, and tell system call stops apart from signals
+		waitpid (child, &status, 0);
+		if (ptrace (PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL) < 0)
+		{
+			fprintf (stderr, "SyscallCount: I'm not allowed to trace, reason: %s.\n", strerror(errno));
+			kill (child, SIGKILL);
+			return 1;
+		}
+		ptrace (PTRACE_SYSCALL, child, NULL, NULL);
+	}
+
+	while (true)
+	{
+		pid_t stopped = waitpid (-1, &status, __WALL);
+		if (stopped < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		if ((WIFEXITED (status)) || (WIFSIGNALED (status)) || (!tracing))
+		{
+			continue;
+		}
+
+		int signal_number = 0;
+		if ((WIFSTOPPED (status)) && (WSTOPSIG (status) == (SIGTRAP | 0x80)))
+		{
+			struct __ptrace_syscall_info info;
+			if ((ptrace (PTRACE_GET_SYSCALL_INFO, stopped, sizeof (info), &info) > 0) && (info.op == PTRACE_SYSCALL_INFO_ENTRY))
+			{
+				counts[info.entry.nr]++;
+			}
+		}
+		else if ((WIFSTOPPED (status)) && ((status >> 16) == 0) && (WSTOPSIG (status) != SIGSTOP) && (WSTOPSIG (status) != SIGTRAP))
+		{
+			// A real signal, pass it on
+			signal_number = WSTOPSIG (status);
+		}
+		ptrace (PTRACE_SYSCALL, stopped, NULL, signal_number);
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now () - start).count ();
+	struct rusage usage;
+	getrusage (RUSAGE_CHILDREN, &usage);
+	double user = usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec / 1000000.0);
+	double system = usage.ru_stime.tv_sec + (usage.ru_stime.tv_usec / 1000000.0);
+
+	printf ("SyscallCount: %s ran for %.1f seconds, using %.2fs user and %.2fs system CPU (%.1f%% of a core)\n", argv[optind], elapsed, user, system, (elapsed > 0) ? ((user + system) * 100) / elapsed : 0);
+	if (tracing)
+	{
+		std::vector<std::pair<uint64_t, long>> sorted;
+		uint64_t total = 0;
+		for (std::pair<const long, uint64_t> &count : counts)
+		{
+			sorted.push_back (std::make_pair (count.second, count.first));
+			total += count.second;
+		}
+		std::sort (sorted.rbegin (), sorted.rend ());
+
+		printf ("  %llu system calls (%.0f/s)", (unsigned long long)total, (elapsed > 0) ? total / elapsed : 0);
+		if (messages > 0)
+		{
+			printf (", %.2f per message", total / messages);
+		}
+		printf ("\n");
+		for (std::pair<uint64_t, long> &count : sorted)
+		{
+			printf ("  %-18s %10llu", syscallName (count.second).c_str (), (unsigned long long)count.first);
+			if (messages > 0)
+			{
+				printf ("  %8.3f per message", count.first / messages);
+			}
+			printf ("\n");
+		}
+	}
+
+	return 0;
+}